@@ -0,0 +1,1207 @@
+/*
+ * Copyright 2022 Google LLC
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "vautil.h"
+
+#include <getopt.h>
+
+#define H264DEC_TEST_MAX_SPS 32
+#define H264DEC_TEST_MAX_PPS 256
+#define H264DEC_TEST_MAX_REFS 16
+#define H264DEC_TEST_MAX_SLICES 256
+
+enum h264dec_test_nal_type {
+    H264DEC_TEST_NAL_SLICE = 1,
+    H264DEC_TEST_NAL_IDR = 5,
+    H264DEC_TEST_NAL_SEI = 6,
+    H264DEC_TEST_NAL_SPS = 7,
+    H264DEC_TEST_NAL_PPS = 8,
+    H264DEC_TEST_NAL_AUD = 9,
+};
+
+enum h264dec_test_slice_type {
+    H264DEC_TEST_SLICE_P = 0,
+    H264DEC_TEST_SLICE_B = 1,
+    H264DEC_TEST_SLICE_I = 2,
+    H264DEC_TEST_SLICE_SP = 3,
+    H264DEC_TEST_SLICE_SI = 4,
+};
+
+struct h264dec_test_bits {
+    const uint8_t *data;
+    size_t size;
+    size_t pos;
+};
+
+struct h264dec_test_sps {
+    bool valid;
+
+    int profile_idc;
+    int constraint_flags;
+    int level_idc;
+    int chroma_format_idc;
+    int bit_depth_luma_minus8;
+    int bit_depth_chroma_minus8;
+    bool seq_scaling_matrix_present_flag;
+    uint8_t scaling_list_4x4[6][16];
+    uint8_t scaling_list_8x8[6][64];
+    int log2_max_frame_num_minus4;
+    int pic_order_cnt_type;
+    int log2_max_pic_order_cnt_lsb_minus4;
+    bool delta_pic_order_always_zero_flag;
+    int max_num_ref_frames;
+    bool gaps_in_frame_num_value_allowed_flag;
+    int pic_width_in_mbs_minus1;
+    int pic_height_in_map_units_minus1;
+    bool frame_mbs_only_flag;
+    bool direct_8x8_inference_flag;
+};
+
+struct h264dec_test_pps {
+    bool valid;
+
+    int sps_id;
+    bool entropy_coding_mode_flag;
+    bool bottom_field_pic_order_in_frame_present_flag;
+    int num_ref_idx_l0_default_active_minus1;
+    int num_ref_idx_l1_default_active_minus1;
+    bool weighted_pred_flag;
+    int weighted_bipred_idc;
+    int pic_init_qp_minus26;
+    int pic_init_qs_minus26;
+    int chroma_qp_index_offset;
+    bool deblocking_filter_control_present_flag;
+    bool constrained_intra_pred_flag;
+    bool redundant_pic_cnt_present_flag;
+    bool transform_8x8_mode_flag;
+    uint8_t scaling_list_4x4[6][16];
+    uint8_t scaling_list_8x8[6][64];
+    int second_chroma_qp_index_offset;
+};
+
+struct h264dec_test_slice {
+    int nal_ref_idc;
+    int nal_unit_type;
+
+    int first_mb_in_slice;
+    int slice_type;
+    int pps_id;
+    int frame_num;
+    int pic_order_cnt_lsb;
+    int delta_pic_order_cnt_bottom;
+    int num_ref_idx_l0_active_minus1;
+    int modification_count;
+    int modification_of_pic_nums_idc[33];
+    int abs_diff_pic_num_minus1[33];
+    int cabac_init_idc;
+    int slice_qp_delta;
+    int disable_deblocking_filter_idc;
+    int slice_alpha_c0_offset_div2;
+    int slice_beta_offset_div2;
+
+    int luma_log2_weight_denom;
+    int chroma_log2_weight_denom;
+    bool luma_weight_l0_flag;
+    int luma_weight_l0[32];
+    int luma_offset_l0[32];
+    bool chroma_weight_l0_flag;
+    int chroma_weight_l0[32][2];
+    int chroma_offset_l0[32][2];
+
+    /* in bits, relative to the nal unit header */
+    int header_size;
+};
+
+struct h264dec_test_ref {
+    VASurfaceID surface;
+    int frame_num;
+    int frame_num_wrap;
+    int poc;
+};
+
+struct h264dec_test_file {
+    const void *ptr;
+    size_t size;
+
+    /* scratch space for emulation prevention removal */
+    uint8_t *rbsp;
+};
+
+struct h264dec_test {
+    VAProfile profile;
+    VAEntrypoint entrypoint;
+    struct va_init_params params;
+
+    struct va va;
+
+    struct h264dec_test_file file;
+
+    struct h264dec_test_sps sps[H264DEC_TEST_MAX_SPS];
+    struct h264dec_test_pps pps[H264DEC_TEST_MAX_PPS];
+
+    const struct h264dec_test_sps *active_sps;
+    int width;
+    int height;
+
+    VAConfigID config;
+    VAContextID context;
+    VASurfaceID surfaces[H264DEC_TEST_MAX_REFS + 2];
+    int surface_count;
+
+    /* short-term reference frames */
+    struct h264dec_test_ref refs[H264DEC_TEST_MAX_REFS];
+    int ref_count;
+
+    int prev_poc_msb;
+    int prev_poc_lsb;
+    int prev_frame_num;
+    int prev_frame_num_offset;
+
+    /* the picture being decoded */
+    bool in_picture;
+    struct h264dec_test_slice pic_slice;
+    VASurfaceID pic_surface;
+    int pic_poc;
+    uint64_t pic_begin;
+    VABufferID pic_bufs[2 + 2 * H264DEC_TEST_MAX_SLICES];
+    int pic_buf_count;
+
+    uint64_t *latencies;
+    int frame_count;
+    int frame_max;
+};
+
+static const uint8_t h264dec_test_zigzag_4x4[16] = {
+    0, 1, 4, 8, 5, 2, 3, 6, 9, 12, 13, 10, 7, 11, 14, 15,
+};
+
+static const uint8_t h264dec_test_zigzag_8x8[64] = {
+    0,  1,  8,  16, 9,  2,  3,  10, 17, 24, 32, 25, 18, 11, 4,  5,  12, 19, 26, 33, 40, 48,
+    41, 34, 27, 20, 13, 6,  7,  14, 21, 28, 35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23,
+    30, 37, 44, 51, 58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+};
+
+/* default scaling lists, in zigzag order */
+static const uint8_t h264dec_test_default_4x4[2][16] = {
+    { 6, 13, 13, 20, 20, 20, 28, 28, 28, 28, 32, 32, 32, 37, 37, 42 },
+    { 10, 14, 14, 20, 20, 20, 24, 24, 24, 24, 27, 27, 27, 30, 30, 34 },
+};
+
+static const uint8_t h264dec_test_default_8x8[2][64] = {
+    {
+        6,  10, 10, 13, 11, 13, 16, 16, 16, 16, 18, 18, 18, 18, 18, 23, 23, 23, 23, 23, 23, 25,
+        25, 25, 25, 25, 25, 25, 27, 27, 27, 27, 27, 27, 27, 27, 29, 29, 29, 29, 29, 29, 29, 31,
+        31, 31, 31, 31, 31, 33, 33, 33, 33, 33, 36, 36, 36, 36, 38, 38, 38, 40, 40, 42,
+    },
+    {
+        9,  13, 13, 15, 13, 15, 17, 17, 17, 17, 19, 19, 19, 19, 19, 21, 21, 21, 21, 21, 21, 22,
+        22, 22, 22, 22, 22, 22, 24, 24, 24, 24, 24, 24, 24, 24, 25, 25, 25, 25, 25, 25, 25, 27,
+        27, 27, 27, 27, 27, 28, 28, 28, 28, 28, 30, 30, 30, 30, 32, 32, 32, 33, 33, 35,
+    },
+};
+
+static unsigned int
+h264dec_test_bits_u(struct h264dec_test_bits *bits, int n)
+{
+    unsigned int val = 0;
+    for (int i = 0; i < n; i++) {
+        if (bits->pos >= bits->size * 8)
+            va_die("bitstream overrun");
+
+        const int bit = (bits->data[bits->pos / 8] >> (7 - bits->pos % 8)) & 1;
+        val = (val << 1) | bit;
+        bits->pos++;
+    }
+    return val;
+}
+
+static unsigned int
+h264dec_test_bits_ue(struct h264dec_test_bits *bits)
+{
+    int leading_zeros = 0;
+    while (!h264dec_test_bits_u(bits, 1)) {
+        leading_zeros++;
+        if (leading_zeros > 31)
+            va_die("invalid exp-golomb code");
+    }
+
+    return (1u << leading_zeros) - 1 + h264dec_test_bits_u(bits, leading_zeros);
+}
+
+static int
+h264dec_test_bits_se(struct h264dec_test_bits *bits)
+{
+    const unsigned int val = h264dec_test_bits_ue(bits);
+    return val & 1 ? (int)((val + 1) / 2) : -(int)(val / 2);
+}
+
+static bool
+h264dec_test_bits_more_rbsp_data(const struct h264dec_test_bits *bits)
+{
+    /* find rbsp_stop_one_bit */
+    size_t last = bits->size;
+    while (last > 0 && !bits->data[last - 1])
+        last--;
+    if (!last)
+        return false;
+
+    const int trailing = __builtin_ctz(bits->data[last - 1]);
+    const size_t stop_pos = last * 8 - 1 - trailing;
+
+    return bits->pos < stop_pos;
+}
+
+static size_t
+h264dec_test_unescape(uint8_t *dst, const uint8_t *src, size_t size)
+{
+    size_t count = 0;
+    int zeros = 0;
+    for (size_t i = 0; i < size; i++) {
+        if (zeros >= 2 && src[i] == 0x03) {
+            zeros = 0;
+            continue;
+        }
+
+        zeros = src[i] ? 0 : zeros + 1;
+        dst[count++] = src[i];
+    }
+    return count;
+}
+
+static void
+h264dec_test_parse_scaling_list(struct h264dec_test_bits *bits,
+                                uint8_t *list,
+                                int size,
+                                const uint8_t *fallback,
+                                const uint8_t *default_list)
+{
+    const uint8_t *zigzag = size == 16 ? h264dec_test_zigzag_4x4 : h264dec_test_zigzag_8x8;
+
+    if (!h264dec_test_bits_u(bits, 1)) {
+        memcpy(list, fallback, size);
+        return;
+    }
+
+    int last = 8;
+    int next = 8;
+    for (int i = 0; i < size; i++) {
+        if (next) {
+            const int delta = h264dec_test_bits_se(bits);
+            next = (last + delta + 256) % 256;
+
+            /* useDefaultScalingMatrixFlag */
+            if (!i && !next) {
+                for (int j = 0; j < size; j++)
+                    list[zigzag[j]] = default_list[j];
+                return;
+            }
+        }
+
+        last = next ? next : last;
+        list[zigzag[i]] = last;
+    }
+}
+
+static void
+h264dec_test_parse_scaling_matrix(struct h264dec_test_bits *bits,
+                                  int list_8x8_count,
+                                  uint8_t lists_4x4[6][16],
+                                  uint8_t lists_8x8[6][64],
+                                  const uint8_t fallback_4x4[6][16],
+                                  const uint8_t fallback_8x8[6][64])
+{
+    uint8_t defaults_4x4[2][16];
+    uint8_t defaults_8x8[2][64];
+    for (int i = 0; i < 2; i++) {
+        for (int j = 0; j < 16; j++)
+            defaults_4x4[i][h264dec_test_zigzag_4x4[j]] = h264dec_test_default_4x4[i][j];
+        for (int j = 0; j < 64; j++)
+            defaults_8x8[i][h264dec_test_zigzag_8x8[j]] = h264dec_test_default_8x8[i][j];
+    }
+
+    for (int i = 0; i < 6; i++) {
+        /* 0 for intra and 1 for inter */
+        const int type = i < 3 ? 0 : 1;
+        /* fall-back rule A uses the defaults, rule B uses the sps lists */
+        const uint8_t *fallback;
+        if (i == 0 || i == 3)
+            fallback = fallback_4x4 ? fallback_4x4[i] : defaults_4x4[type];
+        else
+            fallback = lists_4x4[i - 1];
+
+        h264dec_test_parse_scaling_list(bits, lists_4x4[i], 16, fallback,
+                                        h264dec_test_default_4x4[type]);
+    }
+
+    for (int i = 0; i < list_8x8_count; i++) {
+        const int type = i % 2;
+        const uint8_t *fallback;
+        if (i < 2)
+            fallback = fallback_8x8 ? fallback_8x8[i] : defaults_8x8[type];
+        else
+            fallback = lists_8x8[i - 2];
+
+        h264dec_test_parse_scaling_list(bits, lists_8x8[i], 64, fallback,
+                                        h264dec_test_default_8x8[type]);
+    }
+}
+
+static void
+h264dec_test_parse_sps(struct h264dec_test *test, struct h264dec_test_bits *bits)
+{
+    struct h264dec_test_sps sps = {
+        .valid = true,
+        .chroma_format_idc = 1,
+    };
+
+    sps.profile_idc = h264dec_test_bits_u(bits, 8);
+    sps.constraint_flags = h264dec_test_bits_u(bits, 8);
+    sps.level_idc = h264dec_test_bits_u(bits, 8);
+
+    const unsigned int sps_id = h264dec_test_bits_ue(bits);
+    if (sps_id >= H264DEC_TEST_MAX_SPS)
+        va_die("invalid sps id %u", sps_id);
+
+    memset(sps.scaling_list_4x4, 16, sizeof(sps.scaling_list_4x4));
+    memset(sps.scaling_list_8x8, 16, sizeof(sps.scaling_list_8x8));
+
+    switch (sps.profile_idc) {
+    case 100:
+    case 110:
+    case 122:
+    case 244:
+    case 44:
+    case 83:
+    case 86:
+    case 118:
+    case 128:
+    case 138:
+    case 139:
+    case 134:
+    case 135:
+        sps.chroma_format_idc = h264dec_test_bits_ue(bits);
+        if (sps.chroma_format_idc == 3 && h264dec_test_bits_u(bits, 1))
+            va_die("no separate colour plane support");
+        sps.bit_depth_luma_minus8 = h264dec_test_bits_ue(bits);
+        sps.bit_depth_chroma_minus8 = h264dec_test_bits_ue(bits);
+        /* qpprime_y_zero_transform_bypass_flag */
+        h264dec_test_bits_u(bits, 1);
+        sps.seq_scaling_matrix_present_flag = h264dec_test_bits_u(bits, 1);
+        if (sps.seq_scaling_matrix_present_flag) {
+            h264dec_test_parse_scaling_matrix(bits, sps.chroma_format_idc != 3 ? 2 : 6,
+                                              sps.scaling_list_4x4, sps.scaling_list_8x8, NULL,
+                                              NULL);
+        }
+        break;
+    default:
+        break;
+    }
+
+    if (sps.chroma_format_idc != 1 || sps.bit_depth_luma_minus8 || sps.bit_depth_chroma_minus8)
+        va_die("only 8-bit 4:2:0 is supported");
+
+    sps.log2_max_frame_num_minus4 = h264dec_test_bits_ue(bits);
+    sps.pic_order_cnt_type = h264dec_test_bits_ue(bits);
+    switch (sps.pic_order_cnt_type) {
+    case 0:
+        sps.log2_max_pic_order_cnt_lsb_minus4 = h264dec_test_bits_ue(bits);
+        break;
+    case 2:
+        break;
+    default:
+        va_die("no pic_order_cnt_type %d support", sps.pic_order_cnt_type);
+        break;
+    }
+
+    sps.max_num_ref_frames = h264dec_test_bits_ue(bits);
+    if (sps.max_num_ref_frames > H264DEC_TEST_MAX_REFS)
+        va_die("invalid max_num_ref_frames %d", sps.max_num_ref_frames);
+    sps.gaps_in_frame_num_value_allowed_flag = h264dec_test_bits_u(bits, 1);
+    sps.pic_width_in_mbs_minus1 = h264dec_test_bits_ue(bits);
+    sps.pic_height_in_map_units_minus1 = h264dec_test_bits_ue(bits);
+    sps.frame_mbs_only_flag = h264dec_test_bits_u(bits, 1);
+    if (!sps.frame_mbs_only_flag)
+        va_die("no interlaced support");
+    sps.direct_8x8_inference_flag = h264dec_test_bits_u(bits, 1);
+
+    /* frame cropping and vui are ignored */
+
+    test->sps[sps_id] = sps;
+}
+
+static void
+h264dec_test_parse_pps(struct h264dec_test *test, struct h264dec_test_bits *bits)
+{
+    struct h264dec_test_pps pps = {
+        .valid = true,
+    };
+
+    const unsigned int pps_id = h264dec_test_bits_ue(bits);
+    if (pps_id >= H264DEC_TEST_MAX_PPS)
+        va_die("invalid pps id %u", pps_id);
+
+    pps.sps_id = h264dec_test_bits_ue(bits);
+    if (pps.sps_id >= H264DEC_TEST_MAX_SPS || !test->sps[pps.sps_id].valid)
+        va_die("pps refers to missing sps %d", pps.sps_id);
+    const struct h264dec_test_sps *sps = &test->sps[pps.sps_id];
+
+    pps.entropy_coding_mode_flag = h264dec_test_bits_u(bits, 1);
+    pps.bottom_field_pic_order_in_frame_present_flag = h264dec_test_bits_u(bits, 1);
+    if (h264dec_test_bits_ue(bits))
+        va_die("no slice group support");
+    pps.num_ref_idx_l0_default_active_minus1 = h264dec_test_bits_ue(bits);
+    pps.num_ref_idx_l1_default_active_minus1 = h264dec_test_bits_ue(bits);
+    pps.weighted_pred_flag = h264dec_test_bits_u(bits, 1);
+    pps.weighted_bipred_idc = h264dec_test_bits_u(bits, 2);
+    pps.pic_init_qp_minus26 = h264dec_test_bits_se(bits);
+    pps.pic_init_qs_minus26 = h264dec_test_bits_se(bits);
+    pps.chroma_qp_index_offset = h264dec_test_bits_se(bits);
+    pps.deblocking_filter_control_present_flag = h264dec_test_bits_u(bits, 1);
+    pps.constrained_intra_pred_flag = h264dec_test_bits_u(bits, 1);
+    pps.redundant_pic_cnt_present_flag = h264dec_test_bits_u(bits, 1);
+
+    memcpy(pps.scaling_list_4x4, sps->scaling_list_4x4, sizeof(pps.scaling_list_4x4));
+    memcpy(pps.scaling_list_8x8, sps->scaling_list_8x8, sizeof(pps.scaling_list_8x8));
+    pps.second_chroma_qp_index_offset = pps.chroma_qp_index_offset;
+
+    if (h264dec_test_bits_more_rbsp_data(bits)) {
+        pps.transform_8x8_mode_flag = h264dec_test_bits_u(bits, 1);
+        if (h264dec_test_bits_u(bits, 1)) {
+            const int list_8x8_count =
+                pps.transform_8x8_mode_flag ? (sps->chroma_format_idc != 3 ? 2 : 6) : 0;
+            h264dec_test_parse_scaling_matrix(
+                bits, list_8x8_count, pps.scaling_list_4x4, pps.scaling_list_8x8,
+                sps->seq_scaling_matrix_present_flag ? sps->scaling_list_4x4 : NULL,
+                sps->seq_scaling_matrix_present_flag ? sps->scaling_list_8x8 : NULL);
+        }
+        pps.second_chroma_qp_index_offset = h264dec_test_bits_se(bits);
+    }
+
+    test->pps[pps_id] = pps;
+}
+
+static void
+h264dec_test_parse_pred_weight_table(struct h264dec_test_bits *bits,
+                                     struct h264dec_test_slice *slice)
+{
+    slice->luma_log2_weight_denom = h264dec_test_bits_ue(bits);
+    slice->chroma_log2_weight_denom = h264dec_test_bits_ue(bits);
+
+    for (int i = 0; i <= slice->num_ref_idx_l0_active_minus1; i++) {
+        slice->luma_weight_l0[i] = 1 << slice->luma_log2_weight_denom;
+        if (h264dec_test_bits_u(bits, 1)) {
+            slice->luma_weight_l0_flag = true;
+            slice->luma_weight_l0[i] = h264dec_test_bits_se(bits);
+            slice->luma_offset_l0[i] = h264dec_test_bits_se(bits);
+        }
+
+        for (int j = 0; j < 2; j++)
+            slice->chroma_weight_l0[i][j] = 1 << slice->chroma_log2_weight_denom;
+        if (h264dec_test_bits_u(bits, 1)) {
+            slice->chroma_weight_l0_flag = true;
+            for (int j = 0; j < 2; j++) {
+                slice->chroma_weight_l0[i][j] = h264dec_test_bits_se(bits);
+                slice->chroma_offset_l0[i][j] = h264dec_test_bits_se(bits);
+            }
+        }
+    }
+}
+
+static void
+h264dec_test_parse_slice(struct h264dec_test *test,
+                         struct h264dec_test_bits *bits,
+                         struct h264dec_test_slice *slice)
+{
+    slice->first_mb_in_slice = h264dec_test_bits_ue(bits);
+    slice->slice_type = h264dec_test_bits_ue(bits) % 5;
+    if (slice->slice_type != H264DEC_TEST_SLICE_P && slice->slice_type != H264DEC_TEST_SLICE_I)
+        va_die("only I and P slices are supported");
+
+    slice->pps_id = h264dec_test_bits_ue(bits);
+    if (slice->pps_id >= H264DEC_TEST_MAX_PPS || !test->pps[slice->pps_id].valid)
+        va_die("slice refers to missing pps %d", slice->pps_id);
+    const struct h264dec_test_pps *pps = &test->pps[slice->pps_id];
+    const struct h264dec_test_sps *sps = &test->sps[pps->sps_id];
+
+    slice->frame_num = h264dec_test_bits_u(bits, sps->log2_max_frame_num_minus4 + 4);
+    if (slice->nal_unit_type == H264DEC_TEST_NAL_IDR)
+        h264dec_test_bits_ue(bits); /* idr_pic_id */
+
+    if (sps->pic_order_cnt_type == 0) {
+        slice->pic_order_cnt_lsb =
+            h264dec_test_bits_u(bits, sps->log2_max_pic_order_cnt_lsb_minus4 + 4);
+        if (pps->bottom_field_pic_order_in_frame_present_flag)
+            slice->delta_pic_order_cnt_bottom = h264dec_test_bits_se(bits);
+    }
+
+    if (pps->redundant_pic_cnt_present_flag && h264dec_test_bits_ue(bits))
+        va_die("no redundant picture support");
+
+    slice->num_ref_idx_l0_active_minus1 = pps->num_ref_idx_l0_default_active_minus1;
+    if (slice->slice_type == H264DEC_TEST_SLICE_P) {
+        /* num_ref_idx_active_override_flag */
+        if (h264dec_test_bits_u(bits, 1))
+            slice->num_ref_idx_l0_active_minus1 = h264dec_test_bits_ue(bits);
+        if (slice->num_ref_idx_l0_active_minus1 >= 32)
+            va_die("invalid num_ref_idx_l0_active_minus1");
+
+        /* ref_pic_list_modification_flag_l0 */
+        if (h264dec_test_bits_u(bits, 1)) {
+            while (true) {
+                const int idc = h264dec_test_bits_ue(bits);
+                if (idc == 3)
+                    break;
+                if (idc > 1)
+                    va_die("no long-term ref pic list modification support");
+                if (slice->modification_count >= (int)ARRAY_SIZE(slice->abs_diff_pic_num_minus1))
+                    va_die("too many ref pic list modifications");
+
+                slice->modification_of_pic_nums_idc[slice->modification_count] = idc;
+                slice->abs_diff_pic_num_minus1[slice->modification_count] =
+                    h264dec_test_bits_ue(bits);
+                slice->modification_count++;
+            }
+        }
+
+        if (pps->weighted_pred_flag)
+            h264dec_test_parse_pred_weight_table(bits, slice);
+    }
+
+    if (slice->nal_ref_idc) {
+        if (slice->nal_unit_type == H264DEC_TEST_NAL_IDR) {
+            /* no_output_of_prior_pics_flag */
+            h264dec_test_bits_u(bits, 1);
+            /* long_term_reference_flag */
+            if (h264dec_test_bits_u(bits, 1))
+                va_die("no long-term reference support");
+        } else {
+            /* adaptive_ref_pic_marking_mode_flag */
+            if (h264dec_test_bits_u(bits, 1))
+                va_die("no adaptive reference marking support");
+        }
+    }
+
+    if (pps->entropy_coding_mode_flag && slice->slice_type != H264DEC_TEST_SLICE_I)
+        slice->cabac_init_idc = h264dec_test_bits_ue(bits);
+
+    slice->slice_qp_delta = h264dec_test_bits_se(bits);
+
+    if (pps->deblocking_filter_control_present_flag) {
+        slice->disable_deblocking_filter_idc = h264dec_test_bits_ue(bits);
+        if (slice->disable_deblocking_filter_idc != 1) {
+            slice->slice_alpha_c0_offset_div2 = h264dec_test_bits_se(bits);
+            slice->slice_beta_offset_div2 = h264dec_test_bits_se(bits);
+        }
+    }
+
+    slice->header_size = bits->pos;
+}
+
+static VAPictureH264
+h264dec_test_va_picture(VASurfaceID surface, int frame_num, int poc, uint32_t flags)
+{
+    return (VAPictureH264){
+        .picture_id = surface,
+        .frame_idx = frame_num,
+        .flags = flags,
+        .TopFieldOrderCnt = poc,
+        .BottomFieldOrderCnt = poc,
+    };
+}
+
+static VAPictureH264
+h264dec_test_va_picture_invalid(void)
+{
+    return h264dec_test_va_picture(VA_INVALID_SURFACE, 0, 0, VA_PICTURE_H264_INVALID);
+}
+
+static int
+h264dec_test_compare_refs(const void *a, const void *b)
+{
+    const struct h264dec_test_ref *x = a;
+    const struct h264dec_test_ref *y = b;
+
+    /* descending PicNum */
+    return y->frame_num_wrap - x->frame_num_wrap;
+}
+
+static void
+h264dec_test_update_refs(struct h264dec_test *test, int frame_num)
+{
+    const int max_frame_num = 1 << (test->active_sps->log2_max_frame_num_minus4 + 4);
+
+    for (int i = 0; i < test->ref_count; i++) {
+        struct h264dec_test_ref *ref = &test->refs[i];
+        ref->frame_num_wrap =
+            ref->frame_num > frame_num ? ref->frame_num - max_frame_num : ref->frame_num;
+    }
+
+    qsort(test->refs, test->ref_count, sizeof(test->refs[0]), h264dec_test_compare_refs);
+}
+
+static void
+h264dec_test_init_ref_list(struct h264dec_test *test,
+                           const struct h264dec_test_slice *slice,
+                           const struct h264dec_test_ref **list)
+{
+    const int max_pic_num = 1 << (test->active_sps->log2_max_frame_num_minus4 + 4);
+    const int count = slice->num_ref_idx_l0_active_minus1 + 1;
+
+    /* refs are sorted by descending PicNum */
+    for (int i = 0; i < count; i++)
+        list[i] = i < test->ref_count ? &test->refs[i] : NULL;
+
+    int pred = slice->frame_num;
+    int ref_idx = 0;
+    for (int i = 0; i < slice->modification_count; i++) {
+        const int diff = slice->abs_diff_pic_num_minus1[i] + 1;
+        int no_wrap;
+        if (slice->modification_of_pic_nums_idc[i] == 0) {
+            no_wrap = pred - diff;
+            if (no_wrap < 0)
+                no_wrap += max_pic_num;
+        } else {
+            no_wrap = pred + diff;
+            if (no_wrap >= max_pic_num)
+                no_wrap -= max_pic_num;
+        }
+        pred = no_wrap;
+
+        const int pic_num = no_wrap > slice->frame_num ? no_wrap - max_pic_num : no_wrap;
+        const struct h264dec_test_ref *ref = NULL;
+        for (int j = 0; j < test->ref_count; j++) {
+            if (test->refs[j].frame_num_wrap == pic_num) {
+                ref = &test->refs[j];
+                break;
+            }
+        }
+        if (!ref)
+            va_die("missing reference picture %d", pic_num);
+
+        /* insert ref at ref_idx and remove its duplicate */
+        for (int j = count; j > ref_idx; j--)
+            list[j] = list[j - 1];
+        list[ref_idx++] = ref;
+
+        int n = ref_idx;
+        for (int j = ref_idx; j <= count; j++) {
+            if (list[j] != ref)
+                list[n++] = list[j];
+        }
+    }
+}
+
+static VASurfaceID
+h264dec_test_alloc_surface(struct h264dec_test *test)
+{
+    for (int i = 0; i < test->surface_count; i++) {
+        const VASurfaceID surf = test->surfaces[i];
+
+        bool used = false;
+        for (int j = 0; j < test->ref_count; j++) {
+            if (test->refs[j].surface == surf) {
+                used = true;
+                break;
+            }
+        }
+
+        if (!used)
+            return surf;
+    }
+
+    va_die("dpb overflow");
+}
+
+static int
+h264dec_test_compute_poc(struct h264dec_test *test, const struct h264dec_test_slice *slice)
+{
+    const struct h264dec_test_sps *sps = test->active_sps;
+    const bool idr = slice->nal_unit_type == H264DEC_TEST_NAL_IDR;
+
+    if (sps->pic_order_cnt_type == 0) {
+        const int max_lsb = 1 << (sps->log2_max_pic_order_cnt_lsb_minus4 + 4);
+        const int lsb = slice->pic_order_cnt_lsb;
+
+        if (idr) {
+            test->prev_poc_msb = 0;
+            test->prev_poc_lsb = 0;
+        }
+
+        int msb;
+        if (lsb < test->prev_poc_lsb && test->prev_poc_lsb - lsb >= max_lsb / 2)
+            msb = test->prev_poc_msb + max_lsb;
+        else if (lsb > test->prev_poc_lsb && lsb - test->prev_poc_lsb > max_lsb / 2)
+            msb = test->prev_poc_msb - max_lsb;
+        else
+            msb = test->prev_poc_msb;
+
+        if (slice->nal_ref_idc) {
+            test->prev_poc_msb = msb;
+            test->prev_poc_lsb = lsb;
+        }
+
+        const int top = msb + lsb;
+        const int bottom = top + slice->delta_pic_order_cnt_bottom;
+        return top < bottom ? top : bottom;
+    } else {
+        const int max_frame_num = 1 << (sps->log2_max_frame_num_minus4 + 4);
+
+        int frame_num_offset;
+        if (idr)
+            frame_num_offset = 0;
+        else if (test->prev_frame_num > slice->frame_num)
+            frame_num_offset = test->prev_frame_num_offset + max_frame_num;
+        else
+            frame_num_offset = test->prev_frame_num_offset;
+
+        test->prev_frame_num = slice->frame_num;
+        test->prev_frame_num_offset = frame_num_offset;
+
+        if (idr)
+            return 0;
+        return 2 * (frame_num_offset + slice->frame_num) - (slice->nal_ref_idc ? 0 : 1);
+    }
+}
+
+static void
+h264dec_test_init_context(struct h264dec_test *test, const struct h264dec_test_sps *sps)
+{
+    const unsigned int rt_format = VA_RT_FORMAT_YUV420;
+    const unsigned int pix_format = VA_FOURCC_NV12;
+    struct va *va = &test->va;
+
+    const int width = (sps->pic_width_in_mbs_minus1 + 1) * 16;
+    const int height = (sps->pic_height_in_map_units_minus1 + 1) * 16;
+    if (test->active_sps) {
+        if (width != test->width || height != test->height)
+            va_die("no resolution change support");
+        test->active_sps = sps;
+        return;
+    }
+
+    switch (sps->profile_idc) {
+    case 66:
+        test->profile = VAProfileH264ConstrainedBaseline;
+        break;
+    case 77:
+        test->profile = VAProfileH264Main;
+        break;
+    default:
+        test->profile = VAProfileH264High;
+        break;
+    }
+    /* high profile decoders can decode the subsets */
+    if (!va_find_pair(va, test->profile, test->entrypoint))
+        test->profile = VAProfileH264High;
+    if (!va_find_pair(va, test->profile, test->entrypoint))
+        va_die("no h264 decode support");
+
+    test->active_sps = sps;
+    test->width = width;
+    test->height = height;
+
+    test->surface_count = (sps->max_num_ref_frames ? sps->max_num_ref_frames : 1) + 1;
+    test->config = va_create_config(va, test->profile, test->entrypoint, rt_format);
+    for (int i = 0; i < test->surface_count; i++)
+        test->surfaces[i] = va_create_surface(va, rt_format, width, height, pix_format);
+
+    test->context = va_create_context(va, test->config, width, height, VA_PROGRESSIVE,
+                                      test->surfaces, test->surface_count);
+}
+
+static void
+h264dec_test_begin_picture(struct h264dec_test *test, const struct h264dec_test_slice *slice)
+{
+    const struct h264dec_test_pps *pps = &test->pps[slice->pps_id];
+    const struct h264dec_test_sps *sps = &test->sps[pps->sps_id];
+    struct va *va = &test->va;
+
+    h264dec_test_init_context(test, sps);
+
+    if (slice->nal_unit_type == H264DEC_TEST_NAL_IDR)
+        test->ref_count = 0;
+    h264dec_test_update_refs(test, slice->frame_num);
+
+    test->in_picture = true;
+    test->pic_slice = *slice;
+    test->pic_surface = h264dec_test_alloc_surface(test);
+    test->pic_poc = h264dec_test_compute_poc(test, slice);
+    test->pic_buf_count = 0;
+
+    VAPictureParameterBufferH264 pic_param = {
+        .CurrPic = h264dec_test_va_picture(
+            test->pic_surface, slice->frame_num, test->pic_poc,
+            slice->nal_ref_idc ? VA_PICTURE_H264_SHORT_TERM_REFERENCE : 0),
+        .picture_width_in_mbs_minus1 = sps->pic_width_in_mbs_minus1,
+        .picture_height_in_mbs_minus1 = sps->pic_height_in_map_units_minus1,
+        .bit_depth_luma_minus8 = sps->bit_depth_luma_minus8,
+        .bit_depth_chroma_minus8 = sps->bit_depth_chroma_minus8,
+        .num_ref_frames = sps->max_num_ref_frames,
+        .seq_fields.bits = {
+            .chroma_format_idc = sps->chroma_format_idc,
+            .gaps_in_frame_num_value_allowed_flag = sps->gaps_in_frame_num_value_allowed_flag,
+            .frame_mbs_only_flag = sps->frame_mbs_only_flag,
+            .direct_8x8_inference_flag = sps->direct_8x8_inference_flag,
+            .MinLumaBiPredSize8x8 = sps->level_idc >= 31,
+            .log2_max_frame_num_minus4 = sps->log2_max_frame_num_minus4,
+            .pic_order_cnt_type = sps->pic_order_cnt_type,
+            .log2_max_pic_order_cnt_lsb_minus4 = sps->log2_max_pic_order_cnt_lsb_minus4,
+            .delta_pic_order_always_zero_flag = sps->delta_pic_order_always_zero_flag,
+        },
+        .pic_init_qp_minus26 = pps->pic_init_qp_minus26,
+        .pic_init_qs_minus26 = pps->pic_init_qs_minus26,
+        .chroma_qp_index_offset = pps->chroma_qp_index_offset,
+        .second_chroma_qp_index_offset = pps->second_chroma_qp_index_offset,
+        .pic_fields.bits = {
+            .entropy_coding_mode_flag = pps->entropy_coding_mode_flag,
+            .weighted_pred_flag = pps->weighted_pred_flag,
+            .weighted_bipred_idc = pps->weighted_bipred_idc,
+            .transform_8x8_mode_flag = pps->transform_8x8_mode_flag,
+            .constrained_intra_pred_flag = pps->constrained_intra_pred_flag,
+            .pic_order_present_flag = pps->bottom_field_pic_order_in_frame_present_flag,
+            .deblocking_filter_control_present_flag = pps->deblocking_filter_control_present_flag,
+            .redundant_pic_cnt_present_flag = pps->redundant_pic_cnt_present_flag,
+            .reference_pic_flag = slice->nal_ref_idc != 0,
+        },
+        .frame_num = slice->frame_num,
+    };
+    for (int i = 0; i < H264DEC_TEST_MAX_REFS; i++) {
+        if (i < test->ref_count) {
+            const struct h264dec_test_ref *ref = &test->refs[i];
+            pic_param.ReferenceFrames[i] = h264dec_test_va_picture(
+                ref->surface, ref->frame_num, ref->poc, VA_PICTURE_H264_SHORT_TERM_REFERENCE);
+        } else {
+            pic_param.ReferenceFrames[i] = h264dec_test_va_picture_invalid();
+        }
+    }
+
+    VAIQMatrixBufferH264 iq_matrix;
+    memcpy(iq_matrix.ScalingList4x4, pps->scaling_list_4x4, sizeof(iq_matrix.ScalingList4x4));
+    memcpy(iq_matrix.ScalingList8x8[0], pps->scaling_list_8x8[0],
+           sizeof(iq_matrix.ScalingList8x8[0]));
+    memcpy(iq_matrix.ScalingList8x8[1], pps->scaling_list_8x8[1],
+           sizeof(iq_matrix.ScalingList8x8[1]));
+
+    test->pic_begin = va_now();
+    va_begin_picture(va, test->context, test->pic_surface);
+
+    test->pic_bufs[test->pic_buf_count++] = va_create_buffer(
+        va, test->context, VAPictureParameterBufferType, sizeof(pic_param), &pic_param);
+    test->pic_bufs[test->pic_buf_count++] =
+        va_create_buffer(va, test->context, VAIQMatrixBufferType, sizeof(iq_matrix), &iq_matrix);
+    va_render_picture(va, test->context, test->pic_bufs, test->pic_buf_count);
+}
+
+static void
+h264dec_test_decode_slice(struct h264dec_test *test,
+                          const struct h264dec_test_slice *slice,
+                          const void *nal,
+                          size_t nal_size)
+{
+    struct va *va = &test->va;
+
+    if (test->pic_buf_count + 2 > (int)ARRAY_SIZE(test->pic_bufs))
+        va_die("too many slices");
+
+    VASliceParameterBufferH264 slice_param = {
+        .slice_data_size = nal_size,
+        .slice_data_offset = 0,
+        .slice_data_flag = VA_SLICE_DATA_FLAG_ALL,
+        .slice_data_bit_offset = slice->header_size,
+        .first_mb_in_slice = slice->first_mb_in_slice,
+        .slice_type = slice->slice_type,
+        .num_ref_idx_l0_active_minus1 = slice->num_ref_idx_l0_active_minus1,
+        .cabac_init_idc = slice->cabac_init_idc,
+        .slice_qp_delta = slice->slice_qp_delta,
+        .disable_deblocking_filter_idc = slice->disable_deblocking_filter_idc,
+        .slice_alpha_c0_offset_div2 = slice->slice_alpha_c0_offset_div2,
+        .slice_beta_offset_div2 = slice->slice_beta_offset_div2,
+        .luma_log2_weight_denom = slice->luma_log2_weight_denom,
+        .chroma_log2_weight_denom = slice->chroma_log2_weight_denom,
+        .luma_weight_l0_flag = slice->luma_weight_l0_flag,
+        .chroma_weight_l0_flag = slice->chroma_weight_l0_flag,
+    };
+
+    /* one extra slot for ref pic list modification */
+    const struct h264dec_test_ref *ref_list[33] = { 0 };
+    if (slice->slice_type == H264DEC_TEST_SLICE_P)
+        h264dec_test_init_ref_list(test, slice, ref_list);
+
+    for (int i = 0; i < 32; i++) {
+        slice_param.RefPicList1[i] = h264dec_test_va_picture_invalid();
+
+        if (ref_list[i]) {
+            const struct h264dec_test_ref *ref = ref_list[i];
+            slice_param.RefPicList0[i] = h264dec_test_va_picture(
+                ref->surface, ref->frame_num, ref->poc, VA_PICTURE_H264_SHORT_TERM_REFERENCE);
+        } else {
+            slice_param.RefPicList0[i] = h264dec_test_va_picture_invalid();
+        }
+
+        slice_param.luma_weight_l0[i] = slice->luma_weight_l0[i];
+        slice_param.luma_offset_l0[i] = slice->luma_offset_l0[i];
+        for (int j = 0; j < 2; j++) {
+            slice_param.chroma_weight_l0[i][j] = slice->chroma_weight_l0[i][j];
+            slice_param.chroma_offset_l0[i][j] = slice->chroma_offset_l0[i][j];
+        }
+    }
+
+    VABufferID *bufs = &test->pic_bufs[test->pic_buf_count];
+    bufs[0] = va_create_buffer(va, test->context, VASliceParameterBufferType, sizeof(slice_param),
+                               &slice_param);
+    bufs[1] = va_create_buffer(va, test->context, VASliceDataBufferType, nal_size, nal);
+    test->pic_buf_count += 2;
+
+    va_render_picture(va, test->context, bufs, 2);
+}
+
+static void
+h264dec_test_end_picture(struct h264dec_test *test)
+{
+    const struct h264dec_test_slice *slice = &test->pic_slice;
+    struct va *va = &test->va;
+
+    if (!test->in_picture)
+        return;
+
+    va_end_picture(va, test->context);
+    va_sync_surface(va, test->pic_surface);
+
+    const uint64_t latency = va_now() - test->pic_begin;
+    if (test->frame_count >= test->frame_max) {
+        test->frame_max = test->frame_max ? test->frame_max * 2 : 256;
+        test->latencies = realloc(test->latencies, sizeof(*test->latencies) * test->frame_max);
+        if (!test->latencies)
+            va_die("failed to alloc latencies");
+    }
+    test->latencies[test->frame_count++] = latency;
+
+    for (int i = 0; i < test->pic_buf_count; i++)
+        va_destroy_buffer(va, test->pic_bufs[i]);
+
+    /* sliding window reference marking */
+    if (slice->nal_ref_idc) {
+        const int max_refs = test->active_sps->max_num_ref_frames;
+        if (test->ref_count && test->ref_count >= max_refs) {
+            /* refs are sorted by descending FrameNumWrap */
+            test->ref_count--;
+        }
+
+        if (max_refs) {
+            test->refs[test->ref_count++] = (struct h264dec_test_ref){
+                .surface = test->pic_surface,
+                .frame_num = slice->frame_num,
+                .poc = test->pic_poc,
+            };
+        }
+    }
+
+    test->in_picture = false;
+}
+
+static void
+h264dec_test_decode_nal(struct h264dec_test *test, const uint8_t *nal, size_t nal_size)
+{
+    if (!nal_size)
+        return;
+
+    const int nal_ref_idc = (nal[0] >> 5) & 0x3;
+    const int nal_unit_type = nal[0] & 0x1f;
+
+    struct h264dec_test_bits bits = {
+        .data = test->file.rbsp,
+        .size = h264dec_test_unescape(test->file.rbsp, nal, nal_size),
+        .pos = 8,
+    };
+
+    switch (nal_unit_type) {
+    case H264DEC_TEST_NAL_SLICE:
+    case H264DEC_TEST_NAL_IDR: {
+        struct h264dec_test_slice slice = {
+            .nal_ref_idc = nal_ref_idc,
+            .nal_unit_type = nal_unit_type,
+        };
+        h264dec_test_parse_slice(test, &bits, &slice);
+
+        if (!slice.first_mb_in_slice) {
+            h264dec_test_end_picture(test);
+            h264dec_test_begin_picture(test, &slice);
+        } else if (!test->in_picture) {
+            va_die("missing first slice of picture");
+        }
+
+        h264dec_test_decode_slice(test, &slice, nal, nal_size);
+        break;
+    }
+    case H264DEC_TEST_NAL_SPS:
+        h264dec_test_parse_sps(test, &bits);
+        break;
+    case H264DEC_TEST_NAL_PPS:
+        h264dec_test_parse_pps(test, &bits);
+        break;
+    case H264DEC_TEST_NAL_AUD:
+        h264dec_test_end_picture(test);
+        break;
+    default:
+        break;
+    }
+}
+
+static void
+h264dec_test_decode_stream(struct h264dec_test *test)
+{
+    const struct h264dec_test_file *file = &test->file;
+    const uint8_t *stream = file->ptr;
+    const uint8_t *end = stream + file->size;
+
+    /* find the first start code */
+    const uint8_t *nal = NULL;
+    while (stream + 3 <= end) {
+        if (stream[0] == 0 && stream[1] == 0 && stream[2] == 1) {
+            stream += 3;
+
+            if (nal) {
+                /* trailing zeros belong to the next start code */
+                const uint8_t *nal_end = stream - 3;
+                while (nal_end > nal && !nal_end[-1])
+                    nal_end--;
+                h264dec_test_decode_nal(test, nal, nal_end - nal);
+            }
+            nal = stream;
+        } else {
+            stream++;
+        }
+    }
+
+    if (!nal)
+        va_die("expect annex-b start code");
+    h264dec_test_decode_nal(test, nal, end - nal);
+
+    h264dec_test_end_picture(test);
+}
+
+static void
+h264dec_test_report(struct h264dec_test *test, const char *filename, uint64_t elapsed)
+{
+    if (!test->frame_count) {
+        va_log("%s: no frame decoded", filename);
+        return;
+    }
+
+    uint64_t total = 0;
+    for (int i = 0; i < test->frame_count; i++)
+        total += test->latencies[i];
+
+    qsort(test->latencies, test->frame_count, sizeof(*test->latencies), va_compare_u64);
+
+    va_log("%s: %dx%d, %d frames in %.3f ms, %.1f fps", filename, test->width, test->height,
+           test->frame_count, elapsed / 1e6, test->frame_count * 1e9 / elapsed);
+    va_log("  latency per frame: avg %.3f ms, min %.3f ms, p50 %.3f ms, p99 %.3f ms, max %.3f ms",
+           total / 1e6 / test->frame_count, test->latencies[0] / 1e6,
+           va_percentile(test->latencies, test->frame_count, 50) / 1e6,
+           va_percentile(test->latencies, test->frame_count, 99) / 1e6,
+           test->latencies[test->frame_count - 1] / 1e6);
+}
+
+static void
+h264dec_test_init(struct h264dec_test *test)
+{
+    struct va *va = &test->va;
+
+    va_init(va, &test->params);
+}
+
+static void
+h264dec_test_decode_file(struct h264dec_test *test, const char *filename)
+{
+    struct va *va = &test->va;
+
+    test->file.ptr = va_map_file(va, filename, &test->file.size);
+    test->file.rbsp = malloc(test->file.size);
+    if (!test->file.rbsp)
+        va_die("failed to alloc rbsp");
+
+    const uint64_t begin = va_now();
+    h264dec_test_decode_stream(test);
+    h264dec_test_report(test, filename, va_now() - begin);
+
+    if (test->active_sps) {
+        va_destroy_context(va, test->context);
+        for (int i = 0; i < test->surface_count; i++)
+            va_destroy_surface(va, test->surfaces[i]);
+        va_destroy_config(va, test->config);
+    }
+
+    free(test->latencies);
+    free(test->file.rbsp);
+    va_unmap_file(va, test->file.ptr, test->file.size);
+
+    memset(&test->file, 0, sizeof(test->file));
+    memset(test->sps, 0, sizeof(test->sps));
+    memset(test->pps, 0, sizeof(test->pps));
+    test->active_sps = NULL;
+    test->surface_count = 0;
+    test->ref_count = 0;
+    test->prev_poc_msb = 0;
+    test->prev_poc_lsb = 0;
+    test->prev_frame_num = 0;
+    test->prev_frame_num_offset = 0;
+    test->latencies = NULL;
+    test->frame_count = 0;
+    test->frame_max = 0;
+}
+
+static void
+h264dec_test_cleanup(struct h264dec_test *test)
+{
+    struct va *va = &test->va;
+
+    va_cleanup(va);
+}
+
+int
+main(int argc, char **argv)
+{
+    struct h264dec_test test = {
+        .profile = VAProfileH264High,
+        .entrypoint = VAEntrypointVLD,
+    };
+
+    static const struct option options[] = {
+        { "stats", no_argument, NULL, 's' },
+        { "trace", required_argument, NULL, 't' },
+        { "sync", required_argument, NULL, 'S' },
+        { 0 },
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "st:S:", options, NULL)) != -1) {
+        switch (opt) {
+        case 's':
+            test.params.stats = true;
+            break;
+        case 't':
+            test.params.trace_file = optarg;
+            break;
+        case 'S':
+            if (!va_parse_sync_mode(&test.params, optarg))
+                va_die("invalid sync mode %s", optarg);
+            break;
+        default:
+            va_die("usage: %s [--stats] [--trace <file>] "
+                   "[--sync blocking|timed[:<ms>[:<deadline ms>]]|poll[:<deadline ms>]] "
+                   "<file>...",
+                   argv[0]);
+        }
+    }
+
+    h264dec_test_init(&test);
+
+    for (int i = optind; i < argc; i++)
+        h264dec_test_decode_file(&test, argv[i]);
+
+    h264dec_test_cleanup(&test);
+
+    return 0;
+}
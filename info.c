@@ -5,6 +5,8 @@
 
 #include "vautil.h"
 
+#include <getopt.h>
+
 static void
 info_subpics(const struct va *va)
 {
@@ -98,9 +100,6 @@ info_pair_default_surface(struct va *va, const struct va_pair *pair)
 static void
 info_pair_attr(const struct va *va, const struct va_pair *pair, const VAConfigAttrib *attr)
 {
-    if (attr->value == VA_ATTRIB_NOT_SUPPORTED)
-        return;
-
     char str[1024];
     int format;
     switch (attr->type) {
@@ -132,14 +131,283 @@ info_pairs(struct va *va)
     for (int i = 0; i < va->pair_count; i++) {
         const struct va_pair *pair = &va->pairs[i];
 
+        va_trace_begin(va, "pair");
         va_log("pair: (%s, %s)", vaProfileStr(pair->profile), vaEntrypointStr(pair->entrypoint));
         for (int j = 0; j < VAConfigAttribTypeMax; j++) {
-            const VAConfigAttrib *attr = &pair->attrs[j];
-            info_pair_attr(va, pair, attr);
+            if (!va_pair_has_attr(pair, j))
+                continue;
+
+            const VAConfigAttrib attr = {
+                .type = j,
+                .value = va_pair_get_attr(va, pair, j),
+            };
+            info_pair_attr(va, pair, &attr);
         }
 
         info_pair_default_surface(va, pair);
+        va_trace_end(va, "pair");
+    }
+}
+
+#define INFO_BENCH_ITERATIONS 16
+
+static const struct {
+    int width;
+    int height;
+} info_bench_sizes[] = {
+    { 176, 144 }, { 640, 480 }, { 1280, 720 }, { 1920, 1080 }, { 3840, 2160 }, { 7680, 4320 },
+};
+
+static const struct {
+    unsigned int rt_format;
+    const char *name;
+    unsigned int fourcc;
+} info_bench_rt_formats[] = {
+    { VA_RT_FORMAT_YUV420, "YUV420", VA_FOURCC_NV12 },
+    { VA_RT_FORMAT_YUV422, "YUV422", VA_FOURCC_422H },
+    { VA_RT_FORMAT_YUV444, "YUV444", VA_FOURCC_444P },
+    { VA_RT_FORMAT_YUV400, "YUV400", VA_FOURCC_Y800 },
+    { VA_RT_FORMAT_YUV420_10, "YUV420_10", VA_FOURCC_P010 },
+    { VA_RT_FORMAT_RGB32, "RGB32", VA_FOURCC_BGRX },
+};
+
+/* the standard sizes that fit, followed by the max size */
+static int
+info_bench_get_sizes(int max_width, int max_height, int (*sizes)[2])
+{
+    int count = 0;
+    for (unsigned int i = 0; i < ARRAY_SIZE(info_bench_sizes); i++) {
+        if (info_bench_sizes[i].width > max_width || info_bench_sizes[i].height > max_height)
+            continue;
+        sizes[count][0] = info_bench_sizes[i].width;
+        sizes[count][1] = info_bench_sizes[i].height;
+        count++;
+    }
+
+    if (!count || sizes[count - 1][0] != max_width || sizes[count - 1][1] != max_height) {
+        sizes[count][0] = max_width;
+        sizes[count][1] = max_height;
+        count++;
+    }
+
+    return count;
+}
+
+/* fewer iterations for sizes above 1080p */
+static int
+info_bench_get_iterations(int width, int height)
+{
+    const int64_t iterations = INFO_BENCH_ITERATIONS * 1920 * 1080 / ((int64_t)width * height);
+    return (int)MAX2(MIN2(iterations, INFO_BENCH_ITERATIONS), 2);
+}
+
+static double
+info_bench_median_us(uint64_t *vals, int count)
+{
+    qsort(vals, count, sizeof(*vals), va_compare_u64);
+    return va_percentile(vals, count, 50) / 1e3;
+}
+
+static VAStatus
+info_bench_create_surface(
+    struct va *va, unsigned int rt_format, unsigned int fourcc, int width, int height,
+    VASurfaceID *surf)
+{
+    VASurfaceAttrib attr = {
+        .type = VASurfaceAttribPixelFormat,
+        .flags = VA_SURFACE_ATTRIB_SETTABLE,
+        .value = {
+            .type = VAGenericValueTypeInteger,
+            .value.i = fourcc,
+        },
+    };
+    return vaCreateSurfaces(va->display, rt_format, width, height, surf, 1, &attr, 1);
+}
+
+static void
+info_bench_surfaces(struct va *va, unsigned int rt_format, unsigned int fourcc, int width,
+                    int height)
+{
+    const int iterations = info_bench_get_iterations(width, height);
+    uint64_t creates[INFO_BENCH_ITERATIONS];
+    uint64_t destroys[INFO_BENCH_ITERATIONS];
+
+    for (int i = 0; i < iterations; i++) {
+        VASurfaceID surf;
+        const uint64_t begin = va_now();
+        va->status = info_bench_create_surface(va, rt_format, fourcc, width, height, &surf);
+        const uint64_t created = va_now();
+        if (va->status != VA_STATUS_SUCCESS) {
+            va_log("    %dx%d: failed to create surface: %s", width, height,
+                   vaErrorStr(va->status));
+            return;
+        }
+
+        vaDestroySurfaces(va->display, &surf, 1);
+        creates[i] = created - begin;
+        destroys[i] = va_now() - created;
     }
+
+    va_log("    %dx%d: create %.1f us, destroy %.1f us", width, height,
+           info_bench_median_us(creates, iterations), info_bench_median_us(destroys, iterations));
+}
+
+/* benchmarks the surfaces of every rt format of the pair, and returns the max size */
+static void
+info_bench_pair(struct va *va, const struct va_pair *pair, int *max_width, int *max_height)
+{
+    const uint32_t rt_formats = va_pair_get_attr(va, pair, VAConfigAttribRTFormat);
+    if (rt_formats == VA_ATTRIB_NOT_SUPPORTED)
+        return;
+
+    for (unsigned int i = 0; i < ARRAY_SIZE(info_bench_rt_formats); i++) {
+        if (!(rt_formats & info_bench_rt_formats[i].rt_format))
+            continue;
+
+        VAConfigAttrib attr = {
+            .type = VAConfigAttribRTFormat,
+            .value = info_bench_rt_formats[i].rt_format,
+        };
+        VAConfigID config;
+        va->status =
+            vaCreateConfig(va->display, pair->profile, pair->entrypoint, &attr, 1, &config);
+        if (va->status != VA_STATUS_SUCCESS)
+            continue;
+        const int width = va_query_surface_attr(va, config, VASurfaceAttribMaxWidth, 4096);
+        const int height = va_query_surface_attr(va, config, VASurfaceAttribMaxHeight, 4096);
+        vaDestroyConfig(va->display, config);
+
+        *max_width = MAX2(*max_width, width);
+        *max_height = MAX2(*max_height, height);
+
+        va_log("  (%s, %s) %s, max %dx%d:", vaProfileStr(pair->profile),
+               vaEntrypointStr(pair->entrypoint), info_bench_rt_formats[i].name, width, height);
+
+        int sizes[ARRAY_SIZE(info_bench_sizes) + 1][2];
+        const int size_count = info_bench_get_sizes(width, height, sizes);
+        for (int j = 0; j < size_count; j++) {
+            info_bench_surfaces(va, info_bench_rt_formats[i].rt_format,
+                                info_bench_rt_formats[i].fourcc, sizes[j][0], sizes[j][1]);
+        }
+    }
+}
+
+static void
+info_bench_images(struct va *va, VAImageFormat *fmt, int width, int height)
+{
+    const int iterations = info_bench_get_iterations(width, height);
+    uint64_t creates[INFO_BENCH_ITERATIONS];
+    uint64_t destroys[INFO_BENCH_ITERATIONS];
+    uint64_t maps[INFO_BENCH_ITERATIONS];
+    uint64_t unmaps[INFO_BENCH_ITERATIONS];
+    uint64_t reads[INFO_BENCH_ITERATIONS];
+    uint64_t gets[INFO_BENCH_ITERATIONS];
+    uint64_t size = 0;
+    void *scratch = NULL;
+
+    /* vaGetImage source; not every driver converts to every format */
+    VASurfaceID surf;
+    bool can_get = info_bench_create_surface(va, VA_RT_FORMAT_YUV420, VA_FOURCC_NV12, width,
+                                             height, &surf) == VA_STATUS_SUCCESS;
+    const bool has_surf = can_get;
+
+    for (int i = 0; i < iterations; i++) {
+        VAImage img;
+        uint64_t begin = va_now();
+        va->status = vaCreateImage(va->display, fmt, width, height, &img);
+        creates[i] = va_now() - begin;
+        if (va->status != VA_STATUS_SUCCESS) {
+            va_log("    %dx%d: failed to create image: %s", width, height,
+                   vaErrorStr(va->status));
+            goto out;
+        }
+
+        if (!scratch) {
+            size = img.data_size;
+            scratch = malloc(size);
+            if (!scratch)
+                va_die("failed to alloc scratch");
+        }
+
+        if (can_get) {
+            begin = va_now();
+            va->status = vaGetImage(va->display, surf, 0, 0, width, height, img.image_id);
+            gets[i] = va_now() - begin;
+            can_get = va->status == VA_STATUS_SUCCESS;
+        }
+
+        void *ptr;
+        begin = va_now();
+        va->status = vaMapBuffer(va->display, img.buf, &ptr);
+        maps[i] = va_now() - begin;
+        va_check(va, "failed to map image");
+
+        begin = va_now();
+        memcpy(scratch, ptr, size);
+        reads[i] = va_now() - begin;
+
+        begin = va_now();
+        vaUnmapBuffer(va->display, img.buf);
+        unmaps[i] = va_now() - begin;
+
+        begin = va_now();
+        vaDestroyImage(va->display, img.image_id);
+        destroys[i] = va_now() - begin;
+    }
+
+    /* bytes per ns is GB/s */
+    char get_str[32] = "n/a";
+    if (can_get) {
+        snprintf(get_str, sizeof(get_str), "%.2f GB/s",
+                 size / (info_bench_median_us(gets, iterations) * 1e3));
+    }
+    va_log("    %dx%d: create %.1f us, destroy %.1f us, map %.1f us, unmap %.1f us, "
+           "read %.2f GB/s, get_image %s",
+           width, height, info_bench_median_us(creates, iterations),
+           info_bench_median_us(destroys, iterations), info_bench_median_us(maps, iterations),
+           info_bench_median_us(unmaps, iterations),
+           size / (info_bench_median_us(reads, iterations) * 1e3), get_str);
+
+out:
+    free(scratch);
+    if (has_surf)
+        vaDestroySurfaces(va->display, &surf, 1);
+}
+
+/* calls libva directly, as the va_* wrappers abort on the failures that are
+ * reported here and would add their stats and trace overhead to what is
+ * measured; --stats and --trace only see the enclosing trace slices
+ */
+static void
+info_bench_alloc(struct va *va)
+{
+    int max_width = 0;
+    int max_height = 0;
+
+    va_trace_begin(va, "bench surfaces");
+    va_log("surface alloc bench:");
+    for (int i = 0; i < va->pair_count; i++)
+        info_bench_pair(va, &va->pairs[i], &max_width, &max_height);
+    va_trace_end(va, "bench surfaces");
+
+    if (!max_width || !max_height) {
+        max_width = 4096;
+        max_height = 4096;
+    }
+
+    va_trace_begin(va, "bench images");
+    va_log("image alloc bench, up to %dx%d:", max_width, max_height);
+    for (unsigned int i = 0; i < va->img_count; i++) {
+        VAImageFormat *fmt = &va->img_formats[i];
+        const char *fourcc = (const char *)&fmt->fourcc;
+        va_log("  %c%c%c%c:", fourcc[0], fourcc[1], fourcc[2], fourcc[3]);
+
+        int sizes[ARRAY_SIZE(info_bench_sizes) + 1][2];
+        const int size_count = info_bench_get_sizes(max_width, max_height, sizes);
+        for (int j = 0; j < size_count; j++)
+            info_bench_images(va, fmt, sizes[j][0], sizes[j][1]);
+    }
+    va_trace_end(va, "bench images");
 }
 
 static void
@@ -170,16 +438,50 @@ info_display(const struct va *va)
 }
 
 int
-main(void)
+main(int argc, char **argv)
 {
+    struct va_init_params params = { 0 };
+    bool bench_alloc = false;
+
+    static const struct option options[] = {
+        { "stats", no_argument, NULL, 's' },
+        { "trace", required_argument, NULL, 't' },
+        { "bench-alloc", no_argument, NULL, 'b' },
+        { 0 },
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "st:b", options, NULL)) != -1) {
+        switch (opt) {
+        case 's':
+            params.stats = true;
+            break;
+        case 't':
+            params.trace_file = optarg;
+            break;
+        case 'b':
+            bench_alloc = true;
+            break;
+        default:
+            va_die("usage: %s [--stats] [--trace <file>] [--bench-alloc]\n"
+                   "--stats and --trace do not cover the calls made by --bench-alloc",
+                   argv[0]);
+        }
+    }
 
     struct va va;
-    va_init(&va, NULL);
+    va_init(&va, &params);
 
+    va_trace_begin(&va, "info");
     info_display(&va);
     info_pairs(&va);
     info_images(&va);
     info_subpics(&va);
+    if (bench_alloc) {
+        if (params.stats || params.trace_file)
+            va_log("--stats and --trace do not cover the calls made by --bench-alloc");
+        info_bench_alloc(&va);
+    }
+    va_trace_end(&va, "info");
 
     va_cleanup(&va);
 
@@ -3,70 +3,245 @@
  * SPDX-License-Identifier: MIT
  */
 
+#include "jpegva.h"
+#include "quality.h"
+#include "swjpeg.h"
 #include "vautil.h"
 
-struct jpegdec_test_file {
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <getopt.h>
+#include <libgen.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+struct jpegdec_test_nv12 {
+    uint8_t *data;
+    uint32_t width;
+    uint32_t height;
+    uint32_t pitches[2];
+    uint32_t offsets[2];
+};
+
+struct jpegdec_test_quality {
+    char *filename;
+    /* Y, U and V */
+    struct quality_result planes[3];
+};
+
+enum jpegdec_test_output {
+    /* one surface for the whole image */
+    JPEGDEC_TEST_OUTPUT_SURFACE,
+    /* the image exceeds the surface limits and is decoded in tiles */
+    JPEGDEC_TEST_OUTPUT_TILES,
+    /* the image exceeds the surface limits and cannot be tiled */
+    JPEGDEC_TEST_OUTPUT_CPU,
+};
+
+struct jpegdec_test_tiles {
+    /* in pixels */
+    int mcu_width;
+    int mcu_height;
+    /* in MCUs */
+    int mcu_cols;
+    int mcu_rows;
+    int tile_cols;
+    int tile_rows;
+
+    /* restart intervals of the scan, without the RSTn markers */
+    const uint8_t **intervals;
+    int *interval_sizes;
+    int interval_count;
+};
+
+struct jpegdec_test_soak_sample {
+    /* in seconds */
+    double elapsed;
+    int iteration;
+
+    /* latencies of the decodes since the last sample */
+    uint64_t p50;
+    uint64_t p99;
+    double stddev;
+
+    uint64_t rss;
+    int live_objects;
+};
+
+struct jpegdec_test_soak {
+    bool enabled;
+    /* stop at whichever limit comes first */
+    int iterations;
+    double duration;
+    double sample_period;
+
+    /* thresholds, disabled when negative */
+    double max_latency_drift;
+    int64_t max_rss_growth;
+    int max_live_objects;
+
+    uint64_t *latencies;
+    int latency_count;
+    int latency_max;
+
+    struct jpegdec_test_soak_sample *samples;
+    int sample_count;
+    int sample_max;
+};
+
+struct jpegdec_test_rect {
+    int x;
+    int y;
+    int width;
+    int height;
+};
+
+struct jpegdec_test_crop {
+    char *filename;
+    struct jpegdec_test_rect rect;
+};
+
+struct jpegdec_test_request {
+    /* bytes of JPEG data at the start of the passed fd */
+    uint64_t size;
+};
+
+struct jpegdec_test_response {
+    /* 0 on success, otherwise an errno */
+    int32_t status;
+    uint32_t width;
+    uint32_t height;
+    uint32_t pitches[2];
+    uint32_t offsets[2];
+    /* bytes of NV12 data at the start of the passed fd */
+    uint64_t size;
+    uint64_t decode_time;
+};
+
+#define JPEGDEC_TEST_ARCHIVE_MAGIC 0x5844494a /* "JIDX" */
+#define JPEGDEC_TEST_ARCHIVE_VERSION 1
+
+/* the sidecar <file>.idx is a header followed by the entries */
+struct jpegdec_test_archive_header {
+    uint32_t magic;
+    uint32_t version;
+    /* of the indexed file, to detect stale sidecars */
+    uint64_t input_size;
+    uint64_t input_mtime;
+    uint64_t entry_count;
+};
+
+struct jpegdec_test_archive_entry {
+    uint64_t offset;
+    uint32_t size;
+    uint16_t width;
+    uint16_t height;
+    /* of the DQT and DHT tables */
+    uint64_t table_hash;
+};
+
+/* concatenated JPEGs, such as a raw MJPEG capture */
+struct jpegdec_test_archive {
     const void *ptr;
     size_t size;
 
-    const void *soi;
+    struct jpegdec_test_archive_entry *entries;
+    int entry_count;
+    int entry_max;
+};
 
-    struct {
-        const void *segments[4];
-        int Pq[4];
-        int Tq[4];
-        const void *Qk[4];
-    } dqt;
+/* frames first to last, or to the end when last is negative */
+struct jpegdec_test_range {
+    int first;
+    int last;
+};
 
-    struct {
-        const void *segment;
-        int P;
-        int Y;
-        int X;
-        int Nf;
-        int Ci[4];
-        int Hi[4];
-        int Vi[4];
-        int Tqi[4];
-    } sof0;
+#define JPEGDEC_TEST_CACHE_MAGIC 0x3231564e /* "NV12" */
 
-    struct {
-        const void *segments[4];
-        int Tc[4];
-        int Th[4];
-        const void *Li[4];
-        const void *Vij[4];
-        int Vij_sizes[4];
-    } dht;
+/* followed by the packed Y and UV planes */
+struct jpegdec_test_cache_header {
+    uint32_t magic;
+    uint32_t width;
+    uint32_t height;
+    uint32_t pitch;
+    /* a cheap guard against hash collisions */
+    uint64_t input_size;
+};
 
-    struct {
-        const void *segment;
-        int Ns;
-        int Csj[4];
-        int Tdj[4];
-        int Taj[4];
-    } sos;
+struct jpegdec_test_cache_entry {
+    uint64_t key;
+    uint64_t size;
+    /* the mtime of the file in ns, which is bumped on every hit */
+    uint64_t last_use;
+};
 
-    const void *scan;
-    int scan_size;
+/* decoded outputs in <dir>/<key>.nv12, keyed by the input bytes and the ROI */
+struct jpegdec_test_cache {
+    const char *dir;
+    uint64_t max_size;
 
-    struct {
-        const void *segment;
-        int Ri;
-    } dri;
+    struct jpegdec_test_cache_entry *entries;
+    int entry_count;
+    int entry_max;
+    uint64_t total_size;
 
-    const void *eoi;
+    int hits;
+    int misses;
+    int evictions;
+    uint64_t hit_time;
 };
 
 struct jpegdec_test {
     VAProfile profile;
     VAEntrypoint entrypoint;
+    struct va_init_params params;
+    /* decode on the cpu only */
+    bool sw;
+    /* decode on both and compare */
+    bool verify;
+    int sw_threads;
+    /* compare against <ref_dir>/<name>.nv12 or .ppm */
+    const char *ref_dir;
+    int worst_count;
+    /* decode into our own memory */
+    bool userptr;
+    /* lower the surface limits to force tiling */
+    int max_width;
+    int max_height;
+    /* read back only a region, from --crop or per file from --crop-manifest */
+    struct jpegdec_test_rect crop;
+    struct jpegdec_test_crop *crops;
+    int crop_count;
 
     struct va va;
-
-    struct jpegdec_test_file file;
+    struct va_arena arena;
+
+    struct jpegparse parser;
+    struct jpegva_file file;
+    struct jpegva_picture picture;
+
+    unsigned int rt_format;
+    unsigned int fourcc;
+    enum jpegdec_test_output output;
+    /* the region that is read back, aligned for chroma */
+    struct jpegdec_test_rect roi;
+    struct jpegdec_test_tiles tiles;
+    /* the output of JPEGDEC_TEST_OUTPUT_TILES and JPEGDEC_TEST_OUTPUT_CPU */
+    struct jpegdec_test_nv12 stitched;
+    /* the ROI converted to nv12 when the surface is in another format */
+    struct jpegdec_test_nv12 converted;
 
     VASurfaceID surface;
+    /* whether surface was created from userptr_desc */
+    bool surface_userptr;
+    VASurfaceAttribExternalBuffers userptr_desc;
+    VAImage image;
     VAConfigID config;
     VAContextID context;
 
@@ -75,407 +250,3002 @@ struct jpegdec_test {
     VABufferID huffman_table;
     VABufferID slice_param;
     VABufferID slice_data;
-};
 
-static int
-segment_param_be16(const unsigned char *stream)
-{
-    return (int)stream[0] * 256 + stream[1];
-}
+    bool no_save;
+    /* serve requests on a unix socket */
+    const char *listen_path;
+    /* send requests to a daemon */
+    const char *connect_path;
+    /* also time one jpegdec process per request */
+    bool oneshot;
+    /* the decode options, such as --sync and --crop, that the one-shot
+     * processes are run with so that they decode like the daemon
+     */
+    const char *oneshot_args[16];
+    int oneshot_arg_count;
+    int repeat;
+    /* fork this many decoding processes per run, all on the same device */
+    int *contention;
+    int contention_count;
+    const char *argv0;
+    /* compare chunked and whole-file parsing instead of decoding */
+    const char *bench_parse;
+
+    /* keep the config, surface and context across same-sized frames */
+    struct {
+        bool enabled;
+        bool valid;
+        int width;
+        int height;
+    } warm;
+
+    int frame_count;
+    uint64_t latency;
+    struct jpegdec_test_soak soak;
+
+    struct jpegdec_test_quality *qualities;
+    int quality_count;
+    uint64_t compare_time;
+
+    struct jpegdec_test_cache cache;
+
+    /* decode only some frames of each input, using the frame index */
+    struct jpegdec_test_range *ranges;
+    int range_count;
+    int sample_count;
+    uint64_t sample_seed;
+    struct jpegdec_test_archive archive;
+};
 
 static void
 jpegdec_test_init(struct jpegdec_test *test)
 {
     struct va *va = &test->va;
 
-    va_init(va, NULL);
+    /* no VA device is needed, or each worker opens its own */
+    if (test->sw || test->connect_path || test->bench_parse || test->contention_count)
+        return;
+
+    va_init(va, &test->params);
 }
 
 static void
-jpegdec_test_dump(struct jpegdec_test *test, const char *filename)
+jpegdec_test_alloc_nv12(struct jpegdec_test_nv12 *nv12, uint32_t width, uint32_t height)
 {
-    const struct jpegdec_test_file *file = &test->file;
-    struct va *va = &test->va;
-    VAImage img;
-
-    va_create_image(va, file->sof0.X, file->sof0.Y, VA_FOURCC_NV12, &img);
-    va_get_image(va, test->surface, file->sof0.X, file->sof0.Y, img.image_id);
-    va_save_image(va, &img, filename);
-    va_destroy_image(va, img.image_id);
+    nv12->width = width;
+    nv12->height = height;
+    nv12->pitches[0] = (width + 1) & ~1;
+    nv12->pitches[1] = nv12->pitches[0];
+    nv12->offsets[0] = 0;
+    nv12->offsets[1] = nv12->pitches[0] * height;
+    nv12->data = malloc(nv12->offsets[1] + nv12->pitches[1] * ((height + 1) / 2));
+    if (!nv12->data)
+        va_die("failed to alloc nv12");
 }
 
-static void
-jpegdec_test_decode(struct jpegdec_test *test)
+/* nv12 is allocated even when the scan fails to decode */
+static bool
+jpegdec_test_sw_decode(struct jpegdec_test *test, struct jpegdec_test_nv12 *nv12)
 {
-    struct va *va = &test->va;
+    const struct jpegva_picture *pic = &test->picture;
+    const struct jpegva_file *file = &test->file;
 
-    const VABufferID bufs[] = {
-        test->pic_param,   test->iq_matrix,  test->huffman_table,
-        test->slice_param, test->slice_data,
+    jpegdec_test_alloc_nv12(nv12, file->frame.sof0.X, file->frame.sof0.Y);
+
+    struct swjpeg_decoder dec;
+    if (!swjpeg_decoder_init(&dec, &pic->pic_param, &pic->iq_matrix, &pic->huffman_table,
+                             test->sw_threads) ||
+        !swjpeg_decoder_decode_slice(&dec, &pic->slice_param, file->scan)) {
+        swjpeg_decoder_cleanup(&dec);
+        return false;
+    }
+
+    const struct swjpeg_nv12 out = {
+        .data = nv12->data,
+        .pitches = { nv12->pitches[0], nv12->pitches[1] },
+        .offsets = { nv12->offsets[0], nv12->offsets[1] },
     };
-    va_begin_picture(va, test->context, test->surface);
-    va_render_picture(va, test->context, bufs, ARRAY_SIZE(bufs));
-    va_end_picture(va, test->context);
+    swjpeg_decoder_output_nv12(&dec, &out);
+    swjpeg_decoder_cleanup(&dec);
 
-    va_sync_surface(va, test->surface);
+    return true;
 }
 
 static void
-jpegdec_test_prepare(struct jpegdec_test *test)
+jpegdec_test_load_crops(struct jpegdec_test *test, const char *filename)
 {
-    const unsigned int rt_format = VA_RT_FORMAT_YUV420;
-    const unsigned int pix_format = VA_FOURCC_NV12;
-    const struct jpegdec_test_file *file = &test->file;
-    struct va *va = &test->va;
+    FILE *fp = fopen(filename, "r");
+    if (!fp)
+        va_die("failed to open %s", filename);
+
+    /* "<file> <x>,<y>,<w>,<h>" per line */
+    char line[PATH_MAX + 64];
+    int line_num = 0;
+    while (fgets(line, sizeof(line), fp)) {
+        line_num++;
+
+        char *name = line;
+        while (isspace(*name))
+            name++;
+        if (!*name || *name == '#')
+            continue;
 
-    VAPictureParameterBufferJPEGBaseline pic_param = {
-        .picture_width = file->sof0.X,
-        .picture_height = file->sof0.Y,
-        .num_components = file->sof0.Nf,
-    };
-    for (int i = 0; i < file->sof0.Nf; i++) {
-        pic_param.components[i].component_id = file->sof0.Ci[i];
-        pic_param.components[i].h_sampling_factor = file->sof0.Hi[i];
-        pic_param.components[i].v_sampling_factor = file->sof0.Vi[i];
-        pic_param.components[i].quantiser_table_selector = file->sof0.Tqi[i];
+        char *rect = name;
+        while (*rect && !isspace(*rect))
+            rect++;
+        if (*rect)
+            *rect++ = '\0';
+
+        struct jpegdec_test_rect r;
+        if (sscanf(rect, "%d,%d,%d,%d", &r.x, &r.y, &r.width, &r.height) != 4 || r.x < 0 ||
+            r.y < 0 || r.width <= 0 || r.height <= 0)
+            va_die("%s:%d: expect <file> <x>,<y>,<w>,<h>", filename, line_num);
+
+        if (!(test->crop_count & (test->crop_count - 1))) {
+            const int cap = test->crop_count ? test->crop_count * 2 : 16;
+            test->crops = realloc(test->crops, sizeof(*test->crops) * cap);
+            if (!test->crops)
+                va_die("failed to grow crops");
+        }
+        struct jpegdec_test_crop *crop = &test->crops[test->crop_count++];
+        crop->filename = strdup(name);
+        if (!crop->filename)
+            va_die("failed to dup filename");
+        crop->rect = r;
     }
 
-    VAIQMatrixBufferJPEGBaseline iq_matrix = { 0 };
-    for (unsigned int i = 0; i < ARRAY_SIZE(file->dqt.Qk); i++) {
-        if (!file->dqt.Qk[i])
-            break;
-        if (file->dqt.Pq[i])
-            va_die("no 16-bit Q support");
+    fclose(fp);
+}
 
-        const int Tq = file->dqt.Tq[i];
-        iq_matrix.load_quantiser_table[Tq] = 1;
-        memcpy(iq_matrix.quantiser_table[Tq], file->dqt.Qk[i], 64);
+/* picks the crop of the file, or of all files, and aligns it for chroma;
+ * returns false when the crop misses the image
+ */
+static bool
+jpegdec_test_set_roi(struct jpegdec_test *test, const char *filename)
+{
+    const struct jpegva_file *file = &test->file;
+    const int width = file->frame.sof0.X;
+    const int height = file->frame.sof0.Y;
+    struct jpegdec_test_rect rect = test->crop;
+
+    if (filename) {
+        const char *slash = strrchr(filename, '/');
+        const char *base = slash ? slash + 1 : filename;
+        for (int i = 0; i < test->crop_count; i++) {
+            const struct jpegdec_test_crop *crop = &test->crops[i];
+            if (!strcmp(crop->filename, filename) || !strcmp(crop->filename, base)) {
+                rect = crop->rect;
+                break;
+            }
+        }
     }
 
-    VAHuffmanTableBufferJPEGBaseline huffman_table = { 0 };
-    for (unsigned int i = 0; i < ARRAY_SIZE(file->dht.Li); i++) {
-        if (!file->dht.Li[i])
-            break;
+    if (!rect.width || !rect.height) {
+        test->roi = (struct jpegdec_test_rect){ .width = width, .height = height };
+        return true;
+    }
 
-        const int Tc = file->dht.Tc[i];
-        const int Th = file->dht.Th[i];
-        huffman_table.load_huffman_table[Th] = 1;
-        if (Tc) {
-            memcpy(huffman_table.huffman_table[Th].num_ac_codes, file->dht.Li[i], 16);
-            memcpy(huffman_table.huffman_table[Th].ac_values, file->dht.Vij[i],
-                   file->dht.Vij_sizes[i]);
-        } else {
-            memcpy(huffman_table.huffman_table[Th].num_dc_codes, file->dht.Li[i], 16);
-            memcpy(huffman_table.huffman_table[Th].dc_values, file->dht.Vij[i],
-                   file->dht.Vij_sizes[i]);
-        }
+    const int x0 = rect.x & ~1;
+    const int y0 = rect.y & ~1;
+    const int x1 = MIN2((rect.x + rect.width + 1) & ~1, width);
+    const int y1 = MIN2((rect.y + rect.height + 1) & ~1, height);
+    if (x0 >= x1 || y0 >= y1) {
+        va_log("crop %d,%d,%d,%d is outside of %dx%d", rect.x, rect.y, rect.width, rect.height,
+               width, height);
+        return false;
     }
 
-    VASliceParameterBufferJPEGBaseline slice_param = {
-        .slice_data_size = file->scan_size,
-        .slice_data_flag = VA_SLICE_DATA_FLAG_ALL,
-        .num_components = file->sos.Ns,
+    test->roi = (struct jpegdec_test_rect){
+        .x = x0,
+        .y = y0,
+        .width = x1 - x0,
+        .height = y1 - y0,
     };
-    for (int i = 0; i < file->sos.Ns; i++) {
-        slice_param.components[i].component_selector = file->sos.Csj[i];
-        slice_param.components[i].dc_table_selector = file->sos.Tdj[i];
-        slice_param.components[i].ac_table_selector = file->sos.Taj[i];
-    }
-    slice_param.restart_interval = file->dri.Ri;
+    return true;
+}
 
-    const int mcu_cols = (file->sof0.X + file->sof0.Hi[0] * 8 - 1) / (file->sof0.Hi[0] * 8);
-    const int mcu_rows = (file->sof0.Y + file->sof0.Vi[0] * 8 - 1) / (file->sof0.Vi[0] * 8);
-    slice_param.num_mcus = mcu_cols * mcu_rows;
+/* narrows a view of the whole picture to the ROI */
+static void
+jpegdec_test_crop_nv12(const struct jpegdec_test *test, struct jpegdec_test_nv12 *nv12)
+{
+    const struct jpegdec_test_rect *roi = &test->roi;
 
-    test->config = va_create_config(va, test->profile, test->entrypoint, rt_format);
-    test->surface = va_create_surface(va, rt_format, file->sof0.X, file->sof0.Y, pix_format);
-    test->context = va_create_context(va, test->config, file->sof0.X, file->sof0.Y,
-                                      VA_PROGRESSIVE, test->surface);
+    nv12->offsets[0] += nv12->pitches[0] * roi->y + roi->x;
+    nv12->offsets[1] += nv12->pitches[1] * (roi->y / 2) + roi->x;
+    nv12->width = roi->width;
+    nv12->height = roi->height;
+}
 
-    test->pic_param = va_create_buffer(va, test->context, VAPictureParameterBufferType,
-                                       sizeof(pic_param), &pic_param);
-    test->iq_matrix =
-        va_create_buffer(va, test->context, VAIQMatrixBufferType, sizeof(iq_matrix), &iq_matrix);
-    test->huffman_table = va_create_buffer(va, test->context, VAHuffmanTableBufferType,
-                                           sizeof(huffman_table), &huffman_table);
-    test->slice_param = va_create_buffer(va, test->context, VASliceParameterBufferType,
-                                         sizeof(slice_param), &slice_param);
+/* converts the mapped image to nv12; (x, y) is where the image starts on the
+ * surface, which decides the phase of subsampled chroma
+ */
+static void
+jpegdec_test_copy_image(const VAImage *img,
+                        const uint8_t *ptr,
+                        int x,
+                        int y,
+                        const struct jpegdec_test_nv12 *dst)
+{
+    const int width = dst->width;
+    const int height = dst->height;
+    const int chroma_width = (width + 1) / 2;
+    const int chroma_height = (height + 1) / 2;
+
+    for (int i = 0; i < height; i++) {
+        memcpy(dst->data + dst->offsets[0] + dst->pitches[0] * i,
+               ptr + img->offsets[0] + img->pitches[0] * i, width);
+    }
 
-    test->slice_data =
-        va_create_buffer(va, test->context, VASliceDataBufferType, file->scan_size, file->scan);
+    int sx = 1;
+    int sy = 1;
+    switch (img->format.fourcc) {
+    case VA_FOURCC_NV12:
+        for (int i = 0; i < chroma_height; i++) {
+            memcpy(dst->data + dst->offsets[1] + dst->pitches[1] * i,
+                   ptr + img->offsets[1] + img->pitches[1] * i, chroma_width * 2);
+        }
+        return;
+    case VA_FOURCC_Y800:
+        for (int i = 0; i < chroma_height; i++)
+            memset(dst->data + dst->offsets[1] + dst->pitches[1] * i, 128, chroma_width * 2);
+        return;
+    case VA_FOURCC_422H:
+        sx = 2;
+        break;
+    case VA_FOURCC_422V:
+        sy = 2;
+        break;
+    case VA_FOURCC_411P:
+        sx = 4;
+        break;
+    case VA_FOURCC_444P:
+        break;
+    default:
+        va_die("cannot convert image fourcc 0x%x to nv12", img->format.fourcc);
+    }
+
+    /* average the samples covering each 2x2 luma block, as swjpeg does */
+    for (int i = 0; i < chroma_height; i++) {
+        uint8_t *dst_row = dst->data + dst->offsets[1] + dst->pitches[1] * i;
+        for (int j = 0; j < chroma_width; j++) {
+            for (int p = 0; p < 2; p++) {
+                const uint8_t *plane = ptr + img->offsets[1 + p];
+                int sum = 0;
+                for (int dy = 0; dy < 2; dy++) {
+                    const int cy = (y + MIN2(i * 2 + dy, height - 1)) / sy - y / sy;
+                    for (int dx = 0; dx < 2; dx++) {
+                        const int cx = (x + MIN2(j * 2 + dx, width - 1)) / sx - x / sx;
+                        sum += plane[img->pitches[1 + p] * cy + cx];
+                    }
+                }
+                dst_row[j * 2 + p] = (sum + 2) / 4;
+            }
+        }
+    }
 }
 
 static void
-jpegdec_test_parse_file_dri(struct jpegdec_test *test)
+jpegdec_test_map_output(struct jpegdec_test *test, struct jpegdec_test_nv12 *out)
 {
-    struct jpegdec_test_file *file = &test->file;
-    if (!file->dri.segment)
+    const struct jpegva_file *file = &test->file;
+    struct va *va = &test->va;
+
+    out->width = file->frame.sof0.X;
+    out->height = file->frame.sof0.Y;
+
+    if (test->output != JPEGDEC_TEST_OUTPUT_SURFACE) {
+        *out = test->stitched;
+        jpegdec_test_crop_nv12(test, out);
+        return;
+    }
+
+    /* the decoder wrote straight into the arena */
+    if (test->surface_userptr) {
+        out->data = test->arena.ptr;
+        for (int i = 0; i < 2; i++) {
+            out->pitches[i] = test->userptr_desc.pitches[i];
+            out->offsets[i] = test->userptr_desc.offsets[i];
+        }
+        jpegdec_test_crop_nv12(test, out);
+        return;
+    }
+
+    /* only read back the ROI */
+    const struct jpegdec_test_rect *roi = &test->roi;
+    out->width = roi->width;
+    out->height = roi->height;
+    va_create_image(va, out->width, out->height, test->fourcc, &test->image);
+    va_get_image(va, test->surface, roi->x, roi->y, out->width, out->height,
+                 test->image.image_id);
+    out->data = va_map_buffer(va, test->image.buf);
+    if (test->fourcc == VA_FOURCC_NV12) {
+        for (int i = 0; i < 2; i++) {
+            out->pitches[i] = test->image.pitches[i];
+            out->offsets[i] = test->image.offsets[i];
+        }
         return;
+    }
 
-    const unsigned char *stream = file->dri.segment + 4;
-    file->dri.Ri = segment_param_be16(stream);
+    jpegdec_test_alloc_nv12(&test->converted, out->width, out->height);
+    jpegdec_test_copy_image(&test->image, out->data, roi->x, roi->y, &test->converted);
+    va_unmap_buffer(va, test->image.buf);
+    va_destroy_image(va, test->image.image_id);
+    *out = test->converted;
 }
 
 static void
-jpegdec_test_parse_file_sos(struct jpegdec_test *test)
+jpegdec_test_unmap_output(struct jpegdec_test *test)
 {
-    struct jpegdec_test_file *file = &test->file;
-    const unsigned char *stream = file->sos.segment + 4;
+    struct va *va = &test->va;
+
+    if (test->output != JPEGDEC_TEST_OUTPUT_SURFACE || test->surface_userptr)
+        return;
 
-    file->sos.Ns = stream[0];
-    for (int i = 0; i < file->sos.Ns; i++) {
-        file->sos.Csj[i] = stream[1 + 2 * i];
-        file->sos.Tdj[i] = stream[1 + 2 * i + 1] >> 4;
-        file->sos.Taj[i] = stream[1 + 2 * i + 1] & 0xf;
+    if (test->converted.data) {
+        free(test->converted.data);
+        memset(&test->converted, 0, sizeof(test->converted));
+        return;
     }
+
+    va_unmap_buffer(va, test->image.buf);
+    va_destroy_image(va, test->image.image_id);
 }
 
 static void
-jpegdec_test_parse_file_dht(struct jpegdec_test *test)
+jpegdec_test_verify(struct jpegdec_test *test, const struct jpegdec_test_nv12 *ref)
 {
-    struct jpegdec_test_file *file = &test->file;
-    unsigned int count = 0;
+    struct jpegdec_test_nv12 out;
+    jpegdec_test_map_output(test, &out);
+
+    const uint32_t plane_widths[2] = { ref->width, (ref->width + 1) / 2 * 2 };
+    const uint32_t plane_heights[2] = { ref->height, (ref->height + 1) / 2 };
+    const char *plane_names[2] = { "Y", "UV" };
+    for (int i = 0; i < 2; i++) {
+        int max_diff = 0;
+        uint64_t mismatches = 0;
+        for (uint32_t y = 0; y < plane_heights[i]; y++) {
+            const uint8_t *hw = out.data + out.offsets[i] + out.pitches[i] * y;
+            const uint8_t *sw = ref->data + ref->offsets[i] + ref->pitches[i] * y;
+            for (uint32_t x = 0; x < plane_widths[i]; x++) {
+                const int diff = abs((int)hw[x] - (int)sw[x]);
+                if (diff) {
+                    mismatches++;
+                    if (diff > max_diff)
+                        max_diff = diff;
+                }
+            }
+        }
 
-    for (unsigned int i = 0; i < ARRAY_SIZE(file->dht.segments); i++) {
-        const unsigned char *stream = file->dht.segments[i];
-        if (!stream)
-            continue;
+        va_log("  %s: %" PRIu64 " of %u samples differ, max diff %d", plane_names[i],
+               mismatches, plane_widths[i] * plane_heights[i], max_diff);
+    }
 
-        stream += 2;
-        const unsigned char *end = stream + segment_param_be16(stream);
-        stream += 2;
+    jpegdec_test_unmap_output(test);
+}
 
-        while (stream < end) {
-            if (count >= ARRAY_SIZE(file->dht.Tc))
-                va_die("too many dht");
+static void
+jpegdec_test_load_ref_nv12(struct jpegdec_test *test,
+                           const char *filename,
+                           struct jpegdec_test_nv12 *ref)
+{
+    struct va *va = &test->va;
+    size_t size;
+    const uint8_t *ptr = va_map_file(va, filename, &size);
+
+    /* tightly packed, as written by ffmpeg -pix_fmt nv12 */
+    const uint32_t y_size = ref->width * ref->height;
+    const uint32_t uv_pitch = (ref->width + 1) & ~1;
+    const uint32_t uv_height = (ref->height + 1) / 2;
+    if (size != y_size + uv_pitch * uv_height)
+        va_die("%s is not a %ux%u nv12 file", filename, ref->width, ref->height);
+
+    for (uint32_t y = 0; y < ref->height; y++)
+        memcpy(ref->data + ref->offsets[0] + ref->pitches[0] * y, ptr + ref->width * y,
+               ref->width);
+    for (uint32_t y = 0; y < uv_height; y++)
+        memcpy(ref->data + ref->offsets[1] + ref->pitches[1] * y, ptr + y_size + uv_pitch * y,
+               uv_pitch);
+
+    va_unmap_file(va, ptr, size);
+}
 
-            file->dht.Tc[count] = stream[0] >> 4;
-            file->dht.Th[count] = stream[0] & 0xf;
-            file->dht.Li[count] = &stream[1];
+static const uint8_t *
+jpegdec_test_parse_ppm_uint(const uint8_t *ptr, const uint8_t *end, uint32_t *val)
+{
+    while (ptr < end && (isspace(*ptr) || *ptr == '#')) {
+        if (*ptr == '#') {
+            while (ptr < end && *ptr != '\n')
+                ptr++;
+        } else {
+            ptr++;
+        }
+    }
+    if (ptr == end || !isdigit(*ptr))
+        return NULL;
 
-            if (stream + 1 + 16 > end)
-                va_die("invalid dht");
-            int sum = 0;
-            for (int i = 0; i < 16; i++)
-                sum += stream[1 + i];
-            stream += 1 + 16;
+    *val = 0;
+    while (ptr < end && isdigit(*ptr))
+        *val = *val * 10 + (*ptr++ - '0');
 
-            file->dht.Vij[count] = &stream[0];
-            file->dht.Vij_sizes[count] = sum;
+    return ptr;
+}
 
-            stream += sum;
-            if (stream > end)
-                va_die("invalid dht");
+static void
+jpegdec_test_load_ref_ppm(struct jpegdec_test *test,
+                          const char *filename,
+                          struct jpegdec_test_nv12 *ref)
+{
+    struct va *va = &test->va;
+    size_t size;
+    const uint8_t *ptr = va_map_file(va, filename, &size);
+    const uint8_t *end = ptr + size;
+
+    uint32_t width;
+    uint32_t height;
+    uint32_t maxval;
+    const uint8_t *rgb = ptr + 2;
+    if (size < 2 || ptr[0] != 'P' || ptr[1] != '6' ||
+        !(rgb = jpegdec_test_parse_ppm_uint(rgb, end, &width)) ||
+        !(rgb = jpegdec_test_parse_ppm_uint(rgb, end, &height)) ||
+        !(rgb = jpegdec_test_parse_ppm_uint(rgb, end, &maxval)) || maxval != 255)
+        va_die("%s is not a binary ppm file", filename);
+    /* a single whitespace separates the header from the samples */
+    rgb++;
+
+    if (width != ref->width || height != ref->height)
+        va_die("%s is %ux%u instead of %ux%u", filename, width, height, ref->width, ref->height);
+    if ((size_t)(end - rgb) < (size_t)width * height * 3)
+        va_die("%s is truncated", filename);
+
+    /* full-range BT.601, the inverse of va_save_nv12 */
+#define CLAMP(v) (uint8_t)((v) > 255.0f ? 255 : (v) < 0.0f ? 0 : (int)((v) + 0.5f))
+    for (uint32_t y = 0; y < height; y++) {
+        const uint8_t *src = rgb + width * 3 * y;
+        uint8_t *dst = ref->data + ref->offsets[0] + ref->pitches[0] * y;
+        for (uint32_t x = 0; x < width; x++) {
+            const float luma = 0.299f * src[x * 3] + 0.587f * src[x * 3 + 1] +
+                               0.114f * src[x * 3 + 2];
+            dst[x] = CLAMP(luma);
+        }
+    }
 
-            count++;
+    for (uint32_t y = 0; y < (height + 1) / 2; y++) {
+        uint8_t *dst = ref->data + ref->offsets[1] + ref->pitches[1] * y;
+        for (uint32_t x = 0; x < (width + 1) / 2; x++) {
+            /* average the chroma of the 2x2 block, clamped to the edges */
+            float cb = 0.0f;
+            float cr = 0.0f;
+            for (uint32_t i = 0; i < 4; i++) {
+                const uint32_t sx = MIN2(x * 2 + (i & 1), width - 1);
+                const uint32_t sy = MIN2(y * 2 + (i >> 1), height - 1);
+                const uint8_t *src = rgb + (width * sy + sx) * 3;
+                cb += -0.168736f * src[0] - 0.331264f * src[1] + 0.5f * src[2];
+                cr += 0.5f * src[0] - 0.418688f * src[1] - 0.081312f * src[2];
+            }
+            dst[x * 2] = CLAMP(cb / 4.0f + 128.0f);
+            dst[x * 2 + 1] = CLAMP(cr / 4.0f + 128.0f);
         }
     }
+#undef CLAMP
+
+    va_unmap_file(va, ptr, size);
 }
 
 static void
-jpegdec_test_parse_file_sof0(struct jpegdec_test *test)
+jpegdec_test_load_ref(struct jpegdec_test *test,
+                      const char *filename,
+                      struct jpegdec_test_nv12 *ref)
 {
-    struct jpegdec_test_file *file = &test->file;
-    const unsigned char *stream = file->sof0.segment + 4;
+    const struct jpegva_file *file = &test->file;
+
+    char *name = strdup(filename);
+    if (!name)
+        va_die("failed to dup filename");
+    char *base = basename(name);
+    char *ext = strrchr(base, '.');
+    if (ext)
+        *ext = '\0';
+
+    jpegdec_test_alloc_nv12(ref, file->frame.sof0.X, file->frame.sof0.Y);
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s.nv12", test->ref_dir, base);
+    if (!access(path, R_OK)) {
+        jpegdec_test_load_ref_nv12(test, path, ref);
+    } else {
+        snprintf(path, sizeof(path), "%s/%s.ppm", test->ref_dir, base);
+        if (access(path, R_OK))
+            va_die("no %s.nv12 or %s.ppm in %s", base, base, test->ref_dir);
+        jpegdec_test_load_ref_ppm(test, path, ref);
+    }
 
-    file->sof0.P = stream[0];
-    file->sof0.Y = segment_param_be16(&stream[1]);
-    file->sof0.X = segment_param_be16(&stream[3]);
-    file->sof0.Nf = stream[5];
-    for (int i = 0; i < file->sof0.Nf; i++) {
-        file->sof0.Ci[i] = stream[6 + 3 * i];
-        file->sof0.Hi[i] = stream[6 + 3 * i + 1] >> 4;
-        file->sof0.Vi[i] = stream[6 + 3 * i + 1] & 0xf;
-        file->sof0.Tqi[i] = stream[6 + 3 * i + 2];
+    free(name);
+}
+
+static void
+jpegdec_test_compare(struct jpegdec_test *test,
+                     const char *filename,
+                     const struct jpegdec_test_nv12 *ref,
+                     const void *ptr,
+                     const uint32_t *pitches,
+                     const uint32_t *offsets)
+{
+    struct jpegdec_test_quality *quality;
+    if (!(test->quality_count & (test->quality_count - 1))) {
+        const int cap = test->quality_count ? test->quality_count * 2 : 16;
+        test->qualities = realloc(test->qualities, sizeof(*test->qualities) * cap);
+        if (!test->qualities)
+            va_die("failed to grow qualities");
     }
+    quality = &test->qualities[test->quality_count++];
+
+    quality->filename = strdup(filename);
+    if (!quality->filename)
+        va_die("failed to dup filename");
+
+    struct quality_plane ref_planes[3];
+    struct quality_plane planes[3];
+    quality_nv12_planes(ref->data, ref->pitches, ref->offsets, ref->width, ref->height,
+                        ref_planes);
+    quality_nv12_planes(ptr, pitches, offsets, ref->width, ref->height, planes);
+
+    const uint64_t begin = va_now();
+    for (int i = 0; i < 3; i++)
+        quality_compare(&planes[i], &ref_planes[i], &quality->planes[i]);
+    const uint64_t elapsed = va_now() - begin;
+    test->compare_time += elapsed;
+
+    const struct quality_result *q = quality->planes;
+    va_log("  psnr Y %.2f U %.2f V %.2f dB, ssim Y %.4f U %.4f V %.4f, %.3f ms", q[0].psnr,
+           q[1].psnr, q[2].psnr, q[0].ssim, q[1].ssim, q[2].ssim, elapsed / 1e6);
+}
+
+static int
+jpegdec_test_compare_quality(const void *a, const void *b)
+{
+    const struct jpegdec_test_quality *qa = a;
+    const struct jpegdec_test_quality *qb = b;
+
+    /* lowest luma psnr first, then lowest luma ssim */
+    if (qa->planes[0].psnr != qb->planes[0].psnr)
+        return qa->planes[0].psnr < qb->planes[0].psnr ? -1 : 1;
+    if (qa->planes[0].ssim != qb->planes[0].ssim)
+        return qa->planes[0].ssim < qb->planes[0].ssim ? -1 : 1;
+    return 0;
 }
 
 static void
-jpegdec_test_parse_file_dqt(struct jpegdec_test *test)
+jpegdec_test_report_quality(struct jpegdec_test *test)
 {
-    struct jpegdec_test_file *file = &test->file;
-    unsigned int count = 0;
+    if (!test->quality_count)
+        return;
 
-    for (unsigned int i = 0; i < ARRAY_SIZE(file->dqt.segments); i++) {
-        const unsigned char *stream = file->dqt.segments[i];
-        if (!stream)
-            continue;
+    qsort(test->qualities, test->quality_count, sizeof(*test->qualities),
+          jpegdec_test_compare_quality);
 
-        stream += 2;
-        const unsigned char *end = stream + segment_param_be16(stream);
-        stream += 2;
+    va_log("compared %d frames in %.3f ms", test->quality_count, test->compare_time / 1e6);
 
-        while (stream < end) {
-            if (count >= ARRAY_SIZE(file->dqt.Pq))
-                va_die("too many dqt");
+    const int worst_count = MIN2(test->worst_count, test->quality_count);
+    va_log("worst %d frames:", worst_count);
+    for (int i = 0; i < worst_count; i++) {
+        const struct jpegdec_test_quality *quality = &test->qualities[i];
+        const struct quality_result *q = quality->planes;
+        va_log("  %s: psnr Y %.2f U %.2f V %.2f dB, ssim Y %.4f U %.4f V %.4f", quality->filename,
+               q[0].psnr, q[1].psnr, q[2].psnr, q[0].ssim, q[1].ssim, q[2].ssim);
+    }
 
-            file->dqt.Pq[count] = stream[0] >> 4;
-            file->dqt.Tq[count] = stream[0] & 0xf;
-            file->dqt.Qk[count] = &stream[1];
+    for (int i = 0; i < test->quality_count; i++)
+        free(test->qualities[i].filename);
+    free(test->qualities);
+}
 
-            stream += 1 + 64 * (1 + file->dqt.Pq[count]);
-            if (stream > end)
-                va_die("invalid dqt");
+static bool
+jpegdec_test_decode(struct jpegdec_test *test)
+{
+    struct va *va = &test->va;
 
-            count++;
-        }
+    const VABufferID bufs[] = {
+        test->pic_param,   test->iq_matrix,  test->huffman_table,
+        test->slice_param, test->slice_data,
+    };
+    va_begin_picture(va, test->context, test->surface);
+    va_render_picture(va, test->context, bufs, ARRAY_SIZE(bufs));
+    va_end_picture(va, test->context);
+
+    if (va_sync_surface_status(va, test->surface) != VA_STATUS_SUCCESS) {
+        va_log("failed to sync surface: %s", va_sync_error_str(va));
+        return false;
     }
+
+    return true;
 }
 
 static void
-jpegdec_test_parse_file_segments(struct jpegdec_test *test)
+jpegdec_test_max_size(struct jpegdec_test *test, int *max_width, int *max_height)
 {
-    struct jpegdec_test_file *file = &test->file;
+    struct va *va = &test->va;
 
-    const unsigned char *stream = file->ptr;
-    if (file->size < 2 || stream[0] != 0xff || stream[1] != 0xd8)
-        va_die("expect jpeg magic");
+    *max_width = va_query_surface_attr(va, test->config, VASurfaceAttribMaxWidth, INT_MAX);
+    *max_height = va_query_surface_attr(va, test->config, VASurfaceAttribMaxHeight, INT_MAX);
+
+    const struct va_pair *pair = va_find_pair(va, test->profile, test->entrypoint);
+    if (pair && va_pair_has_attr(pair, VAConfigAttribMaxPictureWidth))
+        *max_width = MIN2(*max_width, (int)va_pair_get_attr(va, pair,
+                                                            VAConfigAttribMaxPictureWidth));
+    if (pair && va_pair_has_attr(pair, VAConfigAttribMaxPictureHeight))
+        *max_height = MIN2(*max_height, (int)va_pair_get_attr(va, pair,
+                                                              VAConfigAttribMaxPictureHeight));
+
+    if (test->max_width)
+        *max_width = MIN2(*max_width, test->max_width);
+    if (test->max_height)
+        *max_height = MIN2(*max_height, test->max_height);
+}
 
-    const unsigned char *end = stream + file->size;
-    while (stream < end && !file->eoi) {
-        if (stream + 2 > end)
-            va_die("incomplete jpeg file");
+static bool
+jpegdec_test_index_intervals(struct jpegdec_test *test)
+{
+    const struct jpegva_file *file = &test->file;
+    struct jpegdec_test_tiles *tiles = &test->tiles;
+    const uint8_t *scan = file->scan;
+    const int ri = file->frame.dri.Ri;
+
+    const int count = (tiles->mcu_cols * tiles->mcu_rows + ri - 1) / ri;
+    tiles->intervals =
+        malloc((sizeof(*tiles->intervals) + sizeof(*tiles->interval_sizes)) * count);
+    if (!tiles->intervals)
+        va_die("failed to alloc intervals");
+    tiles->interval_sizes = (void *)(tiles->intervals + count);
+
+    int index = 0;
+    int start = 0;
+    for (int i = 0; i + 1 < file->scan_size; i++) {
+        if (scan[i] != 0xff || (scan[i + 1] & 0xf8) != 0xd0)
+            continue;
+        if (index == count - 1)
+            return false;
 
-        if (stream[0] != 0xff)
-            va_die("expect segment marker");
+        tiles->intervals[index] = scan + start;
+        tiles->interval_sizes[index] = i - start;
+        index++;
 
-        const void **dst = NULL;
-        switch (stream[1]) {
-        case 0xc0: /* SOF0 */
-            dst = &file->sof0.segment;
-            break;
-        case 0xc4: /* DHT */
-            dst = &file->dht.segments[0];
-            break;
-        case 0xd8: /* SOI */
-            dst = &file->soi;
-            break;
-        case 0xd9: /* EOI */
-            dst = &file->eoi;
-            break;
-        case 0xda: /* SOS */
-            dst = &file->sos.segment;
-            break;
-        case 0xdb: /* DQT */
-            dst = &file->dqt.segments[0];
-            break;
-        case 0xdd: /* DRI */
-            dst = &file->dri.segment;
-            break;
-        case 0xe0: /* APP0 */
-        case 0xe1: /* APP1 */
-        case 0xe2: /* APP2 */
-            break;
-        default:
-            va_die("unknown marker 0x%02x%02x", stream[0], stream[1]);
-            break;
-        }
+        start = i + 2;
+        i++;
+    }
+    tiles->intervals[index] = scan + start;
+    tiles->interval_sizes[index] = file->scan_size - start;
+    tiles->interval_count = index + 1;
 
-        if (dst) {
-            /* duplicated segments */
-            if (*dst) {
-                if (dst == &file->dqt.segments[0] || dst == &file->dht.segments[0]) {
-                    for (size_t i = 1; i < ARRAY_SIZE(file->dqt.segments); i++) {
-                        if (!dst[i]) {
-                            dst = &dst[i];
-                            break;
-                        }
-                    }
-                }
+    return tiles->interval_count == count;
+}
 
-                if (*dst)
-                    va_die("duplicated segment 0x%02x%02x", stream[0], stream[1]);
-            }
+/* every slice must start on a restart interval; without them there is no
+ * entry point into the scan other than its start
+ */
+static bool
+jpegdec_test_plan_tiles(struct jpegdec_test *test, int max_width, int max_height)
+{
+    const struct jpegva_file *file = &test->file;
+    struct jpegdec_test_tiles *tiles = &test->tiles;
+    const int ri = file->frame.dri.Ri;
+
+    memset(tiles, 0, sizeof(*tiles));
+    jpegva_mcu_size(&file->frame, &tiles->mcu_width, &tiles->mcu_height);
+    tiles->mcu_cols = (file->frame.sof0.X + tiles->mcu_width - 1) / tiles->mcu_width;
+    tiles->mcu_rows = (file->frame.sof0.Y + tiles->mcu_height - 1) / tiles->mcu_height;
+
+    if (!ri)
+        return false;
+
+    const int max_cols = max_width / tiles->mcu_width;
+    const int max_rows = max_height / tiles->mcu_height;
+    if (tiles->mcu_cols <= max_cols) {
+        /* full-width bands that end on an interval */
+        tiles->tile_cols = tiles->mcu_cols;
+        tiles->tile_rows = max_rows;
+        while (tiles->tile_rows && (tiles->tile_rows * tiles->mcu_cols) % ri)
+            tiles->tile_rows--;
+    } else if (!(tiles->mcu_cols % ri)) {
+        /* each row of a tile spans whole intervals */
+        tiles->tile_cols = max_cols / ri * ri;
+        tiles->tile_rows = max_rows;
+    }
+    if (!tiles->tile_cols || !tiles->tile_rows)
+        return false;
+
+    if (!jpegdec_test_index_intervals(test)) {
+        va_log("restart intervals do not match the image size");
+        free(tiles->intervals);
+        tiles->intervals = NULL;
+        return false;
+    }
 
-            *dst = stream;
-        }
+    return true;
+}
 
-        stream += 2;
+static bool
+jpegdec_test_decode_tile(struct jpegdec_test *test, int x0, int y0, int cols, int rows)
+{
+    const struct jpegva_file *file = &test->file;
+    const struct jpegva_picture *pic = &test->picture;
+    const struct jpegdec_test_tiles *tiles = &test->tiles;
+    struct jpegdec_test_nv12 *stitched = &test->stitched;
+    struct va *va = &test->va;
+    const int ri = file->frame.dri.Ri;
+
+    const int x = x0 * tiles->mcu_width;
+    const int y = y0 * tiles->mcu_height;
+    const int width = MIN2(cols * tiles->mcu_width, file->frame.sof0.X - x);
+    const int height = MIN2(rows * tiles->mcu_height, file->frame.sof0.Y - y);
+
+    VAPictureParameterBufferJPEGBaseline pic_param = pic->pic_param;
+    pic_param.picture_width = width;
+    pic_param.picture_height = height;
+
+    const VASurfaceID surface =
+        va_create_surface(va, test->rt_format, width, height, test->fourcc);
+    const VAContextID context =
+        va_create_context(va, test->config, width, height, VA_PROGRESSIVE, &surface, 1);
+
+    /* a band spanning the full width is contiguous in the scan */
+    const bool full_width = cols == tiles->mcu_cols;
+    const int slice_count = full_width ? 1 : rows;
+    const int buf_count = 3 + slice_count * 2;
+    VABufferID *bufs = malloc(sizeof(*bufs) * buf_count);
+    if (!bufs)
+        va_die("failed to alloc tile bufs");
+
+    bufs[0] = va_create_buffer(va, context, VAPictureParameterBufferType, sizeof(pic_param),
+                               &pic_param);
+    bufs[1] = va_create_buffer(va, context, VAIQMatrixBufferType, sizeof(pic->iq_matrix),
+                               &pic->iq_matrix);
+    bufs[2] = va_create_buffer(va, context, VAHuffmanTableBufferType,
+                               sizeof(pic->huffman_table), &pic->huffman_table);
+    for (int i = 0; i < slice_count; i++) {
+        const int first_mcu = (y0 + i) * tiles->mcu_cols + x0;
+        const int mcu_count = full_width ? cols * rows : cols;
+        const int first = first_mcu / ri;
+        const int last = (first_mcu + mcu_count - 1) / ri;
+        const uint8_t *data = tiles->intervals[first];
+        const int size = tiles->intervals[last] + tiles->interval_sizes[last] - data;
+
+        VASliceParameterBufferJPEGBaseline slice_param = pic->slice_param;
+        slice_param.slice_data_size = size;
+        slice_param.slice_data_offset = 0;
+        slice_param.slice_data_flag = VA_SLICE_DATA_FLAG_ALL;
+        slice_param.slice_horizontal_position = 0;
+        slice_param.slice_vertical_position = i;
+        slice_param.num_mcus = mcu_count;
+
+        bufs[3 + i * 2] = va_create_buffer(va, context, VASliceParameterBufferType,
+                                           sizeof(slice_param), &slice_param);
+        bufs[4 + i * 2] = va_create_buffer(va, context, VASliceDataBufferType, size, data);
+    }
 
-        /* skip segment parameters */
-        if (dst != &file->soi && dst != &file->eoi) {
-            if (stream + 2 > end)
-                va_die("incomplete jpeg segment");
-            stream += segment_param_be16(stream);
-        }
+    va_begin_picture(va, context, surface);
+    va_render_picture(va, context, bufs, buf_count);
+    va_end_picture(va, context);
+    const bool ok = va_sync_surface_status(va, surface) == VA_STATUS_SUCCESS;
+    if (!ok)
+        va_log("failed to sync tile surface: %s", va_sync_error_str(va));
+
+    if (ok) {
+        VAImage img;
+        va_create_image(va, width, height, test->fourcc, &img);
+        va_get_image(va, surface, 0, 0, width, height, img.image_id);
+        const uint8_t *ptr = va_map_buffer(va, img.buf);
+
+        /* tiles start on MCU boundaries, which are even */
+        struct jpegdec_test_nv12 dst = *stitched;
+        dst.offsets[0] += dst.pitches[0] * y + x;
+        dst.offsets[1] += dst.pitches[1] * (y / 2) + x;
+        dst.width = width;
+        dst.height = height;
+        jpegdec_test_copy_image(&img, ptr, 0, 0, &dst);
+
+        va_unmap_buffer(va, img.buf);
+        va_destroy_image(va, img.image_id);
+    }
+
+    for (int i = 0; i < buf_count; i++)
+        va_destroy_buffer(va, bufs[i]);
+    free(bufs);
 
-        if (dst == &file->sos.segment) {
-            file->scan = stream;
+    va_destroy_context(va, context);
+    va_destroy_surface(va, surface);
+
+    return ok;
+}
 
-            /* skip scan data */
-            while (stream + 2 < end && (stream[0] != 0xff || stream[1] == 0x00))
-                stream++;
+static bool
+jpegdec_test_decode_tiles(struct jpegdec_test *test)
+{
+    const struct jpegva_file *file = &test->file;
+    const struct jpegdec_test_tiles *tiles = &test->tiles;
+    struct va *va = &test->va;
 
-            file->scan_size = (const void *)stream - file->scan;
+    jpegdec_test_alloc_nv12(&test->stitched, file->frame.sof0.X, file->frame.sof0.Y);
+
+    for (int y0 = 0; y0 < tiles->mcu_rows; y0 += tiles->tile_rows) {
+        for (int x0 = 0; x0 < tiles->mcu_cols; x0 += tiles->tile_cols) {
+            va_trace_begin(va, "tile");
+            const bool ok = jpegdec_test_decode_tile(
+                test, x0, y0, MIN2(tiles->tile_cols, tiles->mcu_cols - x0),
+                MIN2(tiles->tile_rows, tiles->mcu_rows - y0));
+            va_trace_end(va, "tile");
+            if (!ok)
+                return false;
         }
     }
 
-    if (!file->soi || !file->dqt.segments[0] || !file->sof0.segment || !file->dht.segments[0] ||
-        !file->sos.segment || !file->scan || !file->eoi)
-        va_die("missing jpeg segments");
+    return true;
 }
 
 static void
-jpegdec_test_parse_file(struct jpegdec_test *test)
+jpegdec_test_release_warm(struct jpegdec_test *test)
 {
-    jpegdec_test_parse_file_segments(test);
+    struct va *va = &test->va;
+
+    if (!test->warm.valid)
+        return;
 
-    jpegdec_test_parse_file_dqt(test);
-    jpegdec_test_parse_file_sof0(test);
-    jpegdec_test_parse_file_dht(test);
-    jpegdec_test_parse_file_sos(test);
-    jpegdec_test_parse_file_dri(test);
+    va_destroy_surface(va, test->surface);
+    va_destroy_context(va, test->context);
+    va_destroy_config(va, test->config);
+    test->warm.valid = false;
 }
 
 static void
-jpegdec_test_decode_file(struct jpegdec_test *test, const char *filename)
+jpegdec_test_prepare(struct jpegdec_test *test)
 {
+    const struct jpegva_file *file = &test->file;
+    const struct jpegva_picture *pic = &test->picture;
     struct va *va = &test->va;
 
-    test->file.ptr = va_map_file(va, filename, &test->file.size);
-    jpegdec_test_parse_file(test);
+    unsigned int rt_format;
+    unsigned int pix_format;
+    const bool supported = jpegva_pick_decode_format(va, &file->frame, &rt_format, &pix_format);
 
-    jpegdec_test_prepare(test);
-    jpegdec_test_decode(test);
+    if (supported && test->warm.valid && test->warm.width == file->frame.sof0.X &&
+        test->warm.height == file->frame.sof0.Y && test->fourcc == pix_format) {
+        test->output = JPEGDEC_TEST_OUTPUT_SURFACE;
+        goto create_buffers;
+    }
+    jpegdec_test_release_warm(test);
+
+    if (!supported) {
+        const struct jpegparse_frame *frame = &file->frame;
+        if (!test->soak.enabled)
+            va_log("%d components at %dx%d sampling have no supported surface format; "
+                   "decoding on the cpu",
+                   frame->sof0.Nf, frame->sof0.Hi[0], frame->sof0.Vi[0]);
+        test->config = VA_INVALID_ID;
+        test->output = JPEGDEC_TEST_OUTPUT_CPU;
+        return;
+    }
 
-    jpegdec_test_dump(test, "decoded.ppm");
+    test->rt_format = rt_format;
+    test->fourcc = pix_format;
+    test->config = va_create_config(va, test->profile, test->entrypoint, rt_format);
 
-    va_destroy_buffer(va, test->pic_param);
-    va_destroy_buffer(va, test->iq_matrix);
-    va_destroy_buffer(va, test->huffman_table);
-    va_destroy_buffer(va, test->slice_param);
-    va_destroy_buffer(va, test->slice_data);
+    int max_width;
+    int max_height;
+    jpegdec_test_max_size(test, &max_width, &max_height);
+    if (file->frame.sof0.X > max_width || file->frame.sof0.Y > max_height) {
+        if (jpegdec_test_plan_tiles(test, max_width, max_height)) {
+            const struct jpegdec_test_tiles *tiles = &test->tiles;
+            if (!test->soak.enabled)
+                va_log("%dx%d exceeds %dx%d; decoding in tiles of %dx%d MCUs", file->frame.sof0.X,
+                       file->frame.sof0.Y, max_width, max_height, tiles->tile_cols,
+                       tiles->tile_rows);
+            test->output = JPEGDEC_TEST_OUTPUT_TILES;
+        } else {
+            if (!test->soak.enabled)
+                va_log("%dx%d exceeds %dx%d and cannot be tiled; decoding on the cpu",
+                       file->frame.sof0.X, file->frame.sof0.Y, max_width, max_height);
+            test->output = JPEGDEC_TEST_OUTPUT_CPU;
+        }
+        return;
+    }
+    test->output = JPEGDEC_TEST_OUTPUT_SURFACE;
+
+    /* other formats fall back to driver memory for this frame only */
+    bool userptr = test->userptr && pix_format == VA_FOURCC_NV12;
+
+    /* drivers that do not report memory types only support their own */
+    if (userptr &&
+        !(va_query_surface_attr(va, test->config, VASurfaceAttribMemoryType,
+                                VA_SURFACE_ATTRIB_MEM_TYPE_VA) &
+          VA_SURFACE_ATTRIB_MEM_TYPE_USER_PTR)) {
+        va_log("user pointer surfaces are not supported; using driver memory");
+        test->userptr = false;
+        userptr = false;
+    }
 
-    va_destroy_config(va, test->config);
-    va_destroy_surface(va, test->surface);
-    va_destroy_context(va, test->context);
+    test->surface_userptr = userptr;
+    if (userptr) {
+        va_userptr_layout(&test->userptr_desc, pix_format, file->frame.sof0.X,
+                          file->frame.sof0.Y);
+        void *ptr = va_arena_reserve(&test->arena, test->userptr_desc.data_size);
+        test->surface = va_create_surface_userptr(va, rt_format, &test->userptr_desc, ptr);
+    } else {
+        test->surface = va_create_surface(va, rt_format, file->frame.sof0.X, file->frame.sof0.Y,
+                                          pix_format);
+    }
+    test->context = va_create_context(va, test->config, file->frame.sof0.X, file->frame.sof0.Y,
+                                      VA_PROGRESSIVE, &test->surface, 1);
 
-    va_unmap_file(va, test->file.ptr, test->file.size);
+    if (test->warm.enabled) {
+        test->warm.valid = true;
+        test->warm.width = file->frame.sof0.X;
+        test->warm.height = file->frame.sof0.Y;
+    }
+
+create_buffers:
+    test->pic_param = va_create_buffer(va, test->context, VAPictureParameterBufferType,
+                                       sizeof(pic->pic_param), &pic->pic_param);
+    test->iq_matrix = va_create_buffer(va, test->context, VAIQMatrixBufferType,
+                                       sizeof(pic->iq_matrix), &pic->iq_matrix);
+    test->huffman_table = va_create_buffer(va, test->context, VAHuffmanTableBufferType,
+                                           sizeof(pic->huffman_table), &pic->huffman_table);
+    test->slice_param = va_create_buffer(va, test->context, VASliceParameterBufferType,
+                                         sizeof(pic->slice_param), &pic->slice_param);
+
+    test->slice_data =
+        va_create_buffer(va, test->context, VASliceDataBufferType, file->scan_size, file->scan);
+}
+
+/* decodes test->file on the gpu, or on the cpu with --sw, and returns the
+ * latency; test->file must be released even when the scan fails to decode
+ */
+static bool
+jpegdec_test_run(struct jpegdec_test *test, uint64_t *latency)
+{
+    const uint64_t begin = va_now();
+    bool ok = false;
+
+    if (test->sw) {
+        test->output = JPEGDEC_TEST_OUTPUT_CPU;
+        ok = jpegdec_test_sw_decode(test, &test->stitched);
+        *latency = va_now() - begin;
+        return ok;
+    }
+
+    jpegdec_test_prepare(test);
+    switch (test->output) {
+    case JPEGDEC_TEST_OUTPUT_SURFACE:
+        ok = jpegdec_test_decode(test);
+        break;
+    case JPEGDEC_TEST_OUTPUT_TILES:
+        ok = jpegdec_test_decode_tiles(test);
+        break;
+    case JPEGDEC_TEST_OUTPUT_CPU:
+        ok = jpegdec_test_sw_decode(test, &test->stitched);
+        break;
+    }
+
+    *latency = va_now() - begin;
+    return ok;
+}
+
+/* frames of an archive stay mapped with the archive */
+static void
+jpegdec_test_unmap_file(struct jpegdec_test *test)
+{
+    if (!test->archive.ptr)
+        va_unmap_file(&test->va, test->file.ptr, test->file.size);
     memset(&test->file, 0, sizeof(test->file));
 }
 
 static void
-jpegdec_test_cleanup(struct jpegdec_test *test)
+jpegdec_test_release(struct jpegdec_test *test)
 {
     struct va *va = &test->va;
 
-    va_cleanup(va);
+    if (test->output == JPEGDEC_TEST_OUTPUT_SURFACE) {
+        va_destroy_buffer(va, test->pic_param);
+        va_destroy_buffer(va, test->iq_matrix);
+        va_destroy_buffer(va, test->huffman_table);
+        va_destroy_buffer(va, test->slice_param);
+        va_destroy_buffer(va, test->slice_data);
+
+        if (!test->warm.valid) {
+            va_destroy_surface(va, test->surface);
+            va_destroy_context(va, test->context);
+            va_destroy_config(va, test->config);
+        }
+    } else {
+        free(test->tiles.intervals);
+        free(test->stitched.data);
+        memset(&test->tiles, 0, sizeof(test->tiles));
+        memset(&test->stitched, 0, sizeof(test->stitched));
+
+        if (!test->sw && test->config != VA_INVALID_ID)
+            va_destroy_config(va, test->config);
+    }
+
+    jpegdec_test_unmap_file(test);
 }
 
-int
-main(int argc, char **argv)
+static inline uint64_t
+jpegdec_test_hash_round(uint64_t acc, uint64_t val)
 {
-    struct jpegdec_test test = {
-        .profile = VAProfileJPEGBaseline,
-        .entrypoint = VAEntrypointVLD,
-    };
+    acc += val * 0xc2b2ae3d27d4eb4full;
+    acc = (acc << 31) | (acc >> 33);
+    return acc * 0x9e3779b185ebca87ull;
+}
+
+/* a multiply-rotate hash in the style of xxHash64; the four lanes are
+ * independent so that the multiplies overlap
+ */
+static uint64_t
+jpegdec_test_hash(const void *ptr, size_t size, uint64_t seed)
+{
+    const uint8_t *p = ptr;
+    const uint8_t *end = p + size;
+
+    uint64_t lanes[4] = { seed + 1, seed + 2, seed + 3, seed + 4 };
+    for (; end - p >= 32; p += 32) {
+        for (int i = 0; i < 4; i++) {
+            uint64_t val;
+            memcpy(&val, p + 8 * i, 8);
+            lanes[i] = jpegdec_test_hash_round(lanes[i], val);
+        }
+    }
+
+    uint64_t h = size;
+    for (int i = 0; i < 4; i++)
+        h = jpegdec_test_hash_round(h, lanes[i]);
+    for (; end - p >= 8; p += 8) {
+        uint64_t val;
+        memcpy(&val, p, 8);
+        h = jpegdec_test_hash_round(h, val);
+    }
+    if (p < end) {
+        uint64_t val = 0;
+        memcpy(&val, p, end - p);
+        h = jpegdec_test_hash_round(h, val);
+    }
+
+    h ^= h >> 33;
+    h *= 0xc2b2ae3d27d4eb4full;
+    h ^= h >> 29;
+    h *= 0x165667b19e3779f9ull;
+    h ^= h >> 32;
+
+    return h;
+}
+
+static void
+jpegdec_test_cache_path(const struct jpegdec_test *test,
+                        uint64_t key,
+                        char *path,
+                        size_t path_size)
+{
+    snprintf(path, path_size, "%s/%016" PRIx64 ".nv12", test->cache.dir, key);
+}
+
+static struct jpegdec_test_cache_entry *
+jpegdec_test_cache_find(struct jpegdec_test *test, uint64_t key)
+{
+    struct jpegdec_test_cache *cache = &test->cache;
+
+    for (int i = 0; i < cache->entry_count; i++) {
+        if (cache->entries[i].key == key)
+            return &cache->entries[i];
+    }
+    return NULL;
+}
+
+/* drops the entry from the index but keeps the file */
+static void
+jpegdec_test_cache_forget(struct jpegdec_test *test, struct jpegdec_test_cache_entry *entry)
+{
+    struct jpegdec_test_cache *cache = &test->cache;
+
+    cache->total_size -= entry->size;
+    *entry = cache->entries[--cache->entry_count];
+}
+
+static void
+jpegdec_test_cache_remove(struct jpegdec_test *test, struct jpegdec_test_cache_entry *entry)
+{
+    char path[PATH_MAX];
+    jpegdec_test_cache_path(test, entry->key, path, sizeof(path));
+    unlink(path);
+
+    jpegdec_test_cache_forget(test, entry);
+}
+
+static void
+jpegdec_test_cache_add(struct jpegdec_test *test,
+                       uint64_t key,
+                       uint64_t size,
+                       uint64_t last_use)
+{
+    struct jpegdec_test_cache *cache = &test->cache;
+
+    if (cache->entry_count == cache->entry_max) {
+        cache->entry_max = cache->entry_max ? cache->entry_max * 2 : 64;
+        cache->entries = realloc(cache->entries, sizeof(*cache->entries) * cache->entry_max);
+        if (!cache->entries)
+            va_die("failed to grow cache entries");
+    }
+
+    cache->entries[cache->entry_count++] = (struct jpegdec_test_cache_entry){
+        .key = key,
+        .size = size,
+        .last_use = last_use,
+    };
+    cache->total_size += size;
+}
+
+/* evicts the least recently used entries until the cache fits */
+static void
+jpegdec_test_cache_evict(struct jpegdec_test *test)
+{
+    struct jpegdec_test_cache *cache = &test->cache;
+
+    while (cache->total_size > cache->max_size) {
+        struct jpegdec_test_cache_entry *lru = &cache->entries[0];
+        for (int i = 1; i < cache->entry_count; i++) {
+            if (cache->entries[i].last_use < lru->last_use)
+                lru = &cache->entries[i];
+        }
+        jpegdec_test_cache_remove(test, lru);
+        cache->evictions++;
+    }
+}
+
+static uint64_t
+jpegdec_test_cache_touch(const char *path)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    const struct timespec times[2] = { ts, ts };
+    utimensat(AT_FDCWD, path, times, 0);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* indexes the entries left by earlier runs, ordered by their mtimes */
+static void
+jpegdec_test_cache_init(struct jpegdec_test *test)
+{
+    struct jpegdec_test_cache *cache = &test->cache;
+
+    if (mkdir(cache->dir, 0755) && errno != EEXIST)
+        va_die("failed to create %s", cache->dir);
+
+    DIR *dir = opendir(cache->dir);
+    if (!dir)
+        va_die("failed to open %s", cache->dir);
+
+    const struct dirent *ent;
+    while ((ent = readdir(dir))) {
+        uint64_t key;
+        int len;
+        if (sscanf(ent->d_name, "%16" SCNx64 ".nv12%n", &key, &len) != 1 ||
+            len != (int)strlen(ent->d_name))
+            continue;
+
+        char path[PATH_MAX];
+        jpegdec_test_cache_path(test, key, path, sizeof(path));
+        struct stat st;
+        if (stat(path, &st))
+            continue;
+
+        jpegdec_test_cache_add(test, key, st.st_size,
+                               (uint64_t)st.st_mtim.tv_sec * 1000000000ull +
+                                   st.st_mtim.tv_nsec);
+    }
+    closedir(dir);
+
+    jpegdec_test_cache_evict(test);
+}
+
+/* the key covers the input bytes, the ROI and the decode setup; entries
+ * outlive the run, and another driver, libva or decode path must miss
+ */
+static uint64_t
+jpegdec_test_cache_key(struct jpegdec_test *test)
+{
+    struct va *va = &test->va;
+    const struct jpegdec_test_rect *roi = &test->roi;
+
+    unsigned int rt_format;
+    unsigned int fourcc;
+    if (!jpegva_pick_decode_format(va, &test->file.frame, &rt_format, &fourcc)) {
+        rt_format = 0;
+        fourcc = 0;
+    }
+
+    const uint64_t setup[] = {
+        (uint64_t)roi->x << 48 ^ (uint64_t)roi->y << 32 ^ (uint64_t)roi->width << 16 ^
+            roi->height,
+        (uint64_t)va->major << 32 | va->minor,
+        (uint64_t)rt_format << 32 | fourcc,
+        (uint64_t)test->max_width << 32 | test->max_height,
+        test->userptr,
+    };
+    uint64_t seed = va->vendor ? jpegdec_test_hash(va->vendor, strlen(va->vendor), 0) : 0;
+    seed = jpegdec_test_hash(setup, sizeof(setup), seed);
+
+    return jpegdec_test_hash(test->file.ptr, test->file.size, seed);
+}
+
+/* loads a cached output into nv12, or returns false on a miss */
+static bool
+jpegdec_test_cache_lookup(struct jpegdec_test *test, uint64_t key, struct jpegdec_test_nv12 *nv12)
+{
+    const struct jpegdec_test_rect *roi = &test->roi;
+
+    struct jpegdec_test_cache_entry *entry = jpegdec_test_cache_find(test, key);
+    if (!entry)
+        return false;
+
+    char path[PATH_MAX];
+    jpegdec_test_cache_path(test, key, path, sizeof(path));
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        /* another process evicted it */
+        jpegdec_test_cache_forget(test, entry);
+        return false;
+    }
+
+    struct jpegdec_test_cache_header hdr;
+    bool hit = fread(&hdr, sizeof(hdr), 1, fp) == 1 && hdr.magic == JPEGDEC_TEST_CACHE_MAGIC &&
+               hdr.width == (uint32_t)roi->width && hdr.height == (uint32_t)roi->height &&
+               hdr.input_size == test->file.size;
+    if (hit) {
+        jpegdec_test_alloc_nv12(nv12, hdr.width, hdr.height);
+        const size_t size = nv12->offsets[1] + nv12->pitches[1] * ((hdr.height + 1) / 2);
+        hit = hdr.pitch == nv12->pitches[0] && fread(nv12->data, size, 1, fp) == 1;
+        if (!hit)
+            free(nv12->data);
+    }
+    fclose(fp);
+
+    /* a collision or a truncated file is replaced by the next store */
+    if (hit)
+        entry->last_use = jpegdec_test_cache_touch(path);
+
+    return hit;
+}
+
+/* writes an output that is already mapped under a temporary name so that
+ * concurrent runs never read a partial entry
+ */
+static void
+jpegdec_test_cache_store(struct jpegdec_test *test,
+                         uint64_t key,
+                         const struct jpegdec_test_nv12 *out)
+{
+    struct jpegdec_test_cache *cache = &test->cache;
+
+    const uint32_t pitch = (out->width + 1) & ~1;
+    const uint64_t size = sizeof(struct jpegdec_test_cache_header) +
+                          (uint64_t)pitch * (out->height + (out->height + 1) / 2);
+    if (size > cache->max_size)
+        return;
+
+    char path[PATH_MAX];
+    char tmp_path[PATH_MAX];
+    jpegdec_test_cache_path(test, key, path, sizeof(path));
+    snprintf(tmp_path, sizeof(tmp_path), "%s/.%016" PRIx64 ".%d", cache->dir, key, getpid());
+
+    /* the cache is best effort; a full disk must not fail the decodes */
+    FILE *fp = fopen(tmp_path, "w");
+    if (!fp) {
+        va_log("failed to open %s; not caching", tmp_path);
+        return;
+    }
+
+    const struct jpegdec_test_cache_header hdr = {
+        .magic = JPEGDEC_TEST_CACHE_MAGIC,
+        .width = out->width,
+        .height = out->height,
+        .pitch = pitch,
+        .input_size = test->file.size,
+    };
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1;
+    for (uint32_t y = 0; ok && y < out->height; y++)
+        ok = fwrite(out->data + out->offsets[0] + out->pitches[0] * y, pitch, 1, fp) == 1;
+    for (uint32_t y = 0; ok && y < (out->height + 1) / 2; y++)
+        ok = fwrite(out->data + out->offsets[1] + out->pitches[1] * y, pitch, 1, fp) == 1;
+    if (fclose(fp))
+        ok = false;
+    if (!ok)
+        va_log("failed to write %s; not caching", tmp_path);
+    if (ok && rename(tmp_path, path)) {
+        va_log("failed to rename %s; not caching", tmp_path);
+        ok = false;
+    }
+    if (!ok) {
+        unlink(tmp_path);
+        return;
+    }
+
+    struct jpegdec_test_cache_entry *entry = jpegdec_test_cache_find(test, key);
+    if (entry)
+        jpegdec_test_cache_forget(test, entry);
+    jpegdec_test_cache_add(test, key, size, jpegdec_test_cache_touch(path));
+    jpegdec_test_cache_evict(test);
+}
+
+static void
+jpegdec_test_report_cache(const struct jpegdec_test *test)
+{
+    const struct jpegdec_test_cache *cache = &test->cache;
+
+    const int lookups = cache->hits + cache->misses;
+    if (!lookups)
+        return;
+
+    va_log("cache: %d hits, %d misses, %.1f%% hit rate, %.3f ms per hit, %d evictions, "
+           "%d entries in %.1f MiB",
+           cache->hits, cache->misses, 100.0 * cache->hits / lookups,
+           cache->hits ? cache->hit_time / 1e6 / cache->hits : 0.0, cache->evictions,
+           cache->entry_count, cache->total_size / (1024.0 * 1024.0));
+}
+
+/* compares an output against the golden image from --ref-dir, which is
+ * freed, and saves it unless --no-save
+ */
+static void
+jpegdec_test_finish_output(struct jpegdec_test *test,
+                           const char *filename,
+                           int frame,
+                           struct jpegdec_test_nv12 *golden,
+                           const struct jpegdec_test_nv12 *out)
+{
+    struct va *va = &test->va;
+
+    if (test->ref_dir) {
+        va_trace_begin(va, "compare");
+        va_trace_flow(va, 't', "frame", frame);
+        jpegdec_test_compare(test, filename, golden, out->data, out->pitches, out->offsets);
+        va_trace_end(va, "compare");
+        free(golden->data);
+    }
+
+    if (!test->no_save) {
+        va_trace_begin(va, "save");
+        va_trace_flow(va, 'f', "frame", frame);
+        va_save_nv12(out->data, out->width, out->height, out->pitches, out->offsets,
+                     "decoded.ppm");
+        va_trace_end(va, "save");
+    }
+}
+
+/* decodes from the cache, or returns false and the key to store under */
+static bool
+jpegdec_test_decode_cached(struct jpegdec_test *test,
+                           const char *filename,
+                           int frame,
+                           uint64_t *key)
+{
+    struct jpegdec_test_cache *cache = &test->cache;
+    struct va *va = &test->va;
+
+    va_trace_begin(va, "cache lookup");
+    const uint64_t begin = va_now();
+    *key = jpegdec_test_cache_key(test);
+    struct jpegdec_test_nv12 out;
+    const bool hit = jpegdec_test_cache_lookup(test, *key, &out);
+    const uint64_t elapsed = va_now() - begin;
+    va_trace_end(va, "cache lookup");
+
+    if (!hit) {
+        cache->misses++;
+        return false;
+    }
+    cache->hits++;
+    cache->hit_time += elapsed;
+    test->latency = elapsed;
+
+    struct jpegdec_test_nv12 golden;
+    if (test->ref_dir) {
+        va_log("%s: %dx%d, cache %.3f ms", filename, out.width, out.height, elapsed / 1e6);
+        jpegdec_test_load_ref(test, filename, &golden);
+        jpegdec_test_crop_nv12(test, &golden);
+    }
+    jpegdec_test_finish_output(test, filename, frame, &golden, &out);
+
+    free(out.data);
+    jpegdec_test_unmap_file(test);
+
+    return true;
+}
+
+static void
+jpegdec_test_decode_file(struct jpegdec_test *test, const char *filename)
+{
+    struct va *va = &test->va;
+    const int frame = test->frame_count++;
+
+    va_trace_begin(va, "parse");
+    va_trace_flow(va, 's', "frame", frame);
+    /* frames of an archive are already mapped */
+    if (!test->archive.ptr)
+        test->file.ptr = va_map_file(va, filename, &test->file.size);
+    const enum jpegparse_result result = jpegva_parse_file(&test->parser, &test->file);
+    if (result != JPEGPARSE_OK) {
+        va_die("failed to parse %s at offset %" PRIu64 ": %s", filename, test->parser.offset,
+               jpegparse_result_str(result));
+    }
+    jpegva_init_picture(&test->picture, &test->file);
+    if (!jpegdec_test_set_roi(test, filename))
+        va_die("failed to crop %s", filename);
+    va_trace_end(va, "parse");
+
+    uint64_t cache_key = 0;
+    if (test->cache.dir && jpegdec_test_decode_cached(test, filename, frame, &cache_key))
+        return;
+
+    struct jpegdec_test_nv12 golden;
+    if (test->ref_dir) {
+        va_trace_begin(va, "load ref");
+        jpegdec_test_load_ref(test, filename, &golden);
+        jpegdec_test_crop_nv12(test, &golden);
+        va_trace_end(va, "load ref");
+    }
+
+    struct jpegdec_test_nv12 ref;
+    uint64_t sw_time = 0;
+    if (test->sw || test->verify) {
+        va_trace_begin(va, "sw decode");
+        va_trace_flow(va, 't', "frame", frame);
+        const uint64_t begin = va_now();
+        if (!jpegdec_test_sw_decode(test, &ref))
+            va_die("failed to decode %s on the cpu", filename);
+        sw_time = va_now() - begin;
+        jpegdec_test_crop_nv12(test, &ref);
+        va_trace_end(va, "sw decode");
+    }
+
+    if (test->sw) {
+        test->latency = sw_time;
+        if (!test->soak.enabled)
+            va_log("%s: %dx%d, cpu %.3f ms", filename, ref.width, ref.height, sw_time / 1e6);
+
+        jpegdec_test_finish_output(test, filename, frame, &golden, &ref);
+        free(ref.data);
+        jpegdec_test_unmap_file(test);
+        return;
+    }
+
+    va_trace_begin(va, "decode");
+    va_trace_flow(va, 't', "frame", frame);
+    uint64_t hw_time;
+    if (!jpegdec_test_run(test, &hw_time))
+        va_die("failed to decode %s", filename);
+    va_trace_end(va, "decode");
+    test->latency = hw_time;
+
+    if (test->verify) {
+        va_log("%s: %dx%d, gpu %.3f ms, cpu %.3f ms", filename, ref.width, ref.height,
+               hw_time / 1e6, sw_time / 1e6);
+        jpegdec_test_verify(test, &ref);
+        free(ref.data);
+    }
+
+    if (test->ref_dir && !test->verify)
+        va_log("%s: %dx%d, gpu %.3f ms", filename, golden.width, golden.height, hw_time / 1e6);
+
+    /* the output is read back once for the compare, the cache and the save */
+    if (test->ref_dir || test->cache.dir || !test->no_save) {
+        struct jpegdec_test_nv12 out;
+        jpegdec_test_map_output(test, &out);
+        jpegdec_test_finish_output(test, filename, frame, &golden, &out);
+        if (test->cache.dir) {
+            va_trace_begin(va, "cache store");
+            jpegdec_test_cache_store(test, cache_key, &out);
+            va_trace_end(va, "cache store");
+        }
+        jpegdec_test_unmap_output(test);
+    }
+
+    jpegdec_test_release(test);
+}
+
+static void
+jpegdec_test_archive_frame(void *data, const struct jpegparse_frame *frame)
+{
+    struct jpegdec_test_archive_entry *entry = data;
+
+    entry->width = frame->sof0.X;
+    entry->height = frame->sof0.Y;
+    entry->table_hash = jpegdec_test_hash(&frame->dqt, sizeof(frame->dqt), 0);
+    entry->table_hash = jpegdec_test_hash(&frame->dht, sizeof(frame->dht), entry->table_hash);
+}
+
+static void
+jpegdec_test_archive_add(struct jpegdec_test_archive *archive,
+                         const struct jpegdec_test_archive_entry *entry)
+{
+    if (archive->entry_count == archive->entry_max) {
+        archive->entry_max = archive->entry_max ? archive->entry_max * 2 : 256;
+        archive->entries =
+            realloc(archive->entries, sizeof(*archive->entries) * archive->entry_max);
+        if (!archive->entries)
+            va_die("failed to grow frame index");
+    }
+    archive->entries[archive->entry_count++] = *entry;
+}
+
+/* indexes the frames in one pass; bytes between frames, such as container
+ * headers, are skipped
+ */
+static void
+jpegdec_test_archive_build(struct jpegdec_test *test, const char *filename)
+{
+    static const struct jpegparse_callbacks callbacks = {
+        .frame = jpegdec_test_archive_frame,
+    };
+    struct jpegdec_test_archive *archive = &test->archive;
+    const uint8_t *ptr = archive->ptr;
+
+    size_t pos = 0;
+    while (pos < archive->size) {
+        const uint8_t *soi = memmem(ptr + pos, archive->size - pos, "\xff\xd8", 2);
+        if (!soi)
+            break;
+        pos = soi - ptr;
+
+        struct jpegdec_test_archive_entry entry = { .offset = pos };
+        jpegparse_init(&test->parser, &callbacks, &entry);
+        enum jpegparse_result result = jpegparse_feed(&test->parser, soi, archive->size - pos);
+        if (result == JPEGPARSE_OK)
+            result = jpegparse_finish(&test->parser);
+        if (result == JPEGPARSE_ERROR_TRUNCATED && archive->entry_count) {
+            va_log("%s: ignoring a truncated frame at offset %zu", filename, pos);
+            break;
+        }
+        if (result != JPEGPARSE_OK) {
+            /* resynchronize on the next SOI rather than losing the rest of the archive */
+            va_log("%s: skipping a bad frame at offset %zu: %s at +%" PRIu64, filename, pos,
+                   jpegparse_result_str(result), test->parser.offset);
+            pos += 2;
+            continue;
+        }
+        if (test->parser.offset > UINT32_MAX)
+            va_die("%s: frame %d is too large", filename, archive->entry_count);
+
+        entry.size = test->parser.offset;
+        jpegdec_test_archive_add(archive, &entry);
+        pos += entry.size;
+    }
+
+    if (!archive->entry_count)
+        va_die("%s: no frames", filename);
+}
+
+static bool
+jpegdec_test_archive_load(struct jpegdec_test *test, const char *path, const struct stat *st)
+{
+    struct jpegdec_test_archive *archive = &test->archive;
+
+    FILE *fp = fopen(path, "r");
+    if (!fp)
+        return false;
+
+    struct jpegdec_test_archive_header hdr;
+    bool ok = fread(&hdr, sizeof(hdr), 1, fp) == 1 && hdr.magic == JPEGDEC_TEST_ARCHIVE_MAGIC &&
+              hdr.version == JPEGDEC_TEST_ARCHIVE_VERSION &&
+              hdr.input_size == (uint64_t)st->st_size &&
+              hdr.input_mtime == (uint64_t)st->st_mtim.tv_sec * 1000000000ull +
+                                     st->st_mtim.tv_nsec &&
+              hdr.entry_count && hdr.entry_count <= INT_MAX;
+    if (ok) {
+        archive->entry_count = hdr.entry_count;
+        archive->entry_max = hdr.entry_count;
+        archive->entries = malloc(sizeof(*archive->entries) * hdr.entry_count);
+        if (!archive->entries)
+            va_die("failed to alloc frame index");
+        ok = fread(archive->entries, sizeof(*archive->entries), hdr.entry_count, fp) ==
+             hdr.entry_count;
+    }
+    fclose(fp);
+
+    for (int i = 0; ok && i < archive->entry_count; i++) {
+        const struct jpegdec_test_archive_entry *entry = &archive->entries[i];
+        ok = entry->offset + entry->size <= archive->size;
+    }
+
+    if (!ok) {
+        free(archive->entries);
+        archive->entries = NULL;
+        archive->entry_count = 0;
+        archive->entry_max = 0;
+    }
+
+    return ok;
+}
+
+/* the index is only an optimization; a read-only directory is not fatal */
+static void
+jpegdec_test_archive_save(struct jpegdec_test *test, const char *path, const struct stat *st)
+{
+    const struct jpegdec_test_archive *archive = &test->archive;
+
+    char tmp_path[PATH_MAX + 16];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d", path, getpid());
+    FILE *fp = fopen(tmp_path, "w");
+    if (!fp) {
+        va_log("failed to open %s; the frame index is not saved", tmp_path);
+        return;
+    }
+
+    const struct jpegdec_test_archive_header hdr = {
+        .magic = JPEGDEC_TEST_ARCHIVE_MAGIC,
+        .version = JPEGDEC_TEST_ARCHIVE_VERSION,
+        .input_size = st->st_size,
+        .input_mtime = (uint64_t)st->st_mtim.tv_sec * 1000000000ull + st->st_mtim.tv_nsec,
+        .entry_count = archive->entry_count,
+    };
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1 &&
+              fwrite(archive->entries, sizeof(*archive->entries), archive->entry_count, fp) ==
+                  (size_t)archive->entry_count;
+    if (fclose(fp) || !ok || rename(tmp_path, path)) {
+        va_log("failed to write %s; the frame index is not saved", path);
+        unlink(tmp_path);
+    }
+}
+
+/* maps the file and loads <file>.idx, or builds it when missing or stale */
+static void
+jpegdec_test_archive_open(struct jpegdec_test *test, const char *filename)
+{
+    struct jpegdec_test_archive *archive = &test->archive;
+    struct va *va = &test->va;
+
+    struct stat st;
+    if (stat(filename, &st))
+        va_die("failed to stat %s", filename);
+    archive->ptr = va_map_file(va, filename, &archive->size);
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s.idx", filename);
+    if (jpegdec_test_archive_load(test, path, &st))
+        return;
+
+    va_trace_begin(va, "index");
+    const uint64_t begin = va_now();
+    jpegdec_test_archive_build(test, filename);
+    const uint64_t elapsed = va_now() - begin;
+    va_trace_end(va, "index");
+
+    uint64_t *hashes = malloc(sizeof(*hashes) * archive->entry_count);
+    if (!hashes)
+        va_die("failed to alloc table hashes");
+    for (int i = 0; i < archive->entry_count; i++)
+        hashes[i] = archive->entries[i].table_hash;
+    qsort(hashes, archive->entry_count, sizeof(*hashes), va_compare_u64);
+    int table_sets = 1;
+    for (int i = 1; i < archive->entry_count; i++)
+        table_sets += hashes[i] != hashes[i - 1];
+    free(hashes);
+
+    va_log("%s: indexed %d frames with %d table sets in %.3f ms", filename,
+           archive->entry_count, table_sets, elapsed / 1e6);
+
+    jpegdec_test_archive_save(test, path, &st);
+}
+
+static void
+jpegdec_test_archive_close(struct jpegdec_test *test)
+{
+    struct jpegdec_test_archive *archive = &test->archive;
+
+    va_unmap_file(&test->va, archive->ptr, archive->size);
+    free(archive->entries);
+    memset(archive, 0, sizeof(*archive));
+}
+
+/* parses "<n>", "<first>-<last>" or "<first>-", separated by commas */
+static void
+jpegdec_test_parse_ranges(struct jpegdec_test *test, const char *str)
+{
+    const char *p = str;
+    while (*p) {
+        struct jpegdec_test_range range;
+        char *end;
+        range.first = strtol(p, &end, 10);
+        if (end == p || range.first < 0)
+            va_die("invalid frame range %s", str);
+        range.last = range.first;
+        if (*end == '-') {
+            p = end + 1;
+            range.last = strtol(p, &end, 10);
+            if (end == p)
+                range.last = -1;
+            else if (range.last < range.first)
+                va_die("invalid frame range %s", str);
+        }
+        if (*end && *end != ',')
+            va_die("invalid frame range %s", str);
+        p = *end ? end + 1 : end;
+
+        test->ranges = realloc(test->ranges, sizeof(*test->ranges) * (test->range_count + 1));
+        if (!test->ranges)
+            va_die("failed to grow frame ranges");
+        test->ranges[test->range_count++] = range;
+    }
+}
+
+static uint64_t
+jpegdec_test_splitmix(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+static int
+jpegdec_test_compare_int(const void *a, const void *b)
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+/* returns the frames selected by the ranges and the sample count, in file
+ * order
+ */
+static int *
+jpegdec_test_select_frames(struct jpegdec_test *test, const char *filename, int *out_count)
+{
+    const int entry_count = test->archive.entry_count;
+
+    int *frames = malloc(sizeof(*frames) * entry_count);
+    if (!frames)
+        va_die("failed to alloc frames");
+
+    int count = 0;
+    if (test->range_count) {
+        bool *selected = calloc(entry_count, sizeof(*selected));
+        if (!selected)
+            va_die("failed to alloc frames");
+        for (int i = 0; i < test->range_count; i++) {
+            const struct jpegdec_test_range *range = &test->ranges[i];
+            if (range->first >= entry_count)
+                va_die("%s: frame %d is out of %d frames", filename, range->first, entry_count);
+            const int last = range->last < 0 ? entry_count - 1
+                                             : MIN2(range->last, entry_count - 1);
+            for (int j = range->first; j <= last; j++)
+                selected[j] = true;
+        }
+        for (int i = 0; i < entry_count; i++) {
+            if (selected[i])
+                frames[count++] = i;
+        }
+        free(selected);
+    } else {
+        for (int i = 0; i < entry_count; i++)
+            frames[count++] = i;
+    }
+
+    /* a partial Fisher-Yates shuffle */
+    if (test->sample_count && test->sample_count < count) {
+        uint64_t state = test->sample_seed;
+        for (int i = 0; i < test->sample_count; i++) {
+            const int j = i + jpegdec_test_splitmix(&state) % (count - i);
+            const int tmp = frames[i];
+            frames[i] = frames[j];
+            frames[j] = tmp;
+        }
+        count = test->sample_count;
+        qsort(frames, count, sizeof(*frames), jpegdec_test_compare_int);
+    }
+
+    *out_count = count;
+    return frames;
+}
+
+/* decodes the selected frames of an archive in place */
+static void
+jpegdec_test_decode_frames(struct jpegdec_test *test, const char *filename)
+{
+    struct jpegdec_test_archive *archive = &test->archive;
+
+    jpegdec_test_archive_open(test, filename);
+
+    int count;
+    int *frames = jpegdec_test_select_frames(test, filename, &count);
+    for (int i = 0; i < count; i++) {
+        const struct jpegdec_test_archive_entry *entry = &archive->entries[frames[i]];
+
+        char name[PATH_MAX];
+        snprintf(name, sizeof(name), "%s#%d", filename, frames[i]);
+        test->file.ptr = (const uint8_t *)archive->ptr + entry->offset;
+        test->file.size = entry->size;
+        jpegdec_test_decode_file(test, name);
+    }
+    free(frames);
+
+    jpegdec_test_archive_close(test);
+}
+
+static void
+jpegdec_test_soak_sample(struct jpegdec_test *test, double elapsed, int iteration)
+{
+    struct jpegdec_test_soak *soak = &test->soak;
+
+    if (soak->sample_count == soak->sample_max) {
+        soak->sample_max = soak->sample_max ? soak->sample_max * 2 : 64;
+        soak->samples = realloc(soak->samples, sizeof(*soak->samples) * soak->sample_max);
+        if (!soak->samples)
+            va_die("failed to grow soak samples");
+    }
+    struct jpegdec_test_soak_sample *sample = &soak->samples[soak->sample_count++];
+
+    double sum = 0.0;
+    double sum_sq = 0.0;
+    for (int i = 0; i < soak->latency_count; i++) {
+        sum += soak->latencies[i];
+        sum_sq += (double)soak->latencies[i] * soak->latencies[i];
+    }
+    const double mean = soak->latency_count ? sum / soak->latency_count : 0.0;
+    const double var = soak->latency_count ? sum_sq / soak->latency_count - mean * mean : 0.0;
+
+    qsort(soak->latencies, soak->latency_count, sizeof(*soak->latencies), va_compare_u64);
+
+    *sample = (struct jpegdec_test_soak_sample){
+        .elapsed = elapsed,
+        .iteration = iteration,
+        .p50 = va_percentile(soak->latencies, soak->latency_count, 50),
+        .p99 = va_percentile(soak->latencies, soak->latency_count, 99),
+        .stddev = var > 0.0 ? sqrt(var) : 0.0,
+        .rss = va_rss_bytes(),
+        .live_objects = test->sw ? 0 : va_stats_live_objects(&test->va),
+    };
+    soak->latency_count = 0;
+
+    va_log("  %8.1f s %8d: p50 %.3f ms, p99 %.3f ms, stddev %.3f ms, rss %" PRIu64
+           " KiB, %d objects",
+           sample->elapsed, sample->iteration, sample->p50 / 1e6, sample->p99 / 1e6,
+           sample->stddev / 1e6, sample->rss / 1024, sample->live_objects);
+}
+
+/* least-squares fit of y = intercept + slope * x */
+static void
+jpegdec_test_soak_fit(const struct jpegdec_test_soak *soak,
+                      double (*get)(const struct jpegdec_test_soak_sample *),
+                      double *intercept,
+                      double *slope)
+{
+    const int n = soak->sample_count;
+    double sx = 0.0;
+    double sy = 0.0;
+    double sxx = 0.0;
+    double sxy = 0.0;
+    for (int i = 0; i < n; i++) {
+        const double x = soak->samples[i].elapsed;
+        const double y = get(&soak->samples[i]);
+        sx += x;
+        sy += y;
+        sxx += x * x;
+        sxy += x * y;
+    }
+
+    const double den = n * sxx - sx * sx;
+    *slope = n > 1 && den != 0.0 ? (n * sxy - sx * sy) / den : 0.0;
+    *intercept = n ? (sy - *slope * sx) / n : 0.0;
+}
+
+static double
+jpegdec_test_soak_get_p50(const struct jpegdec_test_soak_sample *sample)
+{
+    return sample->p50;
+}
+
+static double
+jpegdec_test_soak_get_rss(const struct jpegdec_test_soak_sample *sample)
+{
+    return sample->rss;
+}
+
+static bool
+jpegdec_test_soak_report(struct jpegdec_test *test, int iterations, double elapsed)
+{
+    const struct jpegdec_test_soak *soak = &test->soak;
+    if (!soak->sample_count)
+        return true;
+
+    const double span = soak->samples[soak->sample_count - 1].elapsed - soak->samples[0].elapsed;
+
+    double p50_base;
+    double p50_slope;
+    jpegdec_test_soak_fit(soak, jpegdec_test_soak_get_p50, &p50_base, &p50_slope);
+    const double drift = p50_base > 0.0 ? p50_slope * span / p50_base * 100.0 : 0.0;
+
+    double rss_base;
+    double rss_slope;
+    jpegdec_test_soak_fit(soak, jpegdec_test_soak_get_rss, &rss_base, &rss_slope);
+    const int64_t rss_growth = llround(rss_slope * span / 1024.0);
+
+    double stddev = 0.0;
+    uint64_t p99_max = 0;
+    int live_max = 0;
+    for (int i = 0; i < soak->sample_count; i++) {
+        const struct jpegdec_test_soak_sample *sample = &soak->samples[i];
+        stddev += sample->stddev;
+        p99_max = MAX2(p99_max, sample->p99);
+        live_max = MAX2(live_max, sample->live_objects);
+    }
+    stddev /= soak->sample_count;
+
+    va_log("soak: %d iterations in %.1f s", iterations, elapsed);
+    va_log("  latency: p50 drift %+.2f%% (%+.3f ms/h), mean stddev %.3f ms, max p99 %.3f ms",
+           drift, p50_slope * 3600.0 / 1e6, stddev / 1e6, p99_max / 1e6);
+    va_log("  rss: growth %+" PRId64 " KiB (%+.0f KiB/h)", rss_growth,
+           rss_slope * 3600.0 / 1024.0);
+    va_log("  objects: max %d live", live_max);
+
+    bool pass = true;
+    if (soak->max_latency_drift >= 0.0 && drift > soak->max_latency_drift) {
+        va_log("FAIL: p50 drift %.2f%% exceeds %.2f%%", drift, soak->max_latency_drift);
+        pass = false;
+    }
+    if (soak->max_rss_growth >= 0 && rss_growth > soak->max_rss_growth) {
+        va_log("FAIL: rss growth %" PRId64 " KiB exceeds %" PRId64 " KiB", rss_growth,
+               soak->max_rss_growth);
+        pass = false;
+    }
+    if (soak->max_live_objects >= 0 && live_max > soak->max_live_objects) {
+        va_log("FAIL: %d live objects exceed %d", live_max, soak->max_live_objects);
+        pass = false;
+    }
+
+    return pass;
+}
+
+static bool
+jpegdec_test_soak(struct jpegdec_test *test, char **filenames, int file_count)
+{
+    struct jpegdec_test_soak *soak = &test->soak;
+
+    soak->latency_max = file_count;
+    soak->latencies = malloc(sizeof(*soak->latencies) * soak->latency_max);
+    if (!soak->latencies)
+        va_die("failed to alloc soak latencies");
+
+    va_log("soak: %d files, %d iterations, %.1f s, sampling every %.1f s", file_count,
+           soak->iterations, soak->duration, soak->sample_period);
+
+    const uint64_t start = va_now();
+    uint64_t next_sample = start + (uint64_t)(soak->sample_period * 1e9);
+    int iteration = 0;
+    double elapsed = 0.0;
+    while ((!soak->iterations || iteration < soak->iterations) &&
+           (soak->duration <= 0.0 || elapsed < soak->duration)) {
+        if (soak->latency_count + file_count > soak->latency_max) {
+            soak->latency_max *= 2;
+            soak->latencies =
+                realloc(soak->latencies, sizeof(*soak->latencies) * soak->latency_max);
+            if (!soak->latencies)
+                va_die("failed to grow soak latencies");
+        }
+
+        for (int i = 0; i < file_count; i++) {
+            jpegdec_test_decode_file(test, filenames[i]);
+            soak->latencies[soak->latency_count++] = test->latency;
+        }
+        iteration++;
+
+        const uint64_t now = va_now();
+        elapsed = (now - start) / 1e9;
+        if (now >= next_sample) {
+            jpegdec_test_soak_sample(test, elapsed, iteration);
+            next_sample = now + (uint64_t)(soak->sample_period * 1e9);
+        }
+    }
+    if (soak->latency_count)
+        jpegdec_test_soak_sample(test, elapsed, iteration);
+
+    const bool pass = jpegdec_test_soak_report(test, iteration, elapsed);
+
+    free(soak->latencies);
+    free(soak->samples);
+
+    return pass;
+}
+
+static volatile sig_atomic_t jpegdec_test_stopping;
+
+static void
+jpegdec_test_stop(int sig)
+{
+    jpegdec_test_stopping = 1;
+}
+
+static ssize_t
+jpegdec_test_send_fd(int sock, const void *msg, size_t size, int fd)
+{
+    struct iovec iov = { .iov_base = (void *)msg, .iov_len = size };
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } ctrl;
+    struct msghdr hdr = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+    };
+
+    if (fd >= 0) {
+        hdr.msg_control = ctrl.buf;
+        hdr.msg_controllen = sizeof(ctrl.buf);
+
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(fd));
+    }
+
+    return sendmsg(sock, &hdr, MSG_NOSIGNAL);
+}
+
+static ssize_t
+jpegdec_test_recv_fd(int sock, void *msg, size_t size, int *fd)
+{
+    struct iovec iov = { .iov_base = msg, .iov_len = size };
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } ctrl;
+    struct msghdr hdr = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = ctrl.buf,
+        .msg_controllen = sizeof(ctrl.buf),
+    };
+
+    *fd = -1;
+    const ssize_t ret = recvmsg(sock, &hdr, MSG_CMSG_CLOEXEC);
+    if (ret <= 0)
+        return ret;
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr); cmsg; cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+            memcpy(fd, CMSG_DATA(cmsg), sizeof(*fd));
+    }
+
+    return ret;
+}
+
+static void
+jpegdec_test_report_latency(const char *name, uint64_t *latencies, int count)
+{
+    qsort(latencies, count, sizeof(*latencies), va_compare_u64);
+    va_log("%s: %d requests, p50 %.3f ms, p99 %.3f ms, max %.3f ms", name, count,
+           va_percentile(latencies, count, 50) / 1e6, va_percentile(latencies, count, 99) / 1e6,
+           count ? latencies[count - 1] / 1e6 : 0.0);
+}
+
+/* the output memfd grows as needed and is shared by all responses of a connection */
+struct jpegdec_test_shm {
+    int fd;
+    void *ptr;
+    size_t size;
+};
+
+/* takes over the mapping of jpeg; a bad request fails with an errno and
+ * leaves the daemon serving
+ */
+static int
+jpegdec_test_serve_request(struct jpegdec_test *test,
+                           const void *jpeg,
+                           size_t jpeg_size,
+                           struct jpegdec_test_shm *shm,
+                           struct jpegdec_test_response *resp)
+{
+    test->file.ptr = jpeg;
+    test->file.size = jpeg_size;
+    const enum jpegparse_result result = jpegva_parse_file(&test->parser, &test->file);
+    if (result != JPEGPARSE_OK) {
+        va_log("failed to parse request at offset %" PRIu64 ": %s", test->parser.offset,
+               jpegparse_result_str(result));
+        jpegdec_test_unmap_file(test);
+        return EBADMSG;
+    }
+    jpegva_init_picture(&test->picture, &test->file);
+    if (!jpegdec_test_set_roi(test, NULL)) {
+        jpegdec_test_unmap_file(test);
+        return EINVAL;
+    }
+
+    if (!jpegdec_test_run(test, &resp->decode_time)) {
+        va_log("failed to decode request");
+        jpegdec_test_release(test);
+        return EIO;
+    }
+
+    struct jpegdec_test_nv12 out;
+    jpegdec_test_map_output(test, &out);
+
+    resp->width = out.width;
+    resp->height = out.height;
+    resp->pitches[0] = (out.width + 1) & ~1;
+    resp->pitches[1] = resp->pitches[0];
+    resp->offsets[0] = 0;
+    resp->offsets[1] = resp->pitches[0] * out.height;
+    resp->size = resp->offsets[1] + resp->pitches[1] * ((out.height + 1) / 2);
+
+    int ret = 0;
+    if (resp->size > shm->size) {
+        if (shm->ptr)
+            munmap(shm->ptr, shm->size);
+        shm->ptr = NULL;
+        shm->size = 0;
+
+        if (ftruncate(shm->fd, resp->size)) {
+            ret = errno;
+        } else {
+            shm->ptr = mmap(NULL, resp->size, PROT_READ | PROT_WRITE, MAP_SHARED, shm->fd, 0);
+            if (shm->ptr == MAP_FAILED) {
+                ret = errno;
+                shm->ptr = NULL;
+            } else {
+                shm->size = resp->size;
+            }
+        }
+    }
+
+    if (!ret) {
+        for (uint32_t y = 0; y < out.height; y++) {
+            memcpy(shm->ptr + resp->offsets[0] + resp->pitches[0] * y,
+                   out.data + out.offsets[0] + out.pitches[0] * y, out.width);
+        }
+        for (uint32_t y = 0; y < (out.height + 1) / 2; y++) {
+            memcpy(shm->ptr + resp->offsets[1] + resp->pitches[1] * y,
+                   out.data + out.offsets[1] + out.pitches[1] * y, resp->pitches[1]);
+        }
+    }
+
+    jpegdec_test_unmap_output(test);
+    jpegdec_test_release(test);
+
+    return ret;
+}
+
+static void
+jpegdec_test_serve(struct jpegdec_test *test, int conn)
+{
+    struct va *va = &test->va;
+    struct jpegdec_test_shm shm = { .fd = memfd_create("jpegdec-nv12", MFD_CLOEXEC) };
+    if (shm.fd < 0)
+        va_die("failed to create memfd");
+
+    while (!jpegdec_test_stopping) {
+        struct jpegdec_test_request req;
+        int fd;
+        const ssize_t ret = jpegdec_test_recv_fd(conn, &req, sizeof(req), &fd);
+        if (ret <= 0)
+            break;
+
+        va_trace_begin(va, "request");
+
+        /* the input is mapped in place and must not extend past the end of
+         * the file, which would fault
+         */
+        struct jpegdec_test_response resp = { 0 };
+        struct stat st;
+        if (ret != sizeof(req) || fd < 0) {
+            resp.status = EPROTO;
+        } else if (fstat(fd, &st)) {
+            resp.status = errno;
+        } else if (req.size > (uint64_t)st.st_size) {
+            va_log("request of %" PRIu64 " bytes exceeds its %lld-byte file", req.size,
+                   (long long)st.st_size);
+            resp.status = EINVAL;
+        } else {
+            const void *ptr = mmap(NULL, req.size, PROT_READ, MAP_SHARED, fd, 0);
+            if (ptr == MAP_FAILED)
+                resp.status = errno;
+            else
+                resp.status = jpegdec_test_serve_request(test, ptr, req.size, &shm, &resp);
+        }
+        if (fd >= 0)
+            close(fd);
+
+        jpegdec_test_send_fd(conn, &resp, sizeof(resp), resp.status ? -1 : shm.fd);
+
+        va_trace_end(va, "request");
+    }
+
+    if (shm.ptr)
+        munmap(shm.ptr, shm.size);
+    close(shm.fd);
+}
+
+static int
+jpegdec_test_socket(const char *path, struct sockaddr_un *addr)
+{
+    const int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock < 0)
+        va_die("failed to create socket");
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path))
+        va_die("socket path %s is too long", path);
+    strcpy(addr->sun_path, path);
+
+    return sock;
+}
+
+static void
+jpegdec_test_listen(struct jpegdec_test *test)
+{
+    struct sockaddr_un addr;
+    const int sock = jpegdec_test_socket(test->listen_path, &addr);
+
+    unlink(test->listen_path);
+    if (bind(sock, (const struct sockaddr *)&addr, sizeof(addr)) || listen(sock, 8))
+        va_die("failed to listen on %s", test->listen_path);
+
+    /* no SA_RESTART so that accept and recvmsg return on signals */
+    const struct sigaction sa = { .sa_handler = jpegdec_test_stop };
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    va_log("listening on %s", test->listen_path);
+    while (!jpegdec_test_stopping) {
+        const int conn = accept4(sock, NULL, NULL, SOCK_CLOEXEC);
+        if (conn < 0) {
+            if (errno == EINTR)
+                continue;
+            va_die("failed to accept");
+        }
+
+        jpegdec_test_serve(test, conn);
+        close(conn);
+    }
+
+    close(sock);
+    unlink(test->listen_path);
+}
+
+static void
+jpegdec_test_add_oneshot_arg(struct jpegdec_test *test, const char *arg)
+{
+    /* leave room for argv0, --no-save, the file and NULL */
+    if (test->oneshot_arg_count + 4 > (int)ARRAY_SIZE(test->oneshot_args))
+        va_die("too many decode options");
+    test->oneshot_args[test->oneshot_arg_count++] = arg;
+}
+
+static uint64_t
+jpegdec_test_oneshot(struct jpegdec_test *test, const char *filename)
+{
+    const uint64_t begin = va_now();
+
+    const pid_t pid = fork();
+    if (pid < 0)
+        va_die("failed to fork");
+
+    if (!pid) {
+        const int null = open("/dev/null", O_WRONLY);
+        if (null >= 0)
+            dup2(null, STDOUT_FILENO);
+
+        const char *args[ARRAY_SIZE(test->oneshot_args)];
+        int count = 0;
+        args[count++] = test->argv0;
+        args[count++] = "--no-save";
+        for (int i = 0; i < test->oneshot_arg_count; i++)
+            args[count++] = test->oneshot_args[i];
+        args[count++] = filename;
+        args[count++] = NULL;
+        /* argv0 may be a bare name that was resolved through PATH */
+        execv("/proc/self/exe", (char *const *)args);
+        _exit(127);
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status))
+        va_die("one-shot decode of %s failed", filename);
+
+    return va_now() - begin;
+}
+
+static void
+jpegdec_test_connect(struct jpegdec_test *test, char **filenames, int file_count)
+{
+    struct sockaddr_un addr;
+    const int sock = jpegdec_test_socket(test->connect_path, &addr);
+    if (connect(sock, (const struct sockaddr *)&addr, sizeof(addr)))
+        va_die("failed to connect to %s", test->connect_path);
+
+    const int count = file_count * test->repeat;
+    if (!count)
+        va_die("no requests to send");
+    uint64_t *latencies = malloc(sizeof(*latencies) * count * 2);
+    if (!latencies)
+        va_die("failed to alloc latencies");
+    uint64_t *decode_times = latencies + count;
+
+    for (int i = 0; i < count; i++) {
+        const char *filename = filenames[i % file_count];
+        const int fd = open(filename, O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            va_die("failed to open %s", filename);
+        const struct jpegdec_test_request req = { .size = lseek(fd, 0, SEEK_END) };
+
+        const uint64_t begin = va_now();
+        if (jpegdec_test_send_fd(sock, &req, sizeof(req), fd) != sizeof(req))
+            va_die("failed to send request");
+        close(fd);
+
+        struct jpegdec_test_response resp;
+        int shm_fd;
+        if (jpegdec_test_recv_fd(sock, &resp, sizeof(resp), &shm_fd) != sizeof(resp))
+            va_die("failed to receive response");
+        if (resp.status || shm_fd < 0)
+            va_die("failed to decode %s: %s", filename, strerror(resp.status));
+
+        const void *ptr = mmap(NULL, resp.size, PROT_READ, MAP_SHARED, shm_fd, 0);
+        if (ptr == MAP_FAILED)
+            va_die("failed to map response");
+        latencies[i] = va_now() - begin;
+        decode_times[i] = resp.decode_time;
+
+        if (!test->no_save)
+            va_save_nv12(ptr, resp.width, resp.height, resp.pitches, resp.offsets,
+                         "decoded.ppm");
+
+        munmap((void *)ptr, resp.size);
+        close(shm_fd);
+    }
+    close(sock);
+
+    jpegdec_test_report_latency("daemon decode", decode_times, count);
+    jpegdec_test_report_latency("daemon request", latencies, count);
+
+    if (test->oneshot) {
+        for (int i = 0; i < count; i++)
+            latencies[i] = jpegdec_test_oneshot(test, filenames[i % file_count]);
+        jpegdec_test_report_latency("one-shot request", latencies, count);
+    }
+
+    free(latencies);
+}
+
+struct jpegdec_test_bench {
+    uint64_t scan_size;
+    int frame_count;
+};
+
+static void
+jpegdec_test_parse_contention(struct jpegdec_test *test, const char *str)
+{
+    const char *p = str;
+    while (*p) {
+        char *end;
+        const long n = strtol(p, &end, 10);
+        if (end == p || n <= 0 || n > 1024 || (*end && *end != ','))
+            va_die("invalid process counts %s", str);
+        p = *end ? end + 1 : end;
+
+        test->contention =
+            realloc(test->contention, sizeof(*test->contention) * (test->contention_count + 1));
+        if (!test->contention)
+            va_die("failed to grow process counts");
+        test->contention[test->contention_count++] = n;
+    }
+}
+
+/* what a contention worker sends back; smaller than PIPE_BUF so that the
+ * writes of concurrent workers never interleave
+ */
+struct jpegdec_test_worker_result {
+    int32_t worker;
+    int32_t count;
+    uint64_t elapsed;
+    uint64_t p50;
+    uint64_t p90;
+    uint64_t p99;
+    uint64_t max;
+};
+
+static void NORETURN
+jpegdec_test_contention_worker(struct jpegdec_test *test,
+                               int worker,
+                               char **filenames,
+                               int file_count,
+                               int ready_fd,
+                               int go_fd,
+                               int result_fd)
+{
+    if (!test->sw)
+        va_init(&test->va, &test->params);
+
+    /* the first decodes pay for lazy driver setup */
+    for (int i = 0; i < file_count; i++)
+        jpegdec_test_decode_file(test, filenames[i]);
+
+    /* wait until every worker is ready; the parent closes go_fd to start */
+    char byte = 0;
+    if (write(ready_fd, &byte, 1) != 1)
+        va_die("worker %d failed to synchronize", worker);
+    close(ready_fd);
+    if (read(go_fd, &byte, 1) != 0)
+        va_die("worker %d failed to synchronize", worker);
+
+    const int count = file_count * test->repeat;
+    uint64_t *latencies = malloc(sizeof(*latencies) * count);
+    if (!latencies)
+        va_die("failed to alloc latencies");
+
+    const uint64_t begin = va_now();
+    for (int r = 0; r < test->repeat; r++) {
+        for (int i = 0; i < file_count; i++) {
+            jpegdec_test_decode_file(test, filenames[i]);
+            latencies[r * file_count + i] = test->latency;
+        }
+    }
+    const uint64_t elapsed = va_now() - begin;
+
+    qsort(latencies, count, sizeof(*latencies), va_compare_u64);
+    const struct jpegdec_test_worker_result result = {
+        .worker = worker,
+        .count = count,
+        .elapsed = elapsed,
+        .p50 = va_percentile(latencies, count, 50),
+        .p90 = va_percentile(latencies, count, 90),
+        .p99 = va_percentile(latencies, count, 99),
+        .max = latencies[count - 1],
+    };
+    if (write(result_fd, &result, sizeof(result)) != sizeof(result))
+        va_die("worker %d failed to send its result", worker);
+    free(latencies);
+
+    if (!test->sw)
+        va_cleanup(&test->va);
+    fflush(stdout);
+    _exit(0);
+}
+
+/* kills and reaps every worker that is still running */
+static void
+jpegdec_test_contention_kill(pid_t *pids, int worker_count)
+{
+    for (int i = 0; i < worker_count; i++) {
+        if (pids[i] > 0) {
+            kill(pids[i], SIGKILL);
+            waitpid(pids[i], NULL, 0);
+        }
+    }
+}
+
+/* waits for the ready byte of every worker; a worker that exits first aborts
+ * the run instead of leaving the parent blocked on the others
+ */
+static void
+jpegdec_test_contention_wait_ready(int ready_fd, pid_t *pids, int worker_count)
+{
+    int ready_count = 0;
+    while (ready_count < worker_count) {
+        struct pollfd pfd = {
+            .fd = ready_fd,
+            .events = POLLIN,
+        };
+        const int ret = poll(&pfd, 1, 100);
+        if (ret < 0 && errno != EINTR)
+            va_die("failed to poll workers");
+
+        bool eof = false;
+        if (ret > 0) {
+            char bytes[64];
+            const ssize_t len = read(ready_fd, bytes, sizeof(bytes));
+            if (len < 0 && errno != EINTR)
+                va_die("failed to read from workers");
+            if (len > 0)
+                ready_count += len;
+            else if (!len)
+                eof = true;
+        }
+        if (ready_count >= worker_count)
+            break;
+
+        /* every worker that is still alive has written its byte by eof, so
+         * the one that exited can be waited for
+         */
+        int status;
+        const pid_t pid = waitpid(-1, &status, eof ? 0 : WNOHANG);
+        if (pid <= 0 && !eof)
+            continue;
+
+        int worker = -1;
+        for (int i = 0; i < worker_count; i++) {
+            if (pids[i] == pid) {
+                pids[i] = -1;
+                worker = i;
+            }
+        }
+        jpegdec_test_contention_kill(pids, worker_count);
+
+        /* the workers found no device to contend for */
+        if (worker >= 0 && WIFEXITED(status) && WEXITSTATUS(status) == VA_EXIT_SKIP)
+            exit(VA_EXIT_SKIP);
+        va_die("worker %d exited before starting", worker);
+    }
+}
+
+/* runs worker_count workers together and returns their aggregate frames/s */
+static double
+jpegdec_test_contention_run(struct jpegdec_test *test,
+                            int worker_count,
+                            char **filenames,
+                            int file_count)
+{
+    int ready[2];
+    int go[2];
+    int results[2];
+    if (pipe(ready) || pipe(go) || pipe(results))
+        va_die("failed to create pipes");
+
+    /* the children must not flush what the parent has buffered */
+    fflush(stdout);
+
+    pid_t *pids = malloc(sizeof(*pids) * worker_count);
+    if (!pids)
+        va_die("failed to alloc pids");
+    for (int i = 0; i < worker_count; i++) {
+        pids[i] = fork();
+        if (pids[i] < 0)
+            va_die("failed to fork");
+        if (!pids[i]) {
+            close(ready[0]);
+            close(go[1]);
+            close(results[0]);
+            jpegdec_test_contention_worker(test, i, filenames, file_count, ready[1], go[0],
+                                           results[1]);
+        }
+    }
+    close(ready[1]);
+    close(go[0]);
+    close(results[1]);
+
+    jpegdec_test_contention_wait_ready(ready[0], pids, worker_count);
+    const uint64_t begin = va_now();
+    close(go[1]);
+
+    struct jpegdec_test_worker_result *rs = calloc(worker_count, sizeof(*rs));
+    if (!rs)
+        va_die("failed to alloc results");
+    int total = 0;
+    for (int i = 0; i < worker_count; i++) {
+        struct jpegdec_test_worker_result r;
+        if (read(results[0], &r, sizeof(r)) != sizeof(r) || r.worker < 0 ||
+            r.worker >= worker_count)
+            va_die("a worker exited without a result");
+        rs[r.worker] = r;
+        total += r.count;
+    }
+    const uint64_t elapsed = va_now() - begin;
+    close(ready[0]);
+    close(results[0]);
+
+    for (int i = 0; i < worker_count; i++) {
+        int status;
+        if (waitpid(pids[i], &status, 0) != pids[i] || !WIFEXITED(status) ||
+            WEXITSTATUS(status))
+            va_die("worker %d failed", i);
+    }
+    free(pids);
+
+    const double fps = total / (elapsed / 1e9);
+    va_log("%d processes: %d frames in %.3f s, %.1f frames/s", worker_count, total,
+           elapsed / 1e9, fps);
+    for (int i = 0; i < worker_count; i++) {
+        const struct jpegdec_test_worker_result *r = &rs[i];
+        va_log("  worker %d: %.1f frames/s, p50 %.3f ms, p90 %.3f ms, p99 %.3f ms, max %.3f ms",
+               i, r->count / (r->elapsed / 1e9), r->p50 / 1e6, r->p90 / 1e6, r->p99 / 1e6,
+               r->max / 1e6);
+    }
+    free(rs);
+
+    return fps;
+}
+
+/* runs each contention level and reports the scaling against the first */
+static void
+jpegdec_test_contention(struct jpegdec_test *test, char **filenames, int file_count)
+{
+    if (!file_count)
+        va_die("no input files to decode");
+
+    double *fps = malloc(sizeof(*fps) * test->contention_count);
+    if (!fps)
+        va_die("failed to alloc throughputs");
+    for (int i = 0; i < test->contention_count; i++)
+        fps[i] = jpegdec_test_contention_run(test, test->contention[i], filenames, file_count);
+
+    /* linear scaling keeps the per-process throughput of the first level */
+    const double base = fps[0] / test->contention[0];
+    va_log("scaling:");
+    for (int i = 0; i < test->contention_count; i++) {
+        const int n = test->contention[i];
+        va_log("  %3d processes: %8.1f frames/s, %5.2fx, %3.0f%% efficiency", n, fps[i],
+               fps[i] / base, 100.0 * fps[i] / base / n);
+    }
+    free(fps);
+}
+
+static void
+jpegdec_test_bench_frame(void *data, const struct jpegparse_frame *frame)
+{
+    struct jpegdec_test_bench *bench = data;
+    bench->frame_count++;
+}
+
+static void
+jpegdec_test_bench_scan(void *data, const uint8_t *chunk, size_t size)
+{
+    struct jpegdec_test_bench *bench = data;
+    bench->scan_size += size;
+}
+
+/* parses the files in chunks of chunk_size bytes, or whole when 0, and returns MB/s */
+static double
+jpegdec_test_bench_parse_chunked(struct jpegdec_test *test,
+                                 const struct jpegva_file *files,
+                                 int file_count,
+                                 size_t chunk_size)
+{
+    static const struct jpegparse_callbacks callbacks = {
+        .frame = jpegdec_test_bench_frame,
+        .scan = jpegdec_test_bench_scan,
+    };
+    struct jpegparse *parser = &test->parser;
+    struct jpegdec_test_bench bench = { 0 };
+    uint64_t bytes = 0;
+
+    const uint64_t begin = va_now();
+    uint64_t elapsed;
+    do {
+        for (int i = 0; i < file_count; i++) {
+            const uint8_t *ptr = files[i].ptr;
+            const size_t size = files[i].size;
+            const size_t step = chunk_size ? chunk_size : size;
+
+            jpegparse_init(parser, &callbacks, &bench);
+            enum jpegparse_result result = JPEGPARSE_OK;
+            for (size_t offset = 0; offset < size && result == JPEGPARSE_OK; offset += step)
+                result = jpegparse_feed(parser, ptr + offset, MIN2(step, size - offset));
+            if (result == JPEGPARSE_OK)
+                result = jpegparse_finish(parser);
+            if (result != JPEGPARSE_OK)
+                va_die("failed to parse file %d: %s", i, jpegparse_result_str(result));
+
+            bytes += size;
+        }
+        elapsed = va_now() - begin;
+    } while (elapsed < 250000000ull);
+
+    return (double)bytes / elapsed * 1e3;
+}
+
+static void
+jpegdec_test_bench_parse(struct jpegdec_test *test, char **filenames, int file_count)
+{
+    struct va *va = &test->va;
+
+    if (!file_count)
+        va_die("no input files to parse");
+    struct jpegva_file *files = calloc(file_count, sizeof(*files));
+    if (!files)
+        va_die("failed to alloc files");
+    for (int i = 0; i < file_count; i++)
+        files[i].ptr = va_map_file(va, filenames[i], &files[i].size);
+
+    /* fault the mappings in before timing */
+    jpegdec_test_bench_parse_chunked(test, files, file_count, 0);
+
+    const double whole = jpegdec_test_bench_parse_chunked(test, files, file_count, 0);
+    va_log("whole file: %.1f MB/s", whole);
+
+    const char *chunks = test->bench_parse;
+    while (*chunks) {
+        char *end;
+        const unsigned long chunk_size = strtoul(chunks, &end, 0);
+        if (end == chunks || !chunk_size || (*end && *end != ','))
+            va_die("invalid chunk sizes %s", test->bench_parse);
+        chunks = *end ? end + 1 : end;
+
+        const double chunked =
+            jpegdec_test_bench_parse_chunked(test, files, file_count, chunk_size);
+        va_log("%lu-byte chunks: %.1f MB/s, %.2fx of whole file", chunk_size, chunked,
+               chunked / whole);
+    }
+
+    for (int i = 0; i < file_count; i++)
+        va_unmap_file(va, files[i].ptr, files[i].size);
+    free(files);
+}
+
+static void
+jpegdec_test_cleanup(struct jpegdec_test *test)
+{
+    struct va *va = &test->va;
+
+    if (!test->sw && !test->connect_path && !test->bench_parse && !test->contention_count) {
+        jpegdec_test_release_warm(test);
+        va_cleanup(va);
+    }
+    va_arena_cleanup(&test->arena);
+
+    for (int i = 0; i < test->crop_count; i++)
+        free(test->crops[i].filename);
+    free(test->crops);
+    free(test->cache.entries);
+    free(test->ranges);
+    free(test->contention);
+}
+
+int
+main(int argc, char **argv)
+{
+    struct jpegdec_test test = {
+        .profile = VAProfileJPEGBaseline,
+        .entrypoint = VAEntrypointVLD,
+        .worst_count = 5,
+        .repeat = 1,
+        .argv0 = argv[0],
+        .cache = {
+            .max_size = 1024ull * 1024 * 1024,
+        },
+        .soak = {
+            .sample_period = 10.0,
+            .max_latency_drift = -1.0,
+            .max_rss_growth = -1,
+            .max_live_objects = -1,
+        },
+    };
+
+    static const struct option options[] = {
+        { "stats", no_argument, NULL, 's' },
+        { "trace", required_argument, NULL, 't' },
+        { "sync", required_argument, NULL, 'S' },
+        { "sw", no_argument, NULL, 'c' },
+        { "verify", no_argument, NULL, 'v' },
+        { "threads", required_argument, NULL, 'j' },
+        { "ref-dir", required_argument, NULL, 'r' },
+        { "worst", required_argument, NULL, 'w' },
+        { "userptr", no_argument, NULL, 'u' },
+        { "max-size", required_argument, NULL, 'm' },
+        { "iterations", required_argument, NULL, 'n' },
+        { "duration", required_argument, NULL, 'd' },
+        { "sample-period", required_argument, NULL, 'p' },
+        { "max-latency-drift", required_argument, NULL, 'L' },
+        { "max-rss-growth", required_argument, NULL, 'R' },
+        { "max-live-objects", required_argument, NULL, 'O' },
+        { "no-save", no_argument, NULL, 'q' },
+        { "listen", required_argument, NULL, 'l' },
+        { "connect", required_argument, NULL, 'x' },
+        { "oneshot", no_argument, NULL, 'o' },
+        { "repeat", required_argument, NULL, 'e' },
+        { "bench-parse", required_argument, NULL, 'b' },
+        { "crop", required_argument, NULL, 'C' },
+        { "crop-manifest", required_argument, NULL, 'M' },
+        { "cache", required_argument, NULL, 'K' },
+        { "cache-size", required_argument, NULL, 'Z' },
+        { "frames", required_argument, NULL, 'F' },
+        { "sample", required_argument, NULL, 'N' },
+        { "processes", required_argument, NULL, 'P' },
+        { "skip-without-device", no_argument, NULL, 'D' },
+        { 0 },
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "st:S:cvj:r:w:um:n:d:p:L:R:O:ql:x:oe:b:C:M:K:Z:F:N:P:D",
+                              options, NULL)) != -1) {
+        switch (opt) {
+        case 's':
+            test.params.stats = true;
+            break;
+        case 't':
+            test.params.trace_file = optarg;
+            break;
+        case 'S':
+            if (!va_parse_sync_mode(&test.params, optarg))
+                va_die("invalid sync mode %s", optarg);
+            jpegdec_test_add_oneshot_arg(&test, "--sync");
+            jpegdec_test_add_oneshot_arg(&test, optarg);
+            break;
+        case 'c':
+            test.sw = true;
+            jpegdec_test_add_oneshot_arg(&test, "--sw");
+            break;
+        case 'v':
+            test.verify = true;
+            break;
+        case 'j':
+            test.sw_threads = atoi(optarg);
+            jpegdec_test_add_oneshot_arg(&test, "--threads");
+            jpegdec_test_add_oneshot_arg(&test, optarg);
+            break;
+        case 'r':
+            test.ref_dir = optarg;
+            break;
+        case 'w':
+            test.worst_count = atoi(optarg);
+            break;
+        case 'u':
+            test.userptr = true;
+            jpegdec_test_add_oneshot_arg(&test, "--userptr");
+            break;
+        case 'm':
+            if (sscanf(optarg, "%dx%d", &test.max_width, &test.max_height) != 2)
+                va_die("invalid max size %s", optarg);
+            jpegdec_test_add_oneshot_arg(&test, "--max-size");
+            jpegdec_test_add_oneshot_arg(&test, optarg);
+            break;
+        case 'n':
+            test.soak.iterations = atoi(optarg);
+            break;
+        case 'd':
+            test.soak.duration = atof(optarg);
+            break;
+        case 'p':
+            test.soak.sample_period = atof(optarg);
+            break;
+        case 'L':
+            test.soak.max_latency_drift = atof(optarg);
+            break;
+        case 'R':
+            test.soak.max_rss_growth = atoll(optarg);
+            break;
+        case 'O':
+            test.soak.max_live_objects = atoi(optarg);
+            break;
+        case 'q':
+            test.no_save = true;
+            break;
+        case 'l':
+            test.listen_path = optarg;
+            break;
+        case 'x':
+            test.connect_path = optarg;
+            break;
+        case 'o':
+            test.oneshot = true;
+            break;
+        case 'e':
+            test.repeat = atoi(optarg);
+            break;
+        case 'b':
+            test.bench_parse = optarg;
+            break;
+        case 'C':
+            if (sscanf(optarg, "%d,%d,%d,%d", &test.crop.x, &test.crop.y, &test.crop.width,
+                       &test.crop.height) != 4 ||
+                test.crop.x < 0 || test.crop.y < 0 || test.crop.width <= 0 ||
+                test.crop.height <= 0)
+                va_die("invalid crop %s", optarg);
+            jpegdec_test_add_oneshot_arg(&test, "--crop");
+            jpegdec_test_add_oneshot_arg(&test, optarg);
+            break;
+        case 'M':
+            jpegdec_test_load_crops(&test, optarg);
+            jpegdec_test_add_oneshot_arg(&test, "--crop-manifest");
+            jpegdec_test_add_oneshot_arg(&test, optarg);
+            break;
+        case 'K':
+            test.cache.dir = optarg;
+            break;
+        case 'Z':
+            test.cache.max_size = strtoull(optarg, NULL, 0) * 1024 * 1024;
+            break;
+        case 'F':
+            jpegdec_test_parse_ranges(&test, optarg);
+            break;
+        case 'P':
+            jpegdec_test_parse_contention(&test, optarg);
+            break;
+        case 'D':
+            test.params.skip_without_device = true;
+            break;
+        case 'N':
+            if (sscanf(optarg, "%d:%" SCNu64, &test.sample_count, &test.sample_seed) < 1 ||
+                test.sample_count <= 0)
+                va_die("invalid sample %s", optarg);
+            break;
+        default:
+            va_die("usage: %s [--stats] [--trace <file>] "
+                   "[--sync blocking|timed[:<ms>[:<deadline ms>]]|poll[:<deadline ms>]] "
+                   "[--sw | --verify] [--threads <n>] "
+                   "[--ref-dir <dir>] [--worst <n>] [--userptr] [--max-size <w>x<h>] "
+                   "[--iterations <n>] [--duration <s>] [--sample-period <s>] "
+                   "[--max-latency-drift <pct>] [--max-rss-growth <KiB>] "
+                   "[--max-live-objects <n>] [--no-save] [--listen <socket>] "
+                   "[--connect <socket> [--oneshot] [--repeat <n>]] "
+                   "[--bench-parse <bytes>[,<bytes>...]] [--crop <x>,<y>,<w>,<h>] "
+                   "[--crop-manifest <file>] [--cache <dir> [--cache-size <MiB>]] "
+                   "[--frames <n>|<first>-[<last>][,...]] [--sample <n>[:<seed>]] "
+                   "[--processes <n>[,<n>...] [--repeat <n>]] [--skip-without-device] "
+                   "<file>...",
+                   argv[0]);
+        }
+    }
+    if (test.sw && test.verify)
+        va_die("--sw and --verify are mutually exclusive");
+    /* --sw never initializes va, which collects both */
+    if (test.sw && (test.params.stats || test.params.trace_file))
+        va_die("--sw cannot be combined with --stats or --trace");
+
+    if ((test.listen_path || test.connect_path) &&
+        (test.verify || test.ref_dir || test.soak.iterations || test.soak.duration > 0.0))
+        va_die("--listen and --connect cannot be combined with --verify, --ref-dir or soaking");
+    if (test.listen_path && test.connect_path)
+        va_die("--listen and --connect are mutually exclusive");
+    if (test.listen_path) {
+        test.warm.enabled = true;
+        test.no_save = true;
+    }
+
+    if (test.cache.dir && (test.sw || test.verify || test.listen_path || test.connect_path ||
+                           test.bench_parse))
+        va_die("--cache cannot be combined with --sw, --verify, --listen, --connect or "
+               "--bench-parse");
+
+    if (test.contention_count &&
+        (test.verify || test.ref_dir || test.listen_path || test.connect_path ||
+         test.bench_parse || test.soak.iterations || test.soak.duration > 0.0 ||
+         test.range_count || test.sample_count || test.params.trace_file || test.params.stats ||
+         test.cache.dir))
+        va_die("--processes cannot be combined with --verify, --ref-dir, --listen, --connect, "
+               "--bench-parse, --frames, --sample, --trace, --stats, --cache or soaking");
+    if (test.contention_count)
+        test.no_save = true;
+
+    const bool select_frames = test.range_count || test.sample_count;
+    if (select_frames && (test.ref_dir || test.listen_path || test.connect_path ||
+                          test.bench_parse || test.soak.iterations || test.soak.duration > 0.0))
+        va_die("--frames and --sample cannot be combined with --ref-dir, --listen, --connect, "
+               "--bench-parse or soaking");
+
+    test.soak.enabled = test.soak.iterations > 0 || test.soak.duration > 0.0;
+    if (test.soak.enabled) {
+        if (test.verify || test.ref_dir || test.cache.dir)
+            va_die("--iterations and --duration cannot be combined with --verify, --ref-dir or "
+                   "--cache");
+        if (optind == argc)
+            va_die("no input files to soak");
+        /* count objects for the leak check without timing every call */
+        test.params.track_objects = true;
+        test.no_save = true;
+    }
 
     jpegdec_test_init(&test);
+    if (test.cache.dir)
+        jpegdec_test_cache_init(&test);
+
+    bool pass = true;
+    if (test.bench_parse) {
+        jpegdec_test_bench_parse(&test, argv + optind, argc - optind);
+    } else if (test.listen_path) {
+        jpegdec_test_listen(&test);
+    } else if (test.connect_path) {
+        jpegdec_test_connect(&test, argv + optind, argc - optind);
+    } else if (test.soak.enabled) {
+        pass = jpegdec_test_soak(&test, argv + optind, argc - optind);
+    } else if (test.contention_count) {
+        jpegdec_test_contention(&test, argv + optind, argc - optind);
+    } else if (select_frames) {
+        for (int i = optind; i < argc; i++)
+            jpegdec_test_decode_frames(&test, argv[i]);
+    } else {
+        for (int i = optind; i < argc; i++)
+            jpegdec_test_decode_file(&test, argv[i]);
+    }
 
-    for (int i = 1; i < argc; i++)
-        jpegdec_test_decode_file(&test, argv[i]);
+    jpegdec_test_report_quality(&test);
+    jpegdec_test_report_cache(&test);
 
     jpegdec_test_cleanup(&test);
 
-    return 0;
+    return pass ? 0 : 1;
 }
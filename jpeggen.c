@@ -0,0 +1,595 @@
+/*
+ * Copyright 2022 Google LLC
+ * SPDX-License-Identifier: MIT
+ */
+
+/*
+ * Writes a synthetic baseline JPEG.  The image mixes gradients, a zone plate,
+ * hard edges and noise so that every frequency band carries data, and it only
+ * depends on the options so that corpora are identical on every machine.
+ */
+
+#include "jpegva.h"
+#include "swjpeg.h"
+#include "vautil.h"
+
+#include <getopt.h>
+
+enum jpeggen_layout {
+    /* one DQT and one DHT segment for all tables */
+    JPEGGEN_LAYOUT_COMBINED,
+    /* one segment per table */
+    JPEGGEN_LAYOUT_SPLIT,
+    /* chroma uses the luma tables */
+    JPEGGEN_LAYOUT_SHARED,
+};
+
+struct jpeggen_huffman {
+    const uint8_t *bits;
+    const uint8_t *values;
+    int value_count;
+
+    /* indexed by symbol */
+    uint16_t codes[256];
+    uint8_t sizes[256];
+};
+
+struct jpeggen_component {
+    int id;
+    int h;
+    int v;
+    /* quantization and huffman table selectors */
+    int tq;
+    int th;
+
+    /* padded to whole MCUs */
+    int width;
+    int height;
+    uint8_t *plane;
+
+    int dc_pred;
+};
+
+struct jpeggen {
+    int width;
+    int height;
+    int quality;
+    int subsampling;
+    /* in MCUs, or a negative number of MCU rows */
+    int restart;
+    enum jpeggen_layout layout;
+    uint32_t seed;
+
+    int component_count;
+    struct jpeggen_component components[3];
+    int mcu_cols;
+    int mcu_rows;
+    int restart_interval;
+
+    /* in zigzag order, luma and chroma */
+    uint8_t quant[2][64];
+    /* indexed by class and destination */
+    struct jpeggen_huffman huffman[2][2];
+    float dct[8][8];
+
+    uint8_t *data;
+    size_t size;
+    size_t capacity;
+
+    uint32_t bits;
+    int bit_count;
+};
+
+static void
+jpeggen_init_huffman(struct jpeggen_huffman *huff,
+                     const uint8_t *bits,
+                     const uint8_t *values,
+                     int value_count)
+{
+    huff->bits = bits;
+    huff->values = values;
+    huff->value_count = value_count;
+
+    /* canonical codes, ITU T.81 Annex C */
+    int code = 0;
+    int k = 0;
+    for (int len = 1; len <= 16; len++) {
+        for (int i = 0; i < bits[len - 1]; i++) {
+            huff->codes[values[k]] = code++;
+            huff->sizes[values[k]] = len;
+            k++;
+        }
+        code <<= 1;
+    }
+}
+
+static void
+jpeggen_init_dct(struct jpeggen *gen)
+{
+    for (int u = 0; u < 8; u++) {
+        const double cu = u ? 0.5 : 0.5 / sqrt(2.0);
+        for (int x = 0; x < 8; x++)
+            gen->dct[u][x] = cu * cos((2 * x + 1) * u * M_PI / 16.0);
+    }
+}
+
+static uint32_t
+jpeggen_hash(uint32_t x, uint32_t y, uint32_t seed)
+{
+    uint32_t h = x * 0x9e3779b1u ^ y * 0x85ebca77u ^ seed * 0xc2b2ae3du;
+    h ^= h >> 15;
+    h *= 0x2c1b3c6du;
+    h ^= h >> 12;
+    h *= 0x297a2d39u;
+    h ^= h >> 15;
+    return h;
+}
+
+static void
+jpeggen_pixel(const struct jpeggen *gen, int x, int y, int *rgb)
+{
+    /* replicate the edges into the MCU padding */
+    x = MIN2(x, gen->width - 1);
+    y = MIN2(y, gen->height - 1);
+
+    const double fx = (double)x / gen->width;
+    const double fy = (double)y / gen->height;
+
+    /* a zone plate whose frequency rises towards the corners */
+    const double dx = x - gen->width / 2.0;
+    const double dy = y - gen->height / 2.0;
+    const double k = M_PI / (2.0 * MAX2(gen->width, gen->height));
+    const double zone = 96.0 * cos(k * (dx * dx + dy * dy));
+
+    double base[3] = { 255.0 * fx, 255.0 * fy, 255.0 * (1.0 - fx) };
+
+    /* hard-edged boxes in the top-left quadrant */
+    if (fx < 0.5 && fy < 0.5 && ((x / 24) ^ (y / 24)) & 1) {
+        base[0] = 255.0 - base[0];
+        base[2] = 32.0;
+    }
+
+    const uint32_t h = jpeggen_hash(x, y, gen->seed);
+    for (int i = 0; i < 3; i++) {
+        const double noise = (double)((h >> (i * 8)) & 0x1f) - 16.0;
+        const double v = 0.5 * base[i] + 0.5 * (128.0 + zone) + noise;
+        rgb[i] = (int)MIN2(MAX2(v, 0.0), 255.0);
+    }
+}
+
+static void
+jpeggen_init_components(struct jpeggen *gen)
+{
+    const bool shared = gen->layout == JPEGGEN_LAYOUT_SHARED;
+    int h0;
+    int v0;
+
+    switch (gen->subsampling) {
+    case 420:
+        h0 = 2;
+        v0 = 2;
+        break;
+    case 422:
+        h0 = 2;
+        v0 = 1;
+        break;
+    case 444:
+    case 400:
+        h0 = 1;
+        v0 = 1;
+        break;
+    default:
+        va_die("unsupported subsampling %d", gen->subsampling);
+    }
+
+    gen->component_count = gen->subsampling == 400 ? 1 : 3;
+    for (int i = 0; i < gen->component_count; i++) {
+        gen->components[i] = (struct jpeggen_component){
+            .id = i + 1,
+            .h = i ? 1 : h0,
+            .v = i ? 1 : v0,
+            .tq = i && !shared,
+            .th = i && !shared,
+        };
+    }
+
+    gen->mcu_cols = (gen->width + h0 * 8 - 1) / (h0 * 8);
+    gen->mcu_rows = (gen->height + v0 * 8 - 1) / (v0 * 8);
+    gen->restart_interval = gen->restart < 0 ? -gen->restart * gen->mcu_cols : gen->restart;
+    if (gen->restart_interval > 65535)
+        va_die("restart interval %d is too large", gen->restart_interval);
+
+    for (int i = 0; i < gen->component_count; i++) {
+        struct jpeggen_component *comp = &gen->components[i];
+        comp->width = gen->mcu_cols * comp->h * 8;
+        comp->height = gen->mcu_rows * comp->v * 8;
+        comp->plane = malloc((size_t)comp->width * comp->height);
+        if (!comp->plane)
+            va_die("failed to alloc plane");
+    }
+
+    /* BT.601 full range, with chroma averaged over the subsampled area */
+    const int sx = h0;
+    const int sy = v0;
+    for (int y = 0; y < gen->components[0].height; y++) {
+        for (int x = 0; x < gen->components[0].width; x++) {
+            int rgb[3];
+            jpeggen_pixel(gen, x, y, rgb);
+            const double luma = 0.299 * rgb[0] + 0.587 * rgb[1] + 0.114 * rgb[2];
+            gen->components[0].plane[y * gen->components[0].width + x] = (uint8_t)lround(luma);
+        }
+    }
+
+    for (int i = 1; i < gen->component_count; i++) {
+        struct jpeggen_component *comp = &gen->components[i];
+        for (int y = 0; y < comp->height; y++) {
+            for (int x = 0; x < comp->width; x++) {
+                double sum = 0.0;
+                for (int j = 0; j < sy; j++) {
+                    for (int k = 0; k < sx; k++) {
+                        int rgb[3];
+                        jpeggen_pixel(gen, x * sx + k, y * sy + j, rgb);
+                        sum += i == 1 ? -0.168736 * rgb[0] - 0.331264 * rgb[1] + 0.5 * rgb[2]
+                                      : 0.5 * rgb[0] - 0.418688 * rgb[1] - 0.081312 * rgb[2];
+                    }
+                }
+                const long c = lround(128.0 + sum / (sx * sy));
+                comp->plane[y * comp->width + x] = (uint8_t)MIN2(MAX2(c, 0), 255);
+            }
+        }
+    }
+}
+
+static void
+jpeggen_put_byte(struct jpeggen *gen, uint8_t byte)
+{
+    if (gen->size == gen->capacity) {
+        gen->capacity = gen->capacity ? gen->capacity * 2 : 64 * 1024;
+        gen->data = realloc(gen->data, gen->capacity);
+        if (!gen->data)
+            va_die("failed to alloc output");
+    }
+    gen->data[gen->size++] = byte;
+}
+
+static void
+jpeggen_put_be16(struct jpeggen *gen, int val)
+{
+    jpeggen_put_byte(gen, val >> 8);
+    jpeggen_put_byte(gen, val & 0xff);
+}
+
+static void
+jpeggen_put_marker(struct jpeggen *gen, int marker, int payload_size)
+{
+    jpeggen_put_byte(gen, 0xff);
+    jpeggen_put_byte(gen, marker);
+    if (payload_size >= 0)
+        jpeggen_put_be16(gen, payload_size + 2);
+}
+
+static void
+jpeggen_put_bits(struct jpeggen *gen, uint32_t val, int count)
+{
+    gen->bits = gen->bits << count | (val & ((1u << count) - 1));
+    gen->bit_count += count;
+
+    while (gen->bit_count >= 8) {
+        const uint8_t byte = gen->bits >> (gen->bit_count - 8);
+        jpeggen_put_byte(gen, byte);
+        if (byte == 0xff)
+            jpeggen_put_byte(gen, 0x00);
+        gen->bit_count -= 8;
+    }
+}
+
+static void
+jpeggen_flush_bits(struct jpeggen *gen)
+{
+    /* pad with 1-bits */
+    if (gen->bit_count)
+        jpeggen_put_bits(gen, 0x7f, 8 - gen->bit_count);
+    gen->bits = 0;
+}
+
+static void
+jpeggen_put_symbol(struct jpeggen *gen, const struct jpeggen_huffman *huff, int symbol)
+{
+    jpeggen_put_bits(gen, huff->codes[symbol], huff->sizes[symbol]);
+}
+
+static int
+jpeggen_category(int val)
+{
+    int size = 0;
+    for (val = abs(val); val; val >>= 1)
+        size++;
+    return size;
+}
+
+static void
+jpeggen_put_coef(struct jpeggen *gen, const struct jpeggen_huffman *huff, int run, int val)
+{
+    const int size = jpeggen_category(val);
+    jpeggen_put_symbol(gen, huff, run << 4 | size);
+    if (size)
+        jpeggen_put_bits(gen, val < 0 ? val - 1 : val, size);
+}
+
+static void
+jpeggen_encode_block(struct jpeggen *gen, struct jpeggen_component *comp, int bx, int by)
+{
+    const uint8_t *src = comp->plane + by * 8 * comp->width + bx * 8;
+    const uint8_t *quant = gen->quant[comp->tq];
+
+    float rows[8][8];
+    for (int y = 0; y < 8; y++) {
+        for (int u = 0; u < 8; u++) {
+            float sum = 0.0f;
+            for (int x = 0; x < 8; x++)
+                sum += gen->dct[u][x] * (src[y * comp->width + x] - 128);
+            rows[y][u] = sum;
+        }
+    }
+
+    int coefs[64];
+    for (int v = 0; v < 8; v++) {
+        for (int u = 0; u < 8; u++) {
+            float sum = 0.0f;
+            for (int y = 0; y < 8; y++)
+                sum += gen->dct[v][y] * rows[y][u];
+            coefs[v * 8 + u] = (int)lroundf(sum);
+        }
+    }
+
+    int zz[64];
+    for (int k = 0; k < 64; k++) {
+        const int c = coefs[swjpeg_zigzag[k]];
+        const int q = quant[k];
+        zz[k] = c < 0 ? -((-c + q / 2) / q) : (c + q / 2) / q;
+    }
+
+    const int diff = zz[0] - comp->dc_pred;
+    comp->dc_pred = zz[0];
+    jpeggen_put_coef(gen, &gen->huffman[0][comp->th], 0, diff);
+
+    const struct jpeggen_huffman *ac = &gen->huffman[1][comp->th];
+    int run = 0;
+    for (int k = 1; k < 64; k++) {
+        if (!zz[k]) {
+            run++;
+            continue;
+        }
+        for (; run > 15; run -= 16)
+            jpeggen_put_symbol(gen, ac, 0xf0);
+        jpeggen_put_coef(gen, ac, run, zz[k]);
+        run = 0;
+    }
+    if (run)
+        jpeggen_put_symbol(gen, ac, 0x00);
+}
+
+static void
+jpeggen_encode_scan(struct jpeggen *gen)
+{
+    const int mcu_count = gen->mcu_cols * gen->mcu_rows;
+
+    for (int mcu = 0; mcu < mcu_count; mcu++) {
+        if (gen->restart_interval && mcu && !(mcu % gen->restart_interval)) {
+            jpeggen_flush_bits(gen);
+            jpeggen_put_marker(gen, 0xd0 + (mcu / gen->restart_interval - 1) % 8, -1);
+            for (int i = 0; i < gen->component_count; i++)
+                gen->components[i].dc_pred = 0;
+        }
+
+        const int mx = mcu % gen->mcu_cols;
+        const int my = mcu / gen->mcu_cols;
+        for (int i = 0; i < gen->component_count; i++) {
+            struct jpeggen_component *comp = &gen->components[i];
+            for (int v = 0; v < comp->v; v++) {
+                for (int h = 0; h < comp->h; h++)
+                    jpeggen_encode_block(gen, comp, mx * comp->h + h, my * comp->v + v);
+            }
+        }
+    }
+
+    jpeggen_flush_bits(gen);
+}
+
+static void
+jpeggen_put_dqt(struct jpeggen *gen, int first, int count)
+{
+    jpeggen_put_marker(gen, 0xdb, 65 * count);
+    for (int t = first; t < first + count; t++) {
+        jpeggen_put_byte(gen, t);
+        for (int k = 0; k < 64; k++)
+            jpeggen_put_byte(gen, gen->quant[t][k]);
+    }
+}
+
+static void
+jpeggen_put_dht(struct jpeggen *gen, int first, int count)
+{
+    int size = 0;
+    for (int t = first; t < first + count; t++)
+        size += 2 * 17 + gen->huffman[0][t].value_count + gen->huffman[1][t].value_count;
+
+    jpeggen_put_marker(gen, 0xc4, size);
+    for (int t = first; t < first + count; t++) {
+        for (int tc = 0; tc < 2; tc++) {
+            const struct jpeggen_huffman *huff = &gen->huffman[tc][t];
+            jpeggen_put_byte(gen, tc << 4 | t);
+            for (int i = 0; i < 16; i++)
+                jpeggen_put_byte(gen, huff->bits[i]);
+            for (int i = 0; i < huff->value_count; i++)
+                jpeggen_put_byte(gen, huff->values[i]);
+        }
+    }
+}
+
+static void
+jpeggen_encode(struct jpeggen *gen)
+{
+    const int table_count =
+        gen->component_count > 1 && gen->layout != JPEGGEN_LAYOUT_SHARED ? 2 : 1;
+
+    jpeggen_put_marker(gen, 0xd8, -1);
+
+    /* JFIF 1.01, no density, no thumbnail */
+    static const uint8_t jfif[] = { 'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0 };
+    jpeggen_put_marker(gen, 0xe0, sizeof(jfif));
+    for (size_t i = 0; i < sizeof(jfif); i++)
+        jpeggen_put_byte(gen, jfif[i]);
+
+    if (gen->layout == JPEGGEN_LAYOUT_SPLIT) {
+        for (int t = 0; t < table_count; t++)
+            jpeggen_put_dqt(gen, t, 1);
+    } else {
+        jpeggen_put_dqt(gen, 0, table_count);
+    }
+
+    jpeggen_put_marker(gen, 0xc0, 6 + 3 * gen->component_count);
+    jpeggen_put_byte(gen, 8);
+    jpeggen_put_be16(gen, gen->height);
+    jpeggen_put_be16(gen, gen->width);
+    jpeggen_put_byte(gen, gen->component_count);
+    for (int i = 0; i < gen->component_count; i++) {
+        const struct jpeggen_component *comp = &gen->components[i];
+        jpeggen_put_byte(gen, comp->id);
+        jpeggen_put_byte(gen, comp->h << 4 | comp->v);
+        jpeggen_put_byte(gen, comp->tq);
+    }
+
+    if (gen->layout == JPEGGEN_LAYOUT_SPLIT) {
+        for (int t = 0; t < table_count; t++)
+            jpeggen_put_dht(gen, t, 1);
+    } else {
+        jpeggen_put_dht(gen, 0, table_count);
+    }
+
+    if (gen->restart_interval) {
+        jpeggen_put_marker(gen, 0xdd, 2);
+        jpeggen_put_be16(gen, gen->restart_interval);
+    }
+
+    jpeggen_put_marker(gen, 0xda, 4 + 2 * gen->component_count);
+    jpeggen_put_byte(gen, gen->component_count);
+    for (int i = 0; i < gen->component_count; i++) {
+        const struct jpeggen_component *comp = &gen->components[i];
+        jpeggen_put_byte(gen, comp->id);
+        jpeggen_put_byte(gen, comp->th << 4 | comp->th);
+    }
+    /* Ss, Se, Ah and Al of a sequential scan */
+    jpeggen_put_byte(gen, 0);
+    jpeggen_put_byte(gen, 63);
+    jpeggen_put_byte(gen, 0);
+
+    jpeggen_encode_scan(gen);
+
+    jpeggen_put_marker(gen, 0xd9, -1);
+}
+
+static void
+jpeggen_write(const struct jpeggen *gen, const char *filename)
+{
+    FILE *fp = fopen(filename, "wb");
+    if (!fp)
+        va_die("failed to open %s", filename);
+    if (fwrite(gen->data, 1, gen->size, fp) != gen->size)
+        va_die("failed to write %s", filename);
+    if (fclose(fp))
+        va_die("failed to close %s", filename);
+}
+
+static void
+jpeggen_cleanup(struct jpeggen *gen)
+{
+    for (int i = 0; i < gen->component_count; i++)
+        free(gen->components[i].plane);
+    free(gen->data);
+}
+
+int
+main(int argc, char **argv)
+{
+    struct jpeggen gen = {
+        .width = 1920,
+        .height = 1080,
+        .quality = 75,
+        .subsampling = 420,
+        .layout = JPEGGEN_LAYOUT_COMBINED,
+        .seed = 1,
+    };
+
+    static const struct option options[] = {
+        { "size", required_argument, NULL, 's' },
+        { "quality", required_argument, NULL, 'q' },
+        { "subsampling", required_argument, NULL, 'c' },
+        { "restart", required_argument, NULL, 'r' },
+        { "layout", required_argument, NULL, 'l' },
+        { "seed", required_argument, NULL, 'e' },
+        { 0 },
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "s:q:c:r:l:e:", options, NULL)) != -1) {
+        switch (opt) {
+        case 's':
+            if (sscanf(optarg, "%dx%d", &gen.width, &gen.height) != 2 || gen.width < 1 ||
+                gen.height < 1 || gen.width > 65535 || gen.height > 65535)
+                va_die("invalid size %s", optarg);
+            break;
+        case 'q':
+            gen.quality = atoi(optarg);
+            if (gen.quality < 1 || gen.quality > 100)
+                va_die("invalid quality %s", optarg);
+            break;
+        case 'c':
+            gen.subsampling = atoi(optarg);
+            break;
+        case 'r':
+            /* <n>row restarts every n MCU rows */
+            if (strstr(optarg, "row"))
+                gen.restart = -MAX2(atoi(optarg), 1);
+            else
+                gen.restart = atoi(optarg);
+            break;
+        case 'l':
+            if (!strcmp(optarg, "combined"))
+                gen.layout = JPEGGEN_LAYOUT_COMBINED;
+            else if (!strcmp(optarg, "split"))
+                gen.layout = JPEGGEN_LAYOUT_SPLIT;
+            else if (!strcmp(optarg, "shared"))
+                gen.layout = JPEGGEN_LAYOUT_SHARED;
+            else
+                va_die("invalid layout %s", optarg);
+            break;
+        case 'e':
+            gen.seed = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            va_die("usage: %s [--size <w>x<h>] [--quality <1-100>] "
+                   "[--subsampling 420|422|444|400] [--restart <mcus>|<n>row] "
+                   "[--layout combined|split|shared] [--seed <n>] <output>",
+                   argv[0]);
+        }
+    }
+    if (optind + 1 != argc)
+        va_die("expect one output file");
+
+    jpegva_scale_quant(gen.quality, gen.quant);
+    for (int t = 0; t < 2; t++) {
+        jpeggen_init_huffman(&gen.huffman[0][t], jpegva_std_dc_bits[t], jpegva_std_dc_values,
+                             ARRAY_SIZE(jpegva_std_dc_values));
+        jpeggen_init_huffman(&gen.huffman[1][t], jpegva_std_ac_bits[t], jpegva_std_ac_values[t],
+                             ARRAY_SIZE(jpegva_std_ac_values[t]));
+    }
+    jpeggen_init_dct(&gen);
+    jpeggen_init_components(&gen);
+
+    jpeggen_encode(&gen);
+    jpeggen_write(&gen, argv[optind]);
+
+    jpeggen_cleanup(&gen);
+
+    return 0;
+}
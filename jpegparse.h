@@ -0,0 +1,548 @@
+/*
+ * Copyright 2022 Google LLC
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef JPEGPARSE_H
+#define JPEGPARSE_H
+
+/*
+ * An incremental JPEG parser.  Bytes are pushed in chunks of any size and
+ * the parser reports marker segments, frame/scan headers and entropy-coded
+ * data through callbacks.  All state, including the segment being
+ * assembled, lives in struct jpegparse, so the parser never allocates.
+ * Errors are returned rather than fatal; a parser in the error state can be
+ * reinitialized for the next image.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define JPEGPARSE_MAX_COMPONENTS 4
+#define JPEGPARSE_MAX_TABLES 4
+#define JPEGPARSE_MAX_SEGMENT 65535
+
+enum jpegparse_result {
+    JPEGPARSE_OK = 0,
+    JPEGPARSE_ERROR_NOT_JPEG,
+    JPEGPARSE_ERROR_BAD_MARKER,
+    JPEGPARSE_ERROR_BAD_SEGMENT,
+    JPEGPARSE_ERROR_UNSUPPORTED,
+    JPEGPARSE_ERROR_MISSING_SEGMENT,
+    JPEGPARSE_ERROR_TRUNCATED,
+};
+
+enum jpegparse_state {
+    JPEGPARSE_STATE_SOI,
+    JPEGPARSE_STATE_SOI_CODE,
+    JPEGPARSE_STATE_MARKER,
+    JPEGPARSE_STATE_MARKER_CODE,
+    JPEGPARSE_STATE_LENGTH,
+    JPEGPARSE_STATE_LENGTH_LO,
+    JPEGPARSE_STATE_SEGMENT,
+    JPEGPARSE_STATE_SCAN,
+    /* the last byte of the previous chunk was a 0xff in the scan */
+    JPEGPARSE_STATE_SCAN_FF,
+    JPEGPARSE_STATE_DONE,
+    JPEGPARSE_STATE_ERROR,
+};
+
+/* the headers, using the names of ITU T.81 */
+struct jpegparse_frame {
+    struct {
+        int P;
+        int Y;
+        int X;
+        int Nf;
+        int Ci[JPEGPARSE_MAX_COMPONENTS];
+        int Hi[JPEGPARSE_MAX_COMPONENTS];
+        int Vi[JPEGPARSE_MAX_COMPONENTS];
+        int Tqi[JPEGPARSE_MAX_COMPONENTS];
+    } sof0;
+
+    /* indexed by Tq; Qk is in zigzag order */
+    struct {
+        bool loaded[JPEGPARSE_MAX_TABLES];
+        int Pq[JPEGPARSE_MAX_TABLES];
+        uint16_t Qk[JPEGPARSE_MAX_TABLES][64];
+    } dqt;
+
+    /* indexed by Tc and Th */
+    struct {
+        bool loaded[2][JPEGPARSE_MAX_TABLES];
+        uint8_t Li[2][JPEGPARSE_MAX_TABLES][16];
+        uint8_t Vij[2][JPEGPARSE_MAX_TABLES][256];
+        int Vij_sizes[2][JPEGPARSE_MAX_TABLES];
+    } dht;
+
+    struct {
+        int Ns;
+        int Csj[JPEGPARSE_MAX_COMPONENTS];
+        int Tdj[JPEGPARSE_MAX_COMPONENTS];
+        int Taj[JPEGPARSE_MAX_COMPONENTS];
+    } sos;
+
+    struct {
+        int Ri;
+    } dri;
+};
+
+/* all callbacks are optional */
+struct jpegparse_callbacks {
+    /* a complete marker segment, with the payload after the length field */
+    void (*segment)(void *data, int marker, const uint8_t *payload, size_t size);
+    /* at every SOS, once the frame and scan headers are known */
+    void (*frame)(void *data, const struct jpegparse_frame *frame);
+    /* consecutive chunks of entropy-coded data, including RSTn markers */
+    void (*scan)(void *data, const uint8_t *chunk, size_t size);
+    /* at EOI */
+    void (*end)(void *data);
+};
+
+struct jpegparse {
+    const struct jpegparse_callbacks *callbacks;
+    void *data;
+
+    enum jpegparse_state state;
+    enum jpegparse_result error;
+    /* bytes consumed so far, up to and including EOI */
+    uint64_t offset;
+
+    int marker;
+    bool sof_seen;
+    bool buffered;
+    uint32_t remaining;
+    uint32_t filled;
+
+    struct jpegparse_frame frame;
+    uint8_t segment[JPEGPARSE_MAX_SEGMENT];
+};
+
+static inline const char *
+jpegparse_result_str(enum jpegparse_result result)
+{
+    switch (result) {
+    case JPEGPARSE_OK:
+        return "ok";
+    case JPEGPARSE_ERROR_NOT_JPEG:
+        return "not a jpeg";
+    case JPEGPARSE_ERROR_BAD_MARKER:
+        return "bad marker";
+    case JPEGPARSE_ERROR_BAD_SEGMENT:
+        return "bad segment";
+    case JPEGPARSE_ERROR_UNSUPPORTED:
+        return "unsupported";
+    case JPEGPARSE_ERROR_MISSING_SEGMENT:
+        return "missing segment";
+    case JPEGPARSE_ERROR_TRUNCATED:
+        return "truncated";
+    }
+    return "unknown";
+}
+
+static inline void
+jpegparse_init(struct jpegparse *parser, const struct jpegparse_callbacks *callbacks, void *data)
+{
+    static const struct jpegparse_callbacks no_callbacks;
+
+    parser->callbacks = callbacks ? callbacks : &no_callbacks;
+    parser->data = data;
+    parser->state = JPEGPARSE_STATE_SOI;
+    parser->error = JPEGPARSE_OK;
+    parser->offset = 0;
+    parser->marker = 0;
+    parser->sof_seen = false;
+    parser->buffered = false;
+    parser->remaining = 0;
+    parser->filled = 0;
+    memset(&parser->frame, 0, sizeof(parser->frame));
+}
+
+static inline enum jpegparse_result
+jpegparse_fail(struct jpegparse *parser, enum jpegparse_result error)
+{
+    parser->state = JPEGPARSE_STATE_ERROR;
+    parser->error = error;
+    return error;
+}
+
+static inline int
+jpegparse_be16(const uint8_t *ptr)
+{
+    return (int)ptr[0] << 8 | ptr[1];
+}
+
+static inline enum jpegparse_result
+jpegparse_parse_sof0(struct jpegparse *parser, const uint8_t *ptr, uint32_t size)
+{
+    struct jpegparse_frame *frame = &parser->frame;
+
+    if (parser->sof_seen)
+        return JPEGPARSE_ERROR_UNSUPPORTED;
+    if (size < 6)
+        return JPEGPARSE_ERROR_BAD_SEGMENT;
+
+    frame->sof0.P = ptr[0];
+    frame->sof0.Y = jpegparse_be16(&ptr[1]);
+    frame->sof0.X = jpegparse_be16(&ptr[3]);
+    frame->sof0.Nf = ptr[5];
+    if (frame->sof0.Nf < 1 || frame->sof0.Nf > JPEGPARSE_MAX_COMPONENTS ||
+        size != 6 + 3 * (uint32_t)frame->sof0.Nf || !frame->sof0.X)
+        return JPEGPARSE_ERROR_BAD_SEGMENT;
+    /* 12-bit samples and DNL are not baseline */
+    if (frame->sof0.P != 8 || !frame->sof0.Y)
+        return JPEGPARSE_ERROR_UNSUPPORTED;
+
+    for (int i = 0; i < frame->sof0.Nf; i++) {
+        const uint8_t *comp = &ptr[6 + 3 * i];
+        frame->sof0.Ci[i] = comp[0];
+        frame->sof0.Hi[i] = comp[1] >> 4;
+        frame->sof0.Vi[i] = comp[1] & 0xf;
+        frame->sof0.Tqi[i] = comp[2];
+        if (frame->sof0.Hi[i] < 1 || frame->sof0.Hi[i] > 4 || frame->sof0.Vi[i] < 1 ||
+            frame->sof0.Vi[i] > 4 || frame->sof0.Tqi[i] >= JPEGPARSE_MAX_TABLES)
+            return JPEGPARSE_ERROR_BAD_SEGMENT;
+    }
+
+    parser->sof_seen = true;
+    return JPEGPARSE_OK;
+}
+
+static inline enum jpegparse_result
+jpegparse_parse_dqt(struct jpegparse *parser, const uint8_t *ptr, uint32_t size)
+{
+    struct jpegparse_frame *frame = &parser->frame;
+    const uint8_t *end = ptr + size;
+
+    while (ptr < end) {
+        const int Pq = ptr[0] >> 4;
+        const int Tq = ptr[0] & 0xf;
+        if (Pq > 1 || Tq >= JPEGPARSE_MAX_TABLES || end - ptr < 1 + 64 * (1 + Pq))
+            return JPEGPARSE_ERROR_BAD_SEGMENT;
+        ptr++;
+
+        frame->dqt.loaded[Tq] = true;
+        frame->dqt.Pq[Tq] = Pq;
+        for (int k = 0; k < 64; k++)
+            frame->dqt.Qk[Tq][k] = Pq ? jpegparse_be16(&ptr[k * 2]) : ptr[k];
+        ptr += 64 * (1 + Pq);
+    }
+
+    return JPEGPARSE_OK;
+}
+
+static inline enum jpegparse_result
+jpegparse_parse_dht(struct jpegparse *parser, const uint8_t *ptr, uint32_t size)
+{
+    struct jpegparse_frame *frame = &parser->frame;
+    const uint8_t *end = ptr + size;
+
+    while (ptr < end) {
+        if (end - ptr < 1 + 16)
+            return JPEGPARSE_ERROR_BAD_SEGMENT;
+
+        const int Tc = ptr[0] >> 4;
+        const int Th = ptr[0] & 0xf;
+        if (Tc > 1 || Th >= JPEGPARSE_MAX_TABLES)
+            return JPEGPARSE_ERROR_BAD_SEGMENT;
+
+        int sum = 0;
+        for (int i = 0; i < 16; i++)
+            sum += ptr[1 + i];
+        if (sum > 256 || end - ptr < 1 + 16 + sum)
+            return JPEGPARSE_ERROR_BAD_SEGMENT;
+
+        frame->dht.loaded[Tc][Th] = true;
+        memcpy(frame->dht.Li[Tc][Th], &ptr[1], 16);
+        memcpy(frame->dht.Vij[Tc][Th], &ptr[1 + 16], sum);
+        frame->dht.Vij_sizes[Tc][Th] = sum;
+        ptr += 1 + 16 + sum;
+    }
+
+    return JPEGPARSE_OK;
+}
+
+static inline enum jpegparse_result
+jpegparse_parse_sos(struct jpegparse *parser, const uint8_t *ptr, uint32_t size)
+{
+    struct jpegparse_frame *frame = &parser->frame;
+
+    if (!parser->sof_seen)
+        return JPEGPARSE_ERROR_MISSING_SEGMENT;
+    if (size < 1)
+        return JPEGPARSE_ERROR_BAD_SEGMENT;
+
+    frame->sos.Ns = ptr[0];
+    if (frame->sos.Ns < 1 || frame->sos.Ns > JPEGPARSE_MAX_COMPONENTS ||
+        size != 4 + 2 * (uint32_t)frame->sos.Ns)
+        return JPEGPARSE_ERROR_BAD_SEGMENT;
+
+    for (int i = 0; i < frame->sos.Ns; i++) {
+        const uint8_t *comp = &ptr[1 + 2 * i];
+        frame->sos.Csj[i] = comp[0];
+        frame->sos.Tdj[i] = comp[1] >> 4;
+        frame->sos.Taj[i] = comp[1] & 0xf;
+        if (frame->sos.Tdj[i] >= JPEGPARSE_MAX_TABLES ||
+            frame->sos.Taj[i] >= JPEGPARSE_MAX_TABLES)
+            return JPEGPARSE_ERROR_BAD_SEGMENT;
+        if (!frame->dht.loaded[0][frame->sos.Tdj[i]] || !frame->dht.loaded[1][frame->sos.Taj[i]])
+            return JPEGPARSE_ERROR_MISSING_SEGMENT;
+
+        bool found = false;
+        for (int j = 0; j < frame->sof0.Nf; j++) {
+            if (frame->sof0.Ci[j] != frame->sos.Csj[i])
+                continue;
+            if (!frame->dqt.loaded[frame->sof0.Tqi[j]])
+                return JPEGPARSE_ERROR_MISSING_SEGMENT;
+            found = true;
+        }
+        if (!found)
+            return JPEGPARSE_ERROR_BAD_SEGMENT;
+    }
+
+    return JPEGPARSE_OK;
+}
+
+static inline enum jpegparse_result
+jpegparse_parse_segment(struct jpegparse *parser)
+{
+    const uint8_t *ptr = parser->segment;
+    const uint32_t size = parser->filled;
+
+    switch (parser->marker) {
+    case 0xc0: /* SOF0 */
+    case 0xc1: /* SOF1, identical to SOF0 for 8-bit samples */
+        return jpegparse_parse_sof0(parser, ptr, size);
+    case 0xc4: /* DHT */
+        return jpegparse_parse_dht(parser, ptr, size);
+    case 0xda: /* SOS */
+        return jpegparse_parse_sos(parser, ptr, size);
+    case 0xdb: /* DQT */
+        return jpegparse_parse_dqt(parser, ptr, size);
+    case 0xdd: /* DRI */
+        if (size != 2)
+            return JPEGPARSE_ERROR_BAD_SEGMENT;
+        parser->frame.dri.Ri = jpegparse_be16(ptr);
+        return JPEGPARSE_OK;
+    default:
+        return JPEGPARSE_OK;
+    }
+}
+
+static inline bool
+jpegparse_marker_needs_buffer(const struct jpegparse *parser, int marker)
+{
+    if (parser->callbacks->segment)
+        return true;
+
+    switch (marker) {
+    case 0xc0:
+    case 0xc1:
+    case 0xc4:
+    case 0xda:
+    case 0xdb:
+    case 0xdd:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static inline enum jpegparse_result
+jpegparse_begin_marker(struct jpegparse *parser, int marker)
+{
+    parser->marker = marker;
+
+    if (marker == 0xd9) { /* EOI */
+        if (!parser->sof_seen)
+            return jpegparse_fail(parser, JPEGPARSE_ERROR_MISSING_SEGMENT);
+        parser->state = JPEGPARSE_STATE_DONE;
+        if (parser->callbacks->end)
+            parser->callbacks->end(parser->data);
+        return JPEGPARSE_OK;
+    }
+
+    /* stuffing, TEM, RSTn outside of a scan, and SOI */
+    if (marker <= 0x01 || (marker >= 0xd0 && marker <= 0xd8))
+        return jpegparse_fail(parser, JPEGPARSE_ERROR_BAD_MARKER);
+
+    /* SOFn other than baseline and extended sequential huffman */
+    if (marker >= 0xc2 && marker <= 0xcf && marker != 0xc4 && marker != 0xcc)
+        return jpegparse_fail(parser, JPEGPARSE_ERROR_UNSUPPORTED);
+
+    parser->state = JPEGPARSE_STATE_LENGTH;
+    return JPEGPARSE_OK;
+}
+
+static inline enum jpegparse_result
+jpegparse_end_segment(struct jpegparse *parser)
+{
+    if (parser->buffered) {
+        const enum jpegparse_result result = jpegparse_parse_segment(parser);
+        if (result != JPEGPARSE_OK)
+            return jpegparse_fail(parser, result);
+
+        if (parser->callbacks->segment)
+            parser->callbacks->segment(parser->data, parser->marker, parser->segment,
+                                       parser->filled);
+    }
+
+    if (parser->marker == 0xda) {
+        if (parser->callbacks->frame)
+            parser->callbacks->frame(parser->data, &parser->frame);
+        parser->state = JPEGPARSE_STATE_SCAN;
+    } else {
+        parser->state = JPEGPARSE_STATE_MARKER;
+    }
+
+    return JPEGPARSE_OK;
+}
+
+static inline bool
+jpegparse_is_scan_byte(uint8_t byte)
+{
+    /* stuffed zero or RSTn */
+    return byte == 0x00 || (byte & 0xf8) == 0xd0;
+}
+
+/* consumes scan data and returns the number of bytes consumed */
+static inline size_t
+jpegparse_feed_scan(struct jpegparse *parser, const uint8_t *ptr, size_t size)
+{
+    const uint8_t *start = ptr;
+    const uint8_t *end = ptr + size;
+    const uint8_t *run = ptr;
+
+    while (ptr < end) {
+        const uint8_t *ff = memchr(ptr, 0xff, end - ptr);
+        if (!ff) {
+            ptr = end;
+            break;
+        }
+
+        if (ff + 1 == end) {
+            /* decide once the next byte arrives */
+            if (run < ff && parser->callbacks->scan)
+                parser->callbacks->scan(parser->data, run, ff - run);
+            parser->state = JPEGPARSE_STATE_SCAN_FF;
+            return size;
+        }
+
+        if (!jpegparse_is_scan_byte(ff[1])) {
+            if (run < ff && parser->callbacks->scan)
+                parser->callbacks->scan(parser->data, run, ff - run);
+            parser->state = JPEGPARSE_STATE_MARKER_CODE;
+            return ff + 1 - start;
+        }
+
+        ptr = ff + 2;
+    }
+
+    if (run < ptr && parser->callbacks->scan)
+        parser->callbacks->scan(parser->data, run, ptr - run);
+    return ptr - start;
+}
+
+static inline enum jpegparse_result
+jpegparse_feed(struct jpegparse *parser, const void *data, size_t size)
+{
+    static const uint8_t ff = 0xff;
+    const uint8_t *ptr = data;
+    const uint8_t *end = ptr + size;
+
+    while (ptr < end) {
+        const uint8_t *begin = ptr;
+
+        switch (parser->state) {
+        case JPEGPARSE_STATE_SOI:
+            if (*ptr++ != 0xff)
+                return jpegparse_fail(parser, JPEGPARSE_ERROR_NOT_JPEG);
+            parser->state = JPEGPARSE_STATE_SOI_CODE;
+            break;
+        case JPEGPARSE_STATE_SOI_CODE:
+            if (*ptr++ != 0xd8)
+                return jpegparse_fail(parser, JPEGPARSE_ERROR_NOT_JPEG);
+            parser->state = JPEGPARSE_STATE_MARKER;
+            break;
+        case JPEGPARSE_STATE_MARKER:
+            if (*ptr++ != 0xff)
+                return jpegparse_fail(parser, JPEGPARSE_ERROR_BAD_MARKER);
+            parser->state = JPEGPARSE_STATE_MARKER_CODE;
+            break;
+        case JPEGPARSE_STATE_MARKER_CODE: {
+            const int marker = *ptr++;
+            /* fill bytes */
+            if (marker == 0xff)
+                break;
+            if (jpegparse_begin_marker(parser, marker) != JPEGPARSE_OK)
+                return parser->error;
+            break;
+        }
+        case JPEGPARSE_STATE_LENGTH:
+            parser->remaining = (uint32_t)*ptr++ << 8;
+            parser->state = JPEGPARSE_STATE_LENGTH_LO;
+            break;
+        case JPEGPARSE_STATE_LENGTH_LO:
+            parser->remaining |= *ptr++;
+            if (parser->remaining < 2)
+                return jpegparse_fail(parser, JPEGPARSE_ERROR_BAD_SEGMENT);
+            parser->remaining -= 2;
+            parser->filled = 0;
+            parser->buffered = jpegparse_marker_needs_buffer(parser, parser->marker);
+            parser->state = JPEGPARSE_STATE_SEGMENT;
+            if (!parser->remaining && jpegparse_end_segment(parser) != JPEGPARSE_OK)
+                return parser->error;
+            break;
+        case JPEGPARSE_STATE_SEGMENT: {
+            const uint32_t avail = end - ptr;
+            const uint32_t count = avail < parser->remaining ? avail : parser->remaining;
+            if (parser->buffered)
+                memcpy(parser->segment + parser->filled, ptr, count);
+            parser->filled += count;
+            parser->remaining -= count;
+            ptr += count;
+            if (!parser->remaining && jpegparse_end_segment(parser) != JPEGPARSE_OK)
+                return parser->error;
+            break;
+        }
+        case JPEGPARSE_STATE_SCAN:
+            ptr += jpegparse_feed_scan(parser, ptr, end - ptr);
+            break;
+        case JPEGPARSE_STATE_SCAN_FF:
+            if (jpegparse_is_scan_byte(*ptr)) {
+                if (parser->callbacks->scan)
+                    parser->callbacks->scan(parser->data, &ff, 1);
+                parser->state = JPEGPARSE_STATE_SCAN;
+            } else {
+                parser->state = JPEGPARSE_STATE_MARKER_CODE;
+            }
+            break;
+        case JPEGPARSE_STATE_DONE:
+            /* trailing bytes after EOI are ignored and not counted, so that
+             * offset is the size of the JPEG
+             */
+            return JPEGPARSE_OK;
+        case JPEGPARSE_STATE_ERROR:
+            return parser->error;
+        }
+
+        parser->offset += ptr - begin;
+    }
+
+    return JPEGPARSE_OK;
+}
+
+/* to be called after the last chunk */
+static inline enum jpegparse_result
+jpegparse_finish(struct jpegparse *parser)
+{
+    if (parser->state == JPEGPARSE_STATE_ERROR)
+        return parser->error;
+    if (parser->state != JPEGPARSE_STATE_DONE)
+        return jpegparse_fail(parser, JPEGPARSE_ERROR_TRUNCATED);
+    return JPEGPARSE_OK;
+}
+
+#endif /* JPEGPARSE_H */
@@ -0,0 +1,462 @@
+/*
+ * Copyright 2022 Google LLC
+ * SPDX-License-Identifier: MIT
+ */
+
+/*
+ * Decodes a JPEG, scales it with VPP and encodes the scaled surface as a
+ * JPEG again.  The pixels stay on the GPU; only the bitstreams pass through
+ * CPU memory.
+ */
+
+#include "jpegva.h"
+#include "vautil.h"
+
+#include <getopt.h>
+#include <libgen.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+/* the coded buffer holds the headers and at most 3 bytes per pixel */
+#define JPEGTRANSCODE_CODED_EXTRA (64 * 1024)
+
+struct jpegtranscode {
+    struct va_init_params params;
+    /* 0 for half of the input size */
+    int width;
+    int height;
+    int quality;
+    int iterations;
+    /* a file, or a directory that gets <name>-transcoded.jpg per input */
+    const char *output;
+    bool output_dir;
+    bool no_save;
+
+    struct va va;
+    bool packed_header;
+
+    VAConfigID dec_config;
+    VAConfigID vpp_config;
+    VAConfigID enc_config;
+
+    struct jpegparse parser;
+    struct jpegva_file file;
+    struct jpegva_picture picture;
+    struct jpegva_encode encode;
+
+    /* the size of the scaled and encoded image */
+    int dst_width;
+    int dst_height;
+
+    VASurfaceID src;
+    VASurfaceID dst;
+    VAContextID dec_context;
+    VAContextID vpp_context;
+    VAContextID enc_context;
+
+    VABufferID dec_bufs[5];
+    VAProcPipelineParameterBuffer pipeline;
+    VABufferID vpp_buf;
+    VABufferID coded_buf;
+    VABufferID enc_bufs[6];
+    int enc_buf_count;
+
+    int image_count;
+    uint64_t total_time;
+    uint64_t total_cpu_time;
+};
+
+static void
+jpegtranscode_init(struct jpegtranscode *xcode)
+{
+    struct va *va = &xcode->va;
+
+    va_init(va, &xcode->params);
+
+    if (!va_find_pair(va, VAProfileJPEGBaseline, VAEntrypointVLD))
+        va_die("no JPEG decode support");
+    if (!va_find_pair(va, VAProfileNone, VAEntrypointVideoProc))
+        va_die("no VPP support");
+    const struct va_pair *enc_pair = va_find_pair(va, VAProfileJPEGBaseline,
+                                                  VAEntrypointEncPicture);
+    if (!enc_pair)
+        va_die("no JPEG encode support");
+
+    /* without packed headers, drivers write their own */
+    const uint32_t packed_headers =
+        va_pair_get_attr(va, enc_pair, VAConfigAttribEncPackedHeaders);
+    xcode->packed_header = packed_headers != VA_ATTRIB_NOT_SUPPORTED &&
+                           (packed_headers & VA_ENC_PACKED_HEADER_RAW_DATA);
+
+    xcode->vpp_config =
+        va_create_config(va, VAProfileNone, VAEntrypointVideoProc, VA_RT_FORMAT_YUV420);
+    xcode->enc_config =
+        va_create_config(va, VAProfileJPEGBaseline, VAEntrypointEncPicture, VA_RT_FORMAT_YUV420);
+}
+
+static void
+jpegtranscode_cleanup(struct jpegtranscode *xcode)
+{
+    struct va *va = &xcode->va;
+
+    va_destroy_config(va, xcode->enc_config);
+    va_destroy_config(va, xcode->vpp_config);
+    va_cleanup(va);
+}
+
+static void
+jpegtranscode_prepare_decode(struct jpegtranscode *xcode)
+{
+    const struct jpegva_file *file = &xcode->file;
+    const struct jpegva_picture *pic = &xcode->picture;
+    struct va *va = &xcode->va;
+
+    /* VPP converts the decoded format to the nv12 that is encoded */
+    unsigned int rt_format;
+    unsigned int fourcc;
+    if (!jpegva_pick_decode_format(va, &file->frame, &rt_format, &fourcc)) {
+        va_die("%d components at %dx%d sampling have no surface format", file->frame.sof0.Nf,
+               file->frame.sof0.Hi[0], file->frame.sof0.Vi[0]);
+    }
+
+    xcode->dec_config = va_create_config(va, VAProfileJPEGBaseline, VAEntrypointVLD, rt_format);
+    xcode->src = va_create_surface(va, rt_format, file->frame.sof0.X, file->frame.sof0.Y, fourcc);
+    xcode->dec_context = va_create_context(va, xcode->dec_config, file->frame.sof0.X,
+                                           file->frame.sof0.Y, VA_PROGRESSIVE, &xcode->src, 1);
+
+    const VAContextID ctx = xcode->dec_context;
+    xcode->dec_bufs[0] = va_create_buffer(va, ctx, VAPictureParameterBufferType,
+                                          sizeof(pic->pic_param), &pic->pic_param);
+    xcode->dec_bufs[1] = va_create_buffer(va, ctx, VAIQMatrixBufferType,
+                                          sizeof(pic->iq_matrix), &pic->iq_matrix);
+    xcode->dec_bufs[2] = va_create_buffer(va, ctx, VAHuffmanTableBufferType,
+                                          sizeof(pic->huffman_table), &pic->huffman_table);
+    xcode->dec_bufs[3] = va_create_buffer(va, ctx, VASliceParameterBufferType,
+                                          sizeof(pic->slice_param), &pic->slice_param);
+    xcode->dec_bufs[4] =
+        va_create_buffer(va, ctx, VASliceDataBufferType, file->scan_size, file->scan);
+}
+
+static void
+jpegtranscode_prepare_scale(struct jpegtranscode *xcode)
+{
+    struct va *va = &xcode->va;
+
+    xcode->dst = va_create_surface(va, VA_RT_FORMAT_YUV420, xcode->dst_width,
+                                   xcode->dst_height, VA_FOURCC_NV12);
+    xcode->vpp_context = va_create_context(va, xcode->vpp_config, xcode->dst_width,
+                                           xcode->dst_height, VA_PROGRESSIVE, &xcode->dst, 1);
+
+    /* NULL regions are the whole surfaces */
+    xcode->pipeline = (VAProcPipelineParameterBuffer){
+        .surface = xcode->src,
+        .filter_flags = VA_FILTER_SCALING_HQ,
+    };
+    xcode->vpp_buf = va_create_buffer(va, xcode->vpp_context, VAProcPipelineParameterBufferType,
+                                      sizeof(xcode->pipeline), &xcode->pipeline);
+}
+
+static void
+jpegtranscode_prepare_encode(struct jpegtranscode *xcode)
+{
+    struct jpegva_encode *enc = &xcode->encode;
+    struct va *va = &xcode->va;
+
+    xcode->enc_context = va_create_context(va, xcode->enc_config, xcode->dst_width,
+                                           xcode->dst_height, VA_PROGRESSIVE, &xcode->dst, 1);
+
+    const VAContextID ctx = xcode->enc_context;
+    xcode->coded_buf =
+        va_create_buffer(va, ctx, VAEncCodedBufferType,
+                         xcode->dst_width * xcode->dst_height * 3 + JPEGTRANSCODE_CODED_EXTRA,
+                         NULL);
+
+    jpegva_init_encode(enc, xcode->dst, xcode->coded_buf, xcode->dst_width, xcode->dst_height,
+                       xcode->quality);
+
+    int count = 0;
+    xcode->enc_bufs[count++] = va_create_buffer(va, ctx, VAEncPictureParameterBufferType,
+                                                sizeof(enc->pic_param), &enc->pic_param);
+    xcode->enc_bufs[count++] =
+        va_create_buffer(va, ctx, VAQMatrixBufferType, sizeof(enc->q_matrix), &enc->q_matrix);
+    xcode->enc_bufs[count++] = va_create_buffer(va, ctx, VAHuffmanTableBufferType,
+                                                sizeof(enc->huffman_table), &enc->huffman_table);
+    xcode->enc_bufs[count++] = va_create_buffer(va, ctx, VAEncSliceParameterBufferType,
+                                                sizeof(enc->slice_param), &enc->slice_param);
+
+    if (xcode->packed_header) {
+        const VAEncPackedHeaderParameterBuffer packed = {
+            .type = VAEncPackedHeaderRawData,
+            .bit_length = enc->header_size * 8,
+        };
+        xcode->enc_bufs[count++] = va_create_buffer(va, ctx, VAEncPackedHeaderParameterBufferType,
+                                                    sizeof(packed), &packed);
+        xcode->enc_bufs[count++] = va_create_buffer(va, ctx, VAEncPackedHeaderDataBufferType,
+                                                    enc->header_size, enc->header);
+    }
+
+    assert(count <= (int)ARRAY_SIZE(xcode->enc_bufs));
+    xcode->enc_buf_count = count;
+}
+
+static void
+jpegtranscode_release(struct jpegtranscode *xcode)
+{
+    struct va *va = &xcode->va;
+
+    for (int i = 0; i < xcode->enc_buf_count; i++)
+        va_destroy_buffer(va, xcode->enc_bufs[i]);
+    va_destroy_buffer(va, xcode->coded_buf);
+    va_destroy_context(va, xcode->enc_context);
+
+    va_destroy_buffer(va, xcode->vpp_buf);
+    va_destroy_context(va, xcode->vpp_context);
+    va_destroy_surface(va, xcode->dst);
+
+    for (int i = 0; i < (int)ARRAY_SIZE(xcode->dec_bufs); i++)
+        va_destroy_buffer(va, xcode->dec_bufs[i]);
+    va_destroy_context(va, xcode->dec_context);
+    va_destroy_surface(va, xcode->src);
+    va_destroy_config(va, xcode->dec_config);
+
+    va_unmap_file(va, xcode->file.ptr, xcode->file.size);
+    memset(&xcode->file, 0, sizeof(xcode->file));
+}
+
+/* submits all three stages and waits only for the last one */
+static void
+jpegtranscode_submit(struct jpegtranscode *xcode)
+{
+    struct va *va = &xcode->va;
+
+    va_trace_begin(va, "decode");
+    va_begin_picture(va, xcode->dec_context, xcode->src);
+    va_render_picture(va, xcode->dec_context, xcode->dec_bufs, ARRAY_SIZE(xcode->dec_bufs));
+    va_end_picture(va, xcode->dec_context);
+    va_trace_end(va, "decode");
+
+    va_trace_begin(va, "scale");
+    va_begin_picture(va, xcode->vpp_context, xcode->dst);
+    va_render_picture(va, xcode->vpp_context, &xcode->vpp_buf, 1);
+    va_end_picture(va, xcode->vpp_context);
+    va_trace_end(va, "scale");
+
+    va_trace_begin(va, "encode");
+    va_begin_picture(va, xcode->enc_context, xcode->dst);
+    va_render_picture(va, xcode->enc_context, xcode->enc_bufs, xcode->enc_buf_count);
+    va_end_picture(va, xcode->enc_context);
+    va_trace_end(va, "encode");
+
+    va_trace_begin(va, "sync");
+    va_sync_surface(va, xcode->dst);
+    va_trace_end(va, "sync");
+}
+
+/* walks the coded segments, writing them to fp when not NULL, and returns
+ * the coded size
+ */
+static size_t
+jpegtranscode_read_coded(struct jpegtranscode *xcode, FILE *fp)
+{
+    struct va *va = &xcode->va;
+
+    size_t size = 0;
+    const VACodedBufferSegment *seg = va_map_buffer(va, xcode->coded_buf);
+    for (; seg; seg = seg->next) {
+        if (seg->status & VA_CODED_BUF_STATUS_SLICE_OVERFLOW_MASK)
+            va_die("coded buffer overflow");
+        if (fp && fwrite(seg->buf, 1, seg->size, fp) != seg->size)
+            va_die("failed to write coded data");
+        size += seg->size;
+    }
+    va_unmap_buffer(va, xcode->coded_buf);
+
+    return size;
+}
+
+static void
+jpegtranscode_save(struct jpegtranscode *xcode, const char *filename)
+{
+    FILE *fp = fopen(filename, "w");
+    if (!fp)
+        va_die("failed to open %s", filename);
+    jpegtranscode_read_coded(xcode, fp);
+    fclose(fp);
+}
+
+/* writes the output of filename to --output, or to
+ * <output>/<name>-transcoded.jpg when --output is a directory
+ */
+static void
+jpegtranscode_output_path(const struct jpegtranscode *xcode,
+                          const char *filename,
+                          char *path,
+                          size_t size)
+{
+    if (!xcode->output_dir) {
+        snprintf(path, size, "%s", xcode->output);
+        return;
+    }
+
+    char *name = strdup(filename);
+    if (!name)
+        va_die("failed to dup filename");
+    char *base = basename(name);
+    char *ext = strrchr(base, '.');
+    if (ext)
+        *ext = '\0';
+
+    snprintf(path, size, "%s/%s-transcoded.jpg", xcode->output, base);
+    free(name);
+}
+
+static void
+jpegtranscode_file(struct jpegtranscode *xcode, const char *filename)
+{
+    struct jpegva_file *file = &xcode->file;
+    struct va *va = &xcode->va;
+
+    va_trace_begin(va, "parse");
+    file->ptr = va_map_file(va, filename, &file->size);
+    const enum jpegparse_result result = jpegva_parse_file(&xcode->parser, file);
+    if (result != JPEGPARSE_OK) {
+        va_die("failed to parse %s at offset %" PRIu64 ": %s", filename, xcode->parser.offset,
+               jpegparse_result_str(result));
+    }
+    jpegva_init_picture(&xcode->picture, file);
+    va_trace_end(va, "parse");
+
+    if (xcode->width) {
+        xcode->dst_width = xcode->width;
+        xcode->dst_height = xcode->height;
+    } else {
+        xcode->dst_width = MAX2((file->frame.sof0.X / 2 + 1) & ~1, 2);
+        xcode->dst_height = MAX2((file->frame.sof0.Y / 2 + 1) & ~1, 2);
+    }
+
+    va_trace_begin(va, "prepare");
+    jpegtranscode_prepare_decode(xcode);
+    jpegtranscode_prepare_scale(xcode);
+    jpegtranscode_prepare_encode(xcode);
+    va_trace_end(va, "prepare");
+
+    uint64_t time = 0;
+    uint64_t cpu_time = 0;
+    size_t coded_size = 0;
+    for (int i = 0; i < xcode->iterations; i++) {
+        const uint64_t begin = va_now();
+        const uint64_t cpu_begin = va_thread_cpu_now();
+
+        jpegtranscode_submit(xcode);
+        coded_size = jpegtranscode_read_coded(xcode, NULL);
+
+        time += va_now() - begin;
+        cpu_time += va_thread_cpu_now() - cpu_begin;
+    }
+
+    va_log("%s: %dx%d -> %dx%d, %zu -> %zu bytes, %.3f ms, cpu %.3f ms", filename,
+           file->frame.sof0.X, file->frame.sof0.Y, xcode->dst_width, xcode->dst_height,
+           file->size, coded_size, time / 1e6 / xcode->iterations,
+           cpu_time / 1e6 / xcode->iterations);
+
+    xcode->image_count += xcode->iterations;
+    xcode->total_time += time;
+    xcode->total_cpu_time += cpu_time;
+
+    if (!xcode->no_save) {
+        char path[PATH_MAX];
+        jpegtranscode_output_path(xcode, filename, path, sizeof(path));
+        va_trace_begin(va, "save");
+        jpegtranscode_save(xcode, path);
+        va_trace_end(va, "save");
+    }
+
+    jpegtranscode_release(xcode);
+}
+
+static void
+jpegtranscode_report(const struct jpegtranscode *xcode)
+{
+    if (!xcode->image_count)
+        return;
+
+    va_log("%d images: %.1f images/s, cpu %.3f ms per image", xcode->image_count,
+           xcode->image_count / (xcode->total_time / 1e9),
+           xcode->total_cpu_time / 1e6 / xcode->image_count);
+}
+
+int
+main(int argc, char **argv)
+{
+    struct jpegtranscode xcode = {
+        .quality = 75,
+        .iterations = 1,
+    };
+
+    static const struct option options[] = {
+        { "stats", no_argument, NULL, 's' },
+        { "trace", required_argument, NULL, 't' },
+        { "size", required_argument, NULL, 'z' },
+        { "quality", required_argument, NULL, 'Q' },
+        { "iterations", required_argument, NULL, 'n' },
+        { "output", required_argument, NULL, 'o' },
+        { "no-save", no_argument, NULL, 'q' },
+        { 0 },
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "st:z:Q:n:o:q", options, NULL)) != -1) {
+        switch (opt) {
+        case 's':
+            xcode.params.stats = true;
+            break;
+        case 't':
+            xcode.params.trace_file = optarg;
+            break;
+        case 'z':
+            if (sscanf(optarg, "%dx%d", &xcode.width, &xcode.height) != 2 || xcode.width <= 0 ||
+                xcode.height <= 0)
+                va_die("invalid size %s", optarg);
+            break;
+        case 'Q':
+            xcode.quality = atoi(optarg);
+            if (xcode.quality < 1 || xcode.quality > 100)
+                va_die("invalid quality %s", optarg);
+            break;
+        case 'n':
+            xcode.iterations = atoi(optarg);
+            if (xcode.iterations < 1)
+                va_die("invalid iterations %s", optarg);
+            break;
+        case 'o':
+            xcode.output = optarg;
+            break;
+        case 'q':
+            xcode.no_save = true;
+            break;
+        default:
+            va_die("usage: %s [--stats] [--trace <file>] [--size <w>x<h>] [--quality <1-100>] "
+                   "[--iterations <n>] [--output <file>|<dir>] [--no-save] <file>...",
+                   argv[0]);
+        }
+    }
+
+    /* several inputs would overwrite a single output file */
+    const bool several = argc - optind > 1;
+    struct stat st;
+    if (!xcode.output)
+        xcode.output = several ? "." : "transcoded.jpg";
+    xcode.output_dir = !stat(xcode.output, &st) && S_ISDIR(st.st_mode);
+    if (several && !xcode.no_save && !xcode.output_dir)
+        va_die("--output must be a directory with several inputs");
+
+    jpegtranscode_init(&xcode);
+
+    for (int i = optind; i < argc; i++)
+        jpegtranscode_file(&xcode, argv[i]);
+
+    jpegtranscode_report(&xcode);
+
+    jpegtranscode_cleanup(&xcode);
+
+    return 0;
+}
@@ -0,0 +1,505 @@
+/*
+ * Copyright 2022 Google LLC
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef JPEGVA_H
+#define JPEGVA_H
+
+/*
+ * Baseline JPEG on VA.  Decode parameter buffers are filled from a file
+ * parsed by jpegparse, and encode parameter buffers and the packed headers
+ * use the ITU T.81 Annex K tables.
+ */
+
+#include "jpegparse.h"
+#include "swjpeg.h"
+#include "vautil.h"
+
+/* SOI, APP0, DQT, SOF0, DHT and SOS of a 3-component image */
+#define JPEGVA_HEADER_MAX 1024
+
+/* a mapped single-scan JPEG */
+struct jpegva_file {
+    const void *ptr;
+    size_t size;
+
+    struct jpegparse_frame frame;
+
+    const void *scan;
+    int scan_size;
+
+    /* set by the parser callbacks */
+    enum jpegparse_result error;
+};
+
+struct jpegva_picture {
+    VAPictureParameterBufferJPEGBaseline pic_param;
+    VAIQMatrixBufferJPEGBaseline iq_matrix;
+    VAHuffmanTableBufferJPEGBaseline huffman_table;
+    VASliceParameterBufferJPEGBaseline slice_param;
+};
+
+struct jpegva_encode {
+    VAEncPictureParameterBufferJPEG pic_param;
+    VAQMatrixBufferJPEG q_matrix;
+    VAHuffmanTableBufferJPEGBaseline huffman_table;
+    VAEncSliceParameterBufferJPEG slice_param;
+
+    /* everything before the entropy-coded data */
+    uint8_t header[JPEGVA_HEADER_MAX];
+    uint32_t header_size;
+};
+
+/* ITU T.81 Annex K, in natural order */
+static const uint8_t jpegva_std_quant[2][64] = {
+    {
+        16, 11, 10, 16, 24,  40,  51,  61,  12, 12, 14, 19, 26,  58,  60,  55,
+        14, 13, 16, 24, 40,  57,  69,  56,  14, 17, 22, 29, 51,  87,  80,  62,
+        18, 22, 37, 56, 68,  109, 103, 77,  24, 35, 55, 64, 81,  104, 113, 92,
+        49, 64, 78, 87, 103, 121, 120, 101, 72, 92, 95, 98, 112, 100, 103, 99,
+    },
+    {
+        17, 18, 24, 47, 99, 99, 99, 99, 18, 21, 26, 66, 99, 99, 99, 99,
+        24, 26, 56, 99, 99, 99, 99, 99, 47, 66, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99,
+    },
+};
+
+static const uint8_t jpegva_std_dc_bits[2][16] = {
+    { 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 },
+};
+
+static const uint8_t jpegva_std_dc_values[12] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+
+static const uint8_t jpegva_std_ac_bits[2][16] = {
+    { 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d },
+    { 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 },
+};
+
+static const uint8_t jpegva_std_ac_values[2][162] = {
+    {
+        0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51,
+        0x61, 0x07, 0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1,
+        0x15, 0x52, 0xd1, 0xf0, 0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18,
+        0x19, 0x1a, 0x25, 0x26, 0x27, 0x28, 0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39,
+        0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57,
+        0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74, 0x75,
+        0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8a, 0x92,
+        0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+        0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+        0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8,
+        0xd9, 0xda, 0xe1, 0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2,
+        0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa,
+    },
+    {
+        0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07,
+        0x61, 0x71, 0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09,
+        0x23, 0x33, 0x52, 0xf0, 0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25,
+        0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26, 0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38,
+        0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56,
+        0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74,
+        0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+        0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+        0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba,
+        0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6,
+        0xd7, 0xd8, 0xd9, 0xda, 0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2,
+        0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa,
+    },
+};
+
+/* the Annex K tables with the IJG quality scaling, in zigzag order */
+static inline void
+jpegva_scale_quant(int quality, uint8_t quant[2][64])
+{
+    const int scale = quality < 50 ? 5000 / quality : 200 - quality * 2;
+
+    for (int t = 0; t < 2; t++) {
+        for (int k = 0; k < 64; k++) {
+            const int q = (jpegva_std_quant[t][swjpeg_zigzag[k]] * scale + 50) / 100;
+            quant[t][k] = MIN2(MAX2(q, 1), 255);
+        }
+    }
+}
+
+static inline void
+jpegva_parse_frame(void *data, const struct jpegparse_frame *frame)
+{
+    struct jpegva_file *file = data;
+
+    /* no multi-scan support */
+    if (file->scan) {
+        file->error = JPEGPARSE_ERROR_UNSUPPORTED;
+        return;
+    }
+    file->frame = *frame;
+}
+
+static inline void
+jpegva_parse_scan(void *data, const uint8_t *chunk, size_t size)
+{
+    struct jpegva_file *file = data;
+
+    /* chunks of a single feed are contiguous */
+    if (file->error)
+        return;
+    if (!file->scan)
+        file->scan = chunk;
+    else if ((const uint8_t *)file->scan + file->scan_size != chunk)
+        file->error = JPEGPARSE_ERROR_BAD_SEGMENT;
+    file->scan_size += size;
+}
+
+/* rejects tables that VA cannot take */
+static inline enum jpegparse_result
+jpegva_check_tables(const struct jpegparse_frame *frame)
+{
+    const VAHuffmanTableBufferJPEGBaseline *huffman_table = NULL;
+
+    for (int Tq = 0; Tq < JPEGPARSE_MAX_TABLES; Tq++) {
+        /* no 16-bit Q support */
+        if (frame->dqt.loaded[Tq] && frame->dqt.Pq[Tq])
+            return JPEGPARSE_ERROR_UNSUPPORTED;
+    }
+
+    for (int Th = 0; Th < JPEGPARSE_MAX_TABLES; Th++) {
+        if (!frame->dht.loaded[0][Th] && !frame->dht.loaded[1][Th])
+            continue;
+        if (Th >= (int)ARRAY_SIZE(huffman_table->huffman_table))
+            return JPEGPARSE_ERROR_UNSUPPORTED;
+        if (frame->dht.Vij_sizes[0][Th] > 12 || frame->dht.Vij_sizes[1][Th] > 162)
+            return JPEGPARSE_ERROR_BAD_SEGMENT;
+    }
+
+    return JPEGPARSE_OK;
+}
+
+/* parses file->ptr; parser is only scratch space and has the offset of
+ * parse errors
+ */
+static inline enum jpegparse_result
+jpegva_parse_file(struct jpegparse *parser, struct jpegva_file *file)
+{
+    static const struct jpegparse_callbacks callbacks = {
+        .frame = jpegva_parse_frame,
+        .scan = jpegva_parse_scan,
+    };
+
+    file->scan = NULL;
+    file->scan_size = 0;
+    file->error = JPEGPARSE_OK;
+
+    jpegparse_init(parser, &callbacks, file);
+    enum jpegparse_result result = jpegparse_feed(parser, file->ptr, file->size);
+    if (result == JPEGPARSE_OK)
+        result = jpegparse_finish(parser);
+    if (result == JPEGPARSE_OK)
+        result = file->error;
+    if (result == JPEGPARSE_OK && !file->scan)
+        result = JPEGPARSE_ERROR_MISSING_SEGMENT;
+    if (result == JPEGPARSE_OK)
+        result = jpegva_check_tables(&file->frame);
+
+    return result;
+}
+
+/* the MCU of a single-component scan is one block, otherwise it spans the
+ * largest sampling factors
+ */
+static inline void
+jpegva_mcu_size(const struct jpegparse_frame *frame, int *width, int *height)
+{
+    int hmax = 1;
+    int vmax = 1;
+    if (frame->sof0.Nf > 1) {
+        for (int i = 0; i < frame->sof0.Nf; i++) {
+            hmax = MAX2(hmax, frame->sof0.Hi[i]);
+            vmax = MAX2(vmax, frame->sof0.Vi[i]);
+        }
+    }
+
+    *width = hmax * 8;
+    *height = vmax * 8;
+}
+
+/* picks the render target format and the surface fourcc that hold the
+ * frame without resampling, or returns false when there are none
+ */
+static inline bool
+jpegva_pick_format(const struct jpegparse_frame *frame,
+                   unsigned int *rt_format,
+                   unsigned int *fourcc)
+{
+    static const struct {
+        /* luma sampling factors over chroma sampling factors */
+        int h;
+        int v;
+        unsigned int rt_format;
+        unsigned int fourcc;
+    } formats[] = {
+        { 2, 2, VA_RT_FORMAT_YUV420, VA_FOURCC_NV12 },
+        { 2, 1, VA_RT_FORMAT_YUV422, VA_FOURCC_422H },
+        { 1, 2, VA_RT_FORMAT_YUV422, VA_FOURCC_422V },
+        { 1, 1, VA_RT_FORMAT_YUV444, VA_FOURCC_444P },
+        { 4, 1, VA_RT_FORMAT_YUV411, VA_FOURCC_411P },
+    };
+    const int *H = frame->sof0.Hi;
+    const int *V = frame->sof0.Vi;
+
+    if (frame->sof0.Nf == 1) {
+        *rt_format = VA_RT_FORMAT_YUV400;
+        *fourcc = VA_FOURCC_Y800;
+        return true;
+    }
+
+    if (frame->sof0.Nf != 3 || H[1] != H[2] || V[1] != V[2] || H[0] % H[1] || V[0] % V[1])
+        return false;
+
+    for (size_t i = 0; i < ARRAY_SIZE(formats); i++) {
+        if (H[0] / H[1] == formats[i].h && V[0] / V[1] == formats[i].v) {
+            *rt_format = formats[i].rt_format;
+            *fourcc = formats[i].fourcc;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* picks the decode surface format of the frame, or returns false when this
+ * driver lacks it; pairs that do not report VAConfigAttribRTFormat are
+ * assumed to support 4:2:0 only
+ */
+static inline bool
+jpegva_pick_decode_format(struct va *va,
+                          const struct jpegparse_frame *frame,
+                          unsigned int *rt_format,
+                          unsigned int *fourcc)
+{
+    if (!jpegva_pick_format(frame, rt_format, fourcc))
+        return false;
+
+    unsigned int rt_formats = VA_RT_FORMAT_YUV420;
+    const struct va_pair *pair = va_find_pair(va, VAProfileJPEGBaseline, VAEntrypointVLD);
+    if (pair && va_pair_has_attr(pair, VAConfigAttribRTFormat))
+        rt_formats = va_pair_get_attr(va, pair, VAConfigAttribRTFormat);
+
+    return rt_formats & *rt_format;
+}
+
+/* the file must have passed jpegva_parse_file */
+static inline void
+jpegva_init_picture(struct jpegva_picture *pic, const struct jpegva_file *file)
+{
+    const struct jpegparse_frame *frame = &file->frame;
+
+    VAPictureParameterBufferJPEGBaseline pic_param = {
+        .picture_width = frame->sof0.X,
+        .picture_height = frame->sof0.Y,
+        .num_components = frame->sof0.Nf,
+    };
+    for (int i = 0; i < frame->sof0.Nf; i++) {
+        pic_param.components[i].component_id = frame->sof0.Ci[i];
+        pic_param.components[i].h_sampling_factor = frame->sof0.Hi[i];
+        pic_param.components[i].v_sampling_factor = frame->sof0.Vi[i];
+        pic_param.components[i].quantiser_table_selector = frame->sof0.Tqi[i];
+    }
+
+    VAIQMatrixBufferJPEGBaseline iq_matrix = { 0 };
+    for (int Tq = 0; Tq < JPEGPARSE_MAX_TABLES; Tq++) {
+        if (!frame->dqt.loaded[Tq])
+            continue;
+
+        iq_matrix.load_quantiser_table[Tq] = 1;
+        for (int k = 0; k < 64; k++)
+            iq_matrix.quantiser_table[Tq][k] = frame->dqt.Qk[Tq][k];
+    }
+
+    VAHuffmanTableBufferJPEGBaseline huffman_table = { 0 };
+    for (int Th = 0; Th < JPEGPARSE_MAX_TABLES; Th++) {
+        const bool dc = frame->dht.loaded[0][Th];
+        const bool ac = frame->dht.loaded[1][Th];
+        if (!dc && !ac)
+            continue;
+
+        huffman_table.load_huffman_table[Th] = 1;
+        if (dc) {
+            memcpy(huffman_table.huffman_table[Th].num_dc_codes, frame->dht.Li[0][Th], 16);
+            memcpy(huffman_table.huffman_table[Th].dc_values, frame->dht.Vij[0][Th],
+                   frame->dht.Vij_sizes[0][Th]);
+        }
+        if (ac) {
+            memcpy(huffman_table.huffman_table[Th].num_ac_codes, frame->dht.Li[1][Th], 16);
+            memcpy(huffman_table.huffman_table[Th].ac_values, frame->dht.Vij[1][Th],
+                   frame->dht.Vij_sizes[1][Th]);
+        }
+    }
+
+    VASliceParameterBufferJPEGBaseline slice_param = {
+        .slice_data_size = file->scan_size,
+        .slice_data_flag = VA_SLICE_DATA_FLAG_ALL,
+        .num_components = frame->sos.Ns,
+    };
+    for (int i = 0; i < frame->sos.Ns; i++) {
+        slice_param.components[i].component_selector = frame->sos.Csj[i];
+        slice_param.components[i].dc_table_selector = frame->sos.Tdj[i];
+        slice_param.components[i].ac_table_selector = frame->sos.Taj[i];
+    }
+    slice_param.restart_interval = frame->dri.Ri;
+
+    int mcu_width;
+    int mcu_height;
+    jpegva_mcu_size(frame, &mcu_width, &mcu_height);
+    const int mcu_cols = (frame->sof0.X + mcu_width - 1) / mcu_width;
+    const int mcu_rows = (frame->sof0.Y + mcu_height - 1) / mcu_height;
+    slice_param.num_mcus = mcu_cols * mcu_rows;
+
+    pic->pic_param = pic_param;
+    pic->iq_matrix = iq_matrix;
+    pic->huffman_table = huffman_table;
+    pic->slice_param = slice_param;
+}
+
+static inline void
+jpegva_put_byte(struct jpegva_encode *enc, uint8_t byte)
+{
+    assert(enc->header_size < sizeof(enc->header));
+    enc->header[enc->header_size++] = byte;
+}
+
+static inline void
+jpegva_put_be16(struct jpegva_encode *enc, int val)
+{
+    jpegva_put_byte(enc, val >> 8);
+    jpegva_put_byte(enc, val & 0xff);
+}
+
+/* a negative payload_size writes a marker without a length */
+static inline void
+jpegva_put_marker(struct jpegva_encode *enc, int marker, int payload_size)
+{
+    jpegva_put_byte(enc, 0xff);
+    jpegva_put_byte(enc, marker);
+    if (payload_size >= 0)
+        jpegva_put_be16(enc, payload_size + 2);
+}
+
+/* a 4:2:0 encode of the surface into coded_buf; drivers scale q_matrix by
+ * the quality, which the header tables match
+ */
+static inline void
+jpegva_init_encode(struct jpegva_encode *enc,
+                   VASurfaceID surface,
+                   VABufferID coded_buf,
+                   int width,
+                   int height,
+                   int quality)
+{
+    static const struct {
+        int h;
+        int v;
+        int table;
+    } comps[3] = { { 2, 2, 0 }, { 1, 1, 1 }, { 1, 1, 1 } };
+
+    memset(enc, 0, sizeof(*enc));
+
+    enc->pic_param = (VAEncPictureParameterBufferJPEG){
+        .reconstructed_picture = surface,
+        .picture_width = width,
+        .picture_height = height,
+        .coded_buf = coded_buf,
+        .pic_flags.bits = {
+            .huffman = 1,
+            .interleaved = 1,
+        },
+        .sample_bit_depth = 8,
+        .num_scan = 1,
+        .num_components = 3,
+        .quality = quality,
+    };
+
+    enc->q_matrix.load_lum_quantiser_matrix = 1;
+    enc->q_matrix.load_chroma_quantiser_matrix = 1;
+    for (int k = 0; k < 64; k++) {
+        enc->q_matrix.lum_quantiser_matrix[k] = jpegva_std_quant[0][swjpeg_zigzag[k]];
+        enc->q_matrix.chroma_quantiser_matrix[k] = jpegva_std_quant[1][swjpeg_zigzag[k]];
+    }
+
+    enc->slice_param.num_components = 3;
+    for (int i = 0; i < 3; i++) {
+        enc->pic_param.component_id[i] = i + 1;
+        enc->pic_param.quantiser_table_selector[i] = comps[i].table;
+        enc->slice_param.components[i].component_selector = i + 1;
+        enc->slice_param.components[i].dc_table_selector = comps[i].table;
+        enc->slice_param.components[i].ac_table_selector = comps[i].table;
+    }
+
+    for (int t = 0; t < 2; t++) {
+        enc->huffman_table.load_huffman_table[t] = 1;
+        memcpy(enc->huffman_table.huffman_table[t].num_dc_codes, jpegva_std_dc_bits[t], 16);
+        memcpy(enc->huffman_table.huffman_table[t].dc_values, jpegva_std_dc_values,
+               sizeof(jpegva_std_dc_values));
+        memcpy(enc->huffman_table.huffman_table[t].num_ac_codes, jpegva_std_ac_bits[t], 16);
+        memcpy(enc->huffman_table.huffman_table[t].ac_values, jpegva_std_ac_values[t],
+               sizeof(jpegva_std_ac_values[t]));
+    }
+
+    jpegva_put_marker(enc, 0xd8, -1);
+
+    /* JFIF 1.01, no density, no thumbnail */
+    static const uint8_t jfif[] = { 'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0 };
+    jpegva_put_marker(enc, 0xe0, sizeof(jfif));
+    for (size_t i = 0; i < sizeof(jfif); i++)
+        jpegva_put_byte(enc, jfif[i]);
+
+    uint8_t quant[2][64];
+    jpegva_scale_quant(quality, quant);
+    jpegva_put_marker(enc, 0xdb, 65 * 2);
+    for (int t = 0; t < 2; t++) {
+        jpegva_put_byte(enc, t);
+        for (int k = 0; k < 64; k++)
+            jpegva_put_byte(enc, quant[t][k]);
+    }
+
+    jpegva_put_marker(enc, 0xc0, 6 + 3 * 3);
+    jpegva_put_byte(enc, 8);
+    jpegva_put_be16(enc, height);
+    jpegva_put_be16(enc, width);
+    jpegva_put_byte(enc, 3);
+    for (int i = 0; i < 3; i++) {
+        jpegva_put_byte(enc, i + 1);
+        jpegva_put_byte(enc, comps[i].h << 4 | comps[i].v);
+        jpegva_put_byte(enc, comps[i].table);
+    }
+
+    const int dht_size = 2 * 17 + sizeof(jpegva_std_dc_values) + sizeof(jpegva_std_ac_values[0]);
+    jpegva_put_marker(enc, 0xc4, 2 * dht_size);
+    for (int t = 0; t < 2; t++) {
+        jpegva_put_byte(enc, 0 << 4 | t);
+        for (int i = 0; i < 16; i++)
+            jpegva_put_byte(enc, jpegva_std_dc_bits[t][i]);
+        for (size_t i = 0; i < sizeof(jpegva_std_dc_values); i++)
+            jpegva_put_byte(enc, jpegva_std_dc_values[i]);
+
+        jpegva_put_byte(enc, 1 << 4 | t);
+        for (int i = 0; i < 16; i++)
+            jpegva_put_byte(enc, jpegva_std_ac_bits[t][i]);
+        for (size_t i = 0; i < sizeof(jpegva_std_ac_values[t]); i++)
+            jpegva_put_byte(enc, jpegva_std_ac_values[t][i]);
+    }
+
+    jpegva_put_marker(enc, 0xda, 4 + 2 * 3);
+    jpegva_put_byte(enc, 3);
+    for (int i = 0; i < 3; i++) {
+        jpegva_put_byte(enc, i + 1);
+        jpegva_put_byte(enc, comps[i].table << 4 | comps[i].table);
+    }
+    /* Ss, Se, Ah and Al of a sequential scan */
+    jpegva_put_byte(enc, 0);
+    jpegva_put_byte(enc, 63);
+    jpegva_put_byte(enc, 0);
+}
+
+#endif /* JPEGVA_H */
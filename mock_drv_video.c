@@ -0,0 +1,1541 @@
+/*
+ * Copyright 2022 Google LLC
+ * SPDX-License-Identifier: MIT
+ */
+
+/*
+ * A mock VA driver for hosts without a GPU.  It decodes
+ * VAProfileJPEGBaseline/VAEntrypointVLD on the cpu with swjpeg, into NV12
+ * surfaces or into planar 4:2:2, 4:4:4, 4:1:1 and Y800 surfaces that keep the
+ * sampling of the jpeg, and implements the configs, surfaces, buffers and
+ * images that the tests use.  Load it with
+ *
+ *   LIBVA_DRIVER_NAME=mock LIBVA_DRIVERS_PATH=<builddir>
+ *
+ * libva still opens a DRM render node, which vgem provides on hosts without
+ * a GPU.  The driver is tuned with these environment variables:
+ *
+ *   MOCK_DRV_LATENCY_US: time from vaEndPicture until the surface is ready
+ *   MOCK_DRV_THREADS: swjpeg threads per decode, 1 by default
+ *   MOCK_DRV_MAX_SIZE: max surface size as <width>x<height>
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <va/va_backend.h>
+
+#include "swjpeg.h"
+
+#define MOCK_VENDOR "mock VA driver (swjpeg)"
+#define MOCK_DEFAULT_MAX_SIZE 16384
+#define MOCK_PITCH_ALIGN 64
+#define MOCK_HEIGHT_ALIGN 16
+
+#define MOCK_ALIGN(v, a) (((v) + (a)-1) & ~((a)-1))
+
+enum mock_object_type {
+    MOCK_OBJECT_CONFIG,
+    MOCK_OBJECT_SURFACE,
+    MOCK_OBJECT_CONTEXT,
+    MOCK_OBJECT_BUFFER,
+    MOCK_OBJECT_IMAGE,
+};
+
+struct mock_config {
+    VAProfile profile;
+    VAEntrypoint entrypoint;
+    unsigned int rt_format;
+};
+
+struct mock_format {
+    unsigned int rt_format;
+    unsigned int fourcc;
+    int bits_per_pixel;
+    /* NV12 interleaves both chroma planes in one */
+    int plane_count;
+    /* chroma subsampling */
+    int sx;
+    int sy;
+};
+
+struct mock_surface {
+    unsigned int width;
+    unsigned int height;
+
+    /* user pointer surfaces are NV12 and do not own the data */
+    const struct mock_format *format;
+    uint8_t *data;
+    bool owned;
+    uint32_t pitches[3];
+    uint32_t offsets[3];
+
+    /* CLOCK_MONOTONIC time at which the last decode completes */
+    uint64_t ready_ns;
+    VAStatus decode_status;
+};
+
+struct mock_context {
+    VAConfigID config;
+
+    bool in_picture;
+    VASurfaceID target;
+
+    /* buffers rendered since vaBeginPicture */
+    VABufferID *bufs;
+    int buf_count;
+    int buf_max;
+};
+
+struct mock_buffer {
+    VABufferType type;
+    unsigned int size;
+    unsigned int num_elements;
+    uint8_t *data;
+};
+
+struct mock_object {
+    enum mock_object_type type;
+    union {
+        struct mock_config config;
+        struct mock_surface surface;
+        struct mock_context context;
+        struct mock_buffer buffer;
+        VAImage image;
+    };
+};
+
+struct mock_driver {
+    pthread_mutex_t mutex;
+
+    /* object ids are indices plus one */
+    struct mock_object **objects;
+    int object_count;
+    int object_max;
+
+    uint64_t latency_ns;
+    int thread_count;
+    int max_width;
+    int max_height;
+};
+
+/* the first format of each render target format is its default */
+static const struct mock_format mock_formats[] = {
+    { VA_RT_FORMAT_YUV420, VA_FOURCC_NV12, 12, 2, 2, 2 },
+    { VA_RT_FORMAT_YUV422, VA_FOURCC_422H, 16, 3, 2, 1 },
+    { VA_RT_FORMAT_YUV422, VA_FOURCC_422V, 16, 3, 1, 2 },
+    { VA_RT_FORMAT_YUV444, VA_FOURCC_444P, 24, 3, 1, 1 },
+    { VA_RT_FORMAT_YUV411, VA_FOURCC_411P, 12, 3, 4, 1 },
+    { VA_RT_FORMAT_YUV400, VA_FOURCC_Y800, 8, 1, 1, 1 },
+};
+
+#define MOCK_FORMAT_COUNT ((int)(sizeof(mock_formats) / sizeof(mock_formats[0])))
+#define MOCK_RT_FORMATS                                                                     \
+    (VA_RT_FORMAT_YUV420 | VA_RT_FORMAT_YUV422 | VA_RT_FORMAT_YUV444 | VA_RT_FORMAT_YUV411 | \
+     VA_RT_FORMAT_YUV400)
+
+/* a fourcc of 0 matches the default format of rt_format, and an rt_format of
+ * 0 matches any
+ */
+static const struct mock_format *
+mock_find_format(unsigned int rt_format, unsigned int fourcc)
+{
+    for (int i = 0; i < MOCK_FORMAT_COUNT; i++) {
+        const struct mock_format *fmt = &mock_formats[i];
+        if ((!rt_format || fmt->rt_format == rt_format) &&
+            (!fourcc || fmt->fourcc == fourcc))
+            return fmt;
+    }
+    return NULL;
+}
+
+static VAImageFormat
+mock_image_format(const struct mock_format *fmt)
+{
+    return (VAImageFormat){
+        .fourcc = fmt->fourcc,
+        .byte_order = VA_LSB_FIRST,
+        .bits_per_pixel = fmt->bits_per_pixel,
+    };
+}
+
+/* fills the plane layout of a width x height picture and returns its size */
+static uint32_t
+mock_layout(const struct mock_format *fmt,
+            uint32_t width,
+            uint32_t height,
+            uint32_t height_align,
+            uint32_t *pitches,
+            uint32_t *offsets)
+{
+    const uint32_t aligned_height = MOCK_ALIGN(height, height_align);
+
+    pitches[0] = MOCK_ALIGN(width, MOCK_PITCH_ALIGN);
+    offsets[0] = 0;
+    uint32_t size = pitches[0] * aligned_height;
+    for (int i = 1; i < fmt->plane_count; i++) {
+        const uint32_t bytes = (width + fmt->sx - 1) / fmt->sx * (fmt->plane_count == 2 ? 2 : 1);
+        pitches[i] = MOCK_ALIGN(bytes, MOCK_PITCH_ALIGN);
+        offsets[i] = size;
+        size += pitches[i] * ((aligned_height + fmt->sy - 1) / fmt->sy);
+    }
+
+    return size;
+}
+
+/* the bytes of a plane that cover the width x height rectangle at (x, y);
+ * x and y are even
+ */
+static void
+mock_plane_rect(const struct mock_format *fmt,
+                int plane,
+                uint32_t x,
+                uint32_t y,
+                uint32_t width,
+                uint32_t height,
+                uint32_t rect[4])
+{
+    if (!plane) {
+        rect[0] = x;
+        rect[1] = y;
+        rect[2] = width;
+        rect[3] = height;
+        return;
+    }
+
+    const uint32_t bpp = fmt->plane_count == 2 ? 2 : 1;
+    rect[0] = x / fmt->sx * bpp;
+    rect[1] = y / fmt->sy;
+    rect[2] = ((x + width + fmt->sx - 1) / fmt->sx - x / fmt->sx) * bpp;
+    rect[3] = (y + height + fmt->sy - 1) / fmt->sy - y / fmt->sy;
+}
+
+static uint64_t
+mock_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void
+mock_sleep_until(uint64_t ns)
+{
+    const struct timespec ts = {
+        .tv_sec = ns / 1000000000ull,
+        .tv_nsec = ns % 1000000000ull,
+    };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL))
+        ;
+}
+
+static struct mock_driver *
+mock_driver(VADriverContextP ctx)
+{
+    return ctx->pDriverData;
+}
+
+static struct mock_object *
+mock_lookup(struct mock_driver *drv, VAGenericID id, enum mock_object_type type)
+{
+    if (!id || id > (VAGenericID)drv->object_count)
+        return NULL;
+
+    struct mock_object *obj = drv->objects[id - 1];
+    return obj && obj->type == type ? obj : NULL;
+}
+
+static struct mock_object *
+mock_add(struct mock_driver *drv, enum mock_object_type type, VAGenericID *id)
+{
+    int idx = 0;
+    while (idx < drv->object_count && drv->objects[idx])
+        idx++;
+
+    if (idx == drv->object_count) {
+        if (drv->object_count == drv->object_max) {
+            const int max = drv->object_max ? drv->object_max * 2 : 64;
+            struct mock_object **objects = realloc(drv->objects, sizeof(*objects) * max);
+            if (!objects)
+                return NULL;
+            drv->objects = objects;
+            drv->object_max = max;
+        }
+        drv->objects[drv->object_count++] = NULL;
+    }
+
+    struct mock_object *obj = calloc(1, sizeof(*obj));
+    if (!obj)
+        return NULL;
+    obj->type = type;
+
+    drv->objects[idx] = obj;
+    *id = idx + 1;
+
+    return obj;
+}
+
+static void
+mock_remove(struct mock_driver *drv, VAGenericID id)
+{
+    free(drv->objects[id - 1]);
+    drv->objects[id - 1] = NULL;
+}
+
+static VAStatus
+mock_create_buffer_locked(struct mock_driver *drv,
+                          VABufferType type,
+                          unsigned int size,
+                          unsigned int num_elements,
+                          const void *data,
+                          VABufferID *buf_id)
+{
+    struct mock_object *obj = mock_add(drv, MOCK_OBJECT_BUFFER, buf_id);
+    if (!obj)
+        return VA_STATUS_ERROR_ALLOCATION_FAILED;
+
+    struct mock_buffer *buf = &obj->buffer;
+    buf->type = type;
+    buf->size = size;
+    buf->num_elements = num_elements;
+    buf->data = malloc((size_t)size * num_elements);
+    if (!buf->data) {
+        mock_remove(drv, *buf_id);
+        return VA_STATUS_ERROR_ALLOCATION_FAILED;
+    }
+    if (data)
+        memcpy(buf->data, data, (size_t)size * num_elements);
+
+    return VA_STATUS_SUCCESS;
+}
+
+static void
+mock_destroy_buffer_locked(struct mock_driver *drv, VABufferID buf_id)
+{
+    struct mock_object *obj = mock_lookup(drv, buf_id, MOCK_OBJECT_BUFFER);
+    if (!obj)
+        return;
+
+    free(obj->buffer.data);
+    mock_remove(drv, buf_id);
+}
+
+static bool
+mock_supports(VAProfile profile, VAEntrypoint entrypoint)
+{
+    return profile == VAProfileJPEGBaseline && entrypoint == VAEntrypointVLD;
+}
+
+static VAStatus
+mock_terminate(VADriverContextP ctx)
+{
+    struct mock_driver *drv = mock_driver(ctx);
+
+    for (int i = 0; i < drv->object_count; i++) {
+        struct mock_object *obj = drv->objects[i];
+        if (!obj)
+            continue;
+
+        switch (obj->type) {
+        case MOCK_OBJECT_SURFACE:
+            if (obj->surface.owned)
+                free(obj->surface.data);
+            break;
+        case MOCK_OBJECT_CONTEXT:
+            free(obj->context.bufs);
+            break;
+        case MOCK_OBJECT_BUFFER:
+            free(obj->buffer.data);
+            break;
+        default:
+            break;
+        }
+        free(obj);
+    }
+    free(drv->objects);
+
+    pthread_mutex_destroy(&drv->mutex);
+    free(drv);
+    ctx->pDriverData = NULL;
+
+    return VA_STATUS_SUCCESS;
+}
+
+static VAStatus
+mock_query_config_profiles(VADriverContextP ctx, VAProfile *profile_list, int *num_profiles)
+{
+    profile_list[0] = VAProfileJPEGBaseline;
+    *num_profiles = 1;
+    return VA_STATUS_SUCCESS;
+}
+
+static VAStatus
+mock_query_config_entrypoints(VADriverContextP ctx,
+                              VAProfile profile,
+                              VAEntrypoint *entrypoint_list,
+                              int *num_entrypoints)
+{
+    if (profile != VAProfileJPEGBaseline)
+        return VA_STATUS_ERROR_UNSUPPORTED_PROFILE;
+
+    entrypoint_list[0] = VAEntrypointVLD;
+    *num_entrypoints = 1;
+    return VA_STATUS_SUCCESS;
+}
+
+static VAStatus
+mock_get_config_attributes(VADriverContextP ctx,
+                           VAProfile profile,
+                           VAEntrypoint entrypoint,
+                           VAConfigAttrib *attrib_list,
+                           int num_attribs)
+{
+    struct mock_driver *drv = mock_driver(ctx);
+
+    if (!mock_supports(profile, entrypoint))
+        return VA_STATUS_ERROR_UNSUPPORTED_ENTRYPOINT;
+
+    for (int i = 0; i < num_attribs; i++) {
+        VAConfigAttrib *attr = &attrib_list[i];
+        switch (attr->type) {
+        case VAConfigAttribRTFormat:
+            attr->value = MOCK_RT_FORMATS;
+            break;
+        case VAConfigAttribMaxPictureWidth:
+            attr->value = drv->max_width;
+            break;
+        case VAConfigAttribMaxPictureHeight:
+            attr->value = drv->max_height;
+            break;
+        default:
+            attr->value = VA_ATTRIB_NOT_SUPPORTED;
+            break;
+        }
+    }
+
+    return VA_STATUS_SUCCESS;
+}
+
+static VAStatus
+mock_create_config(VADriverContextP ctx,
+                   VAProfile profile,
+                   VAEntrypoint entrypoint,
+                   VAConfigAttrib *attrib_list,
+                   int num_attribs,
+                   VAConfigID *config_id)
+{
+    struct mock_driver *drv = mock_driver(ctx);
+
+    if (!mock_supports(profile, entrypoint))
+        return VA_STATUS_ERROR_UNSUPPORTED_ENTRYPOINT;
+
+    unsigned int rt_format = VA_RT_FORMAT_YUV420;
+    for (int i = 0; i < num_attribs; i++) {
+        if (attrib_list[i].type != VAConfigAttribRTFormat)
+            return VA_STATUS_ERROR_ATTR_NOT_SUPPORTED;
+        if (!mock_find_format(attrib_list[i].value, 0))
+            return VA_STATUS_ERROR_UNSUPPORTED_RT_FORMAT;
+        rt_format = attrib_list[i].value;
+    }
+
+    pthread_mutex_lock(&drv->mutex);
+    struct mock_object *obj = mock_add(drv, MOCK_OBJECT_CONFIG, config_id);
+    if (obj) {
+        obj->config.profile = profile;
+        obj->config.entrypoint = entrypoint;
+        obj->config.rt_format = rt_format;
+    }
+    pthread_mutex_unlock(&drv->mutex);
+
+    return obj ? VA_STATUS_SUCCESS : VA_STATUS_ERROR_ALLOCATION_FAILED;
+}
+
+static VAStatus
+mock_destroy_config(VADriverContextP ctx, VAConfigID config_id)
+{
+    struct mock_driver *drv = mock_driver(ctx);
+    VAStatus status = VA_STATUS_SUCCESS;
+
+    pthread_mutex_lock(&drv->mutex);
+    if (mock_lookup(drv, config_id, MOCK_OBJECT_CONFIG))
+        mock_remove(drv, config_id);
+    else
+        status = VA_STATUS_ERROR_INVALID_CONFIG;
+    pthread_mutex_unlock(&drv->mutex);
+
+    return status;
+}
+
+static VAStatus
+mock_query_config_attributes(VADriverContextP ctx,
+                             VAConfigID config_id,
+                             VAProfile *profile,
+                             VAEntrypoint *entrypoint,
+                             VAConfigAttrib *attrib_list,
+                             int *num_attribs)
+{
+    struct mock_driver *drv = mock_driver(ctx);
+    VAStatus status = VA_STATUS_SUCCESS;
+
+    pthread_mutex_lock(&drv->mutex);
+    const struct mock_object *obj = mock_lookup(drv, config_id, MOCK_OBJECT_CONFIG);
+    if (obj) {
+        *profile = obj->config.profile;
+        *entrypoint = obj->config.entrypoint;
+        attrib_list[0].type = VAConfigAttribRTFormat;
+        attrib_list[0].value = obj->config.rt_format;
+        *num_attribs = 1;
+    } else {
+        status = VA_STATUS_ERROR_INVALID_CONFIG;
+    }
+    pthread_mutex_unlock(&drv->mutex);
+
+    return status;
+}
+
+static VAStatus
+mock_query_surface_attributes(VADriverContextP ctx,
+                              VAConfigID config,
+                              VASurfaceAttrib *attrib_list,
+                              unsigned int *num_attribs)
+{
+    struct mock_driver *drv = mock_driver(ctx);
+
+    const VASurfaceAttrib common_attrs[] = {
+        {
+            .type = VASurfaceAttribMinWidth,
+            .flags = VA_SURFACE_ATTRIB_GETTABLE,
+            .value = { .type = VAGenericValueTypeInteger, .value.i = 1 },
+        },
+        {
+            .type = VASurfaceAttribMinHeight,
+            .flags = VA_SURFACE_ATTRIB_GETTABLE,
+            .value = { .type = VAGenericValueTypeInteger, .value.i = 1 },
+        },
+        {
+            .type = VASurfaceAttribMaxWidth,
+            .flags = VA_SURFACE_ATTRIB_GETTABLE,
+            .value = { .type = VAGenericValueTypeInteger, .value.i = drv->max_width },
+        },
+        {
+            .type = VASurfaceAttribMaxHeight,
+            .flags = VA_SURFACE_ATTRIB_GETTABLE,
+            .value = { .type = VAGenericValueTypeInteger, .value.i = drv->max_height },
+        },
+        {
+            .type = VASurfaceAttribMemoryType,
+            .flags = VA_SURFACE_ATTRIB_GETTABLE | VA_SURFACE_ATTRIB_SETTABLE,
+            .value = {
+                .type = VAGenericValueTypeInteger,
+                .value.i = VA_SURFACE_ATTRIB_MEM_TYPE_VA | VA_SURFACE_ATTRIB_MEM_TYPE_USER_PTR,
+            },
+        },
+        {
+            .type = VASurfaceAttribExternalBufferDescriptor,
+            .flags = VA_SURFACE_ATTRIB_SETTABLE,
+            .value = { .type = VAGenericValueTypePointer },
+        },
+    };
+
+    pthread_mutex_lock(&drv->mutex);
+    const struct mock_object *obj = mock_lookup(drv, config, MOCK_OBJECT_CONFIG);
+    const unsigned int rt_format = obj ? obj->config.rt_format : 0;
+    pthread_mutex_unlock(&drv->mutex);
+    if (!obj)
+        return VA_STATUS_ERROR_INVALID_CONFIG;
+
+    /* the pixel formats of the render target format, then the rest */
+    VASurfaceAttrib attrs[MOCK_FORMAT_COUNT + sizeof(common_attrs) / sizeof(common_attrs[0])];
+    unsigned int count = 0;
+    for (int i = 0; i < MOCK_FORMAT_COUNT; i++) {
+        if (mock_formats[i].rt_format != rt_format)
+            continue;
+        attrs[count++] = (VASurfaceAttrib){
+            .type = VASurfaceAttribPixelFormat,
+            .flags = VA_SURFACE_ATTRIB_GETTABLE | VA_SURFACE_ATTRIB_SETTABLE,
+            .value = {
+                .type = VAGenericValueTypeInteger,
+                .value.i = mock_formats[i].fourcc,
+            },
+        };
+    }
+    memcpy(attrs + count, common_attrs, sizeof(common_attrs));
+    count += sizeof(common_attrs) / sizeof(common_attrs[0]);
+
+    if (attrib_list) {
+        if (*num_attribs < count)
+            return VA_STATUS_ERROR_MAX_NUM_EXCEEDED;
+        memcpy(attrib_list, attrs, sizeof(*attrs) * count);
+    }
+    *num_attribs = count;
+
+    return VA_STATUS_SUCCESS;
+}
+
+static VAStatus
+mock_create_surfaces2(VADriverContextP ctx,
+                      unsigned int format,
+                      unsigned int width,
+                      unsigned int height,
+                      VASurfaceID *surfaces,
+                      unsigned int num_surfaces,
+                      VASurfaceAttrib *attrib_list,
+                      unsigned int num_attribs)
+{
+    struct mock_driver *drv = mock_driver(ctx);
+
+    const struct mock_format *fmt = mock_find_format(format, 0);
+    if (!fmt)
+        return VA_STATUS_ERROR_UNSUPPORTED_RT_FORMAT;
+    if (!width || !height || width > (unsigned int)drv->max_width ||
+        height > (unsigned int)drv->max_height)
+        return VA_STATUS_ERROR_RESOLUTION_NOT_SUPPORTED;
+
+    int mem_type = VA_SURFACE_ATTRIB_MEM_TYPE_VA;
+    const VASurfaceAttribExternalBuffers *desc = NULL;
+    for (unsigned int i = 0; i < num_attribs; i++) {
+        const VASurfaceAttrib *attr = &attrib_list[i];
+        switch (attr->type) {
+        case VASurfaceAttribPixelFormat:
+            fmt = mock_find_format(format, attr->value.value.i);
+            if (!fmt)
+                return VA_STATUS_ERROR_INVALID_IMAGE_FORMAT;
+            break;
+        case VASurfaceAttribMemoryType:
+            mem_type = attr->value.value.i;
+            break;
+        case VASurfaceAttribExternalBufferDescriptor:
+            desc = attr->value.value.p;
+            break;
+        default:
+            break;
+        }
+    }
+
+    if (mem_type == VA_SURFACE_ATTRIB_MEM_TYPE_USER_PTR) {
+        if (!desc || fmt->fourcc != VA_FOURCC_NV12 ||
+            desc->pixel_format != VA_FOURCC_NV12 || desc->num_planes != 2 ||
+            desc->num_buffers < num_surfaces || desc->pitches[0] < width ||
+            desc->pitches[1] < MOCK_ALIGN(width, 2) ||
+            desc->offsets[1] < desc->pitches[0] * height)
+            return VA_STATUS_ERROR_INVALID_PARAMETER;
+    } else if (mem_type == VA_SURFACE_ATTRIB_MEM_TYPE_VA) {
+        desc = NULL;
+    } else {
+        return VA_STATUS_ERROR_UNSUPPORTED_MEMORY_TYPE;
+    }
+
+    uint32_t pitches[3];
+    uint32_t offsets[3];
+    const uint32_t size = mock_layout(fmt, width, height, MOCK_HEIGHT_ALIGN, pitches, offsets);
+
+    VAStatus status = VA_STATUS_SUCCESS;
+    unsigned int created = 0;
+
+    pthread_mutex_lock(&drv->mutex);
+    for (; created < num_surfaces; created++) {
+        struct mock_object *obj = mock_add(drv, MOCK_OBJECT_SURFACE, &surfaces[created]);
+        if (!obj) {
+            status = VA_STATUS_ERROR_ALLOCATION_FAILED;
+            break;
+        }
+
+        struct mock_surface *surf = &obj->surface;
+        surf->width = width;
+        surf->height = height;
+        surf->format = fmt;
+        surf->decode_status = VA_STATUS_SUCCESS;
+
+        if (desc) {
+            surf->data = (uint8_t *)desc->buffers[created];
+            memcpy(surf->pitches, desc->pitches, sizeof(surf->pitches));
+            memcpy(surf->offsets, desc->offsets, sizeof(surf->offsets));
+            continue;
+        }
+
+        memcpy(surf->pitches, pitches, sizeof(surf->pitches));
+        memcpy(surf->offsets, offsets, sizeof(surf->offsets));
+        surf->data = calloc(1, size);
+        surf->owned = true;
+        if (!surf->data) {
+            mock_remove(drv, surfaces[created]);
+            status = VA_STATUS_ERROR_ALLOCATION_FAILED;
+            break;
+        }
+    }
+
+    if (status != VA_STATUS_SUCCESS) {
+        for (unsigned int i = 0; i < created; i++) {
+            struct mock_object *obj = mock_lookup(drv, surfaces[i], MOCK_OBJECT_SURFACE);
+            if (obj->surface.owned)
+                free(obj->surface.data);
+            mock_remove(drv, surfaces[i]);
+        }
+    }
+    pthread_mutex_unlock(&drv->mutex);
+
+    return status;
+}
+
+static VAStatus
+mock_create_surfaces(VADriverContextP ctx,
+                     int width,
+                     int height,
+                     int format,
+                     int num_surfaces,
+                     VASurfaceID *surfaces)
+{
+    return mock_create_surfaces2(ctx, format, width, height, surfaces, num_surfaces, NULL, 0);
+}
+
+static VAStatus
+mock_destroy_surfaces(VADriverContextP ctx, VASurfaceID *surface_list, int num_surfaces)
+{
+    struct mock_driver *drv = mock_driver(ctx);
+    VAStatus status = VA_STATUS_SUCCESS;
+
+    pthread_mutex_lock(&drv->mutex);
+    for (int i = 0; i < num_surfaces; i++) {
+        struct mock_object *obj = mock_lookup(drv, surface_list[i], MOCK_OBJECT_SURFACE);
+        if (!obj) {
+            status = VA_STATUS_ERROR_INVALID_SURFACE;
+            continue;
+        }
+
+        if (obj->surface.owned)
+            free(obj->surface.data);
+        mock_remove(drv, surface_list[i]);
+    }
+    pthread_mutex_unlock(&drv->mutex);
+
+    return status;
+}
+
+static VAStatus
+mock_create_context(VADriverContextP ctx,
+                    VAConfigID config_id,
+                    int picture_width,
+                    int picture_height,
+                    int flag,
+                    VASurfaceID *render_targets,
+                    int num_render_targets,
+                    VAContextID *context)
+{
+    struct mock_driver *drv = mock_driver(ctx);
+    VAStatus status = VA_STATUS_SUCCESS;
+
+    pthread_mutex_lock(&drv->mutex);
+    if (mock_lookup(drv, config_id, MOCK_OBJECT_CONFIG)) {
+        struct mock_object *obj = mock_add(drv, MOCK_OBJECT_CONTEXT, context);
+        if (obj)
+            obj->context.config = config_id;
+        else
+            status = VA_STATUS_ERROR_ALLOCATION_FAILED;
+    } else {
+        status = VA_STATUS_ERROR_INVALID_CONFIG;
+    }
+    pthread_mutex_unlock(&drv->mutex);
+
+    return status;
+}
+
+static VAStatus
+mock_destroy_context(VADriverContextP ctx, VAContextID context)
+{
+    struct mock_driver *drv = mock_driver(ctx);
+    VAStatus status = VA_STATUS_SUCCESS;
+
+    pthread_mutex_lock(&drv->mutex);
+    struct mock_object *obj = mock_lookup(drv, context, MOCK_OBJECT_CONTEXT);
+    if (obj) {
+        free(obj->context.bufs);
+        mock_remove(drv, context);
+    } else {
+        status = VA_STATUS_ERROR_INVALID_CONTEXT;
+    }
+    pthread_mutex_unlock(&drv->mutex);
+
+    return status;
+}
+
+static VAStatus
+mock_create_buffer(VADriverContextP ctx,
+                   VAContextID context,
+                   VABufferType type,
+                   unsigned int size,
+                   unsigned int num_elements,
+                   void *data,
+                   VABufferID *buf_id)
+{
+    struct mock_driver *drv = mock_driver(ctx);
+
+    pthread_mutex_lock(&drv->mutex);
+    const VAStatus status =
+        mock_create_buffer_locked(drv, type, size, num_elements, data, buf_id);
+    pthread_mutex_unlock(&drv->mutex);
+
+    return status;
+}
+
+static VAStatus
+mock_buffer_set_num_elements(VADriverContextP ctx, VABufferID buf_id, unsigned int num_elements)
+{
+    struct mock_driver *drv = mock_driver(ctx);
+    VAStatus status = VA_STATUS_SUCCESS;
+
+    pthread_mutex_lock(&drv->mutex);
+    struct mock_object *obj = mock_lookup(drv, buf_id, MOCK_OBJECT_BUFFER);
+    if (obj) {
+        struct mock_buffer *buf = &obj->buffer;
+        uint8_t *data = realloc(buf->data, (size_t)buf->size * num_elements);
+        if (data) {
+            buf->data = data;
+            buf->num_elements = num_elements;
+        } else {
+            status = VA_STATUS_ERROR_ALLOCATION_FAILED;
+        }
+    } else {
+        status = VA_STATUS_ERROR_INVALID_BUFFER;
+    }
+    pthread_mutex_unlock(&drv->mutex);
+
+    return status;
+}
+
+static VAStatus
+mock_map_buffer(VADriverContextP ctx, VABufferID buf_id, void **pbuf)
+{
+    struct mock_driver *drv = mock_driver(ctx);
+
+    pthread_mutex_lock(&drv->mutex);
+    const struct mock_object *obj = mock_lookup(drv, buf_id, MOCK_OBJECT_BUFFER);
+    if (obj)
+        *pbuf = obj->buffer.data;
+    pthread_mutex_unlock(&drv->mutex);
+
+    return obj ? VA_STATUS_SUCCESS : VA_STATUS_ERROR_INVALID_BUFFER;
+}
+
+static VAStatus
+mock_unmap_buffer(VADriverContextP ctx, VABufferID buf_id)
+{
+    struct mock_driver *drv = mock_driver(ctx);
+
+    pthread_mutex_lock(&drv->mutex);
+    const bool valid = mock_lookup(drv, buf_id, MOCK_OBJECT_BUFFER);
+    pthread_mutex_unlock(&drv->mutex);
+
+    return valid ? VA_STATUS_SUCCESS : VA_STATUS_ERROR_INVALID_BUFFER;
+}
+
+static VAStatus
+mock_destroy_buffer(VADriverContextP ctx, VABufferID buffer_id)
+{
+    struct mock_driver *drv = mock_driver(ctx);
+
+    pthread_mutex_lock(&drv->mutex);
+    const bool valid = mock_lookup(drv, buffer_id, MOCK_OBJECT_BUFFER);
+    mock_destroy_buffer_locked(drv, buffer_id);
+    pthread_mutex_unlock(&drv->mutex);
+
+    return valid ? VA_STATUS_SUCCESS : VA_STATUS_ERROR_INVALID_BUFFER;
+}
+
+static VAStatus
+mock_buffer_info(VADriverContextP ctx,
+                 VABufferID buf_id,
+                 VABufferType *type,
+                 unsigned int *size,
+                 unsigned int *num_elements)
+{
+    struct mock_driver *drv = mock_driver(ctx);
+
+    pthread_mutex_lock(&drv->mutex);
+    const struct mock_object *obj = mock_lookup(drv, buf_id, MOCK_OBJECT_BUFFER);
+    if (obj) {
+        *type = obj->buffer.type;
+        *size = obj->buffer.size;
+        *num_elements = obj->buffer.num_elements;
+    }
+    pthread_mutex_unlock(&drv->mutex);
+
+    return obj ? VA_STATUS_SUCCESS : VA_STATUS_ERROR_INVALID_BUFFER;
+}
+
+static VAStatus
+mock_begin_picture(VADriverContextP ctx, VAContextID context, VASurfaceID render_target)
+{
+    struct mock_driver *drv = mock_driver(ctx);
+    VAStatus status = VA_STATUS_SUCCESS;
+
+    pthread_mutex_lock(&drv->mutex);
+    struct mock_object *obj = mock_lookup(drv, context, MOCK_OBJECT_CONTEXT);
+    if (!obj) {
+        status = VA_STATUS_ERROR_INVALID_CONTEXT;
+    } else if (!mock_lookup(drv, render_target, MOCK_OBJECT_SURFACE)) {
+        status = VA_STATUS_ERROR_INVALID_SURFACE;
+    } else {
+        obj->context.in_picture = true;
+        obj->context.target = render_target;
+        obj->context.buf_count = 0;
+    }
+    pthread_mutex_unlock(&drv->mutex);
+
+    return status;
+}
+
+static VAStatus
+mock_render_picture(VADriverContextP ctx,
+                    VAContextID context,
+                    VABufferID *buffers,
+                    int num_buffers)
+{
+    struct mock_driver *drv = mock_driver(ctx);
+    VAStatus status = VA_STATUS_SUCCESS;
+
+    pthread_mutex_lock(&drv->mutex);
+    struct mock_object *obj = mock_lookup(drv, context, MOCK_OBJECT_CONTEXT);
+    if (!obj || !obj->context.in_picture) {
+        status = VA_STATUS_ERROR_INVALID_CONTEXT;
+        goto out;
+    }
+
+    struct mock_context *mctx = &obj->context;
+    if (mctx->buf_count + num_buffers > mctx->buf_max) {
+        const int max = MOCK_ALIGN(mctx->buf_count + num_buffers, 16);
+        VABufferID *bufs = realloc(mctx->bufs, sizeof(*bufs) * max);
+        if (!bufs) {
+            status = VA_STATUS_ERROR_ALLOCATION_FAILED;
+            goto out;
+        }
+        mctx->bufs = bufs;
+        mctx->buf_max = max;
+    }
+
+    for (int i = 0; i < num_buffers; i++) {
+        if (!mock_lookup(drv, buffers[i], MOCK_OBJECT_BUFFER)) {
+            status = VA_STATUS_ERROR_INVALID_BUFFER;
+            goto out;
+        }
+    }
+    memcpy(mctx->bufs + mctx->buf_count, buffers, sizeof(*buffers) * num_buffers);
+    mctx->buf_count += num_buffers;
+
+out:
+    pthread_mutex_unlock(&drv->mutex);
+    return status;
+}
+
+/* the buffers have been validated by mock_end_picture */
+static const struct mock_buffer *
+mock_get_buffer(struct mock_driver *drv, VABufferID buf_id)
+{
+    return &mock_lookup(drv, buf_id, MOCK_OBJECT_BUFFER)->buffer;
+}
+
+/* NV12 takes any sampling, other formats only their own */
+static VAStatus
+mock_output(const struct swjpeg_decoder *dec, struct mock_surface *surf)
+{
+    const struct mock_format *fmt = surf->format;
+
+    if (fmt->fourcc == VA_FOURCC_NV12) {
+        const struct swjpeg_nv12 out = {
+            .data = surf->data,
+            .pitches = { surf->pitches[0], surf->pitches[1] },
+            .offsets = { surf->offsets[0], surf->offsets[1] },
+        };
+        swjpeg_decoder_output_nv12(dec, &out);
+        return VA_STATUS_SUCCESS;
+    }
+
+    if (dec->component_count != fmt->plane_count)
+        return VA_STATUS_ERROR_DECODING_ERROR;
+    for (int i = 1; i < fmt->plane_count; i++) {
+        const struct swjpeg_component *comp = &dec->components[i];
+        if (comp->h * fmt->sx != dec->hmax || comp->v * fmt->sy != dec->vmax)
+            return VA_STATUS_ERROR_DECODING_ERROR;
+    }
+
+    for (int i = 0; i < fmt->plane_count; i++) {
+        const struct swjpeg_component *comp = &dec->components[i];
+        uint32_t rect[4];
+        mock_plane_rect(fmt, i, 0, 0, dec->width, dec->height, rect);
+        for (uint32_t y = 0; y < rect[3]; y++) {
+            memcpy(surf->data + surf->offsets[i] + surf->pitches[i] * y,
+                   comp->plane + comp->pitch * y, rect[2]);
+        }
+    }
+
+    return VA_STATUS_SUCCESS;
+}
+
+static VAStatus
+mock_decode_jpeg(struct mock_driver *drv,
+                 const struct mock_context *mctx,
+                 struct mock_surface *surf)
+{
+    const struct mock_buffer *pic_param = NULL;
+    const struct mock_buffer *iq_matrix = NULL;
+    const struct mock_buffer *huffman_table = NULL;
+    for (int i = 0; i < mctx->buf_count; i++) {
+        const struct mock_buffer *buf = mock_get_buffer(drv, mctx->bufs[i]);
+        if (buf->type == VAPictureParameterBufferType &&
+            buf->size >= sizeof(VAPictureParameterBufferJPEGBaseline))
+            pic_param = buf;
+        else if (buf->type == VAIQMatrixBufferType &&
+                 buf->size >= sizeof(VAIQMatrixBufferJPEGBaseline))
+            iq_matrix = buf;
+        else if (buf->type == VAHuffmanTableBufferType &&
+                 buf->size >= sizeof(VAHuffmanTableBufferJPEGBaseline))
+            huffman_table = buf;
+    }
+    if (!pic_param || !iq_matrix || !huffman_table)
+        return VA_STATUS_ERROR_INVALID_PARAMETER;
+
+    const VAPictureParameterBufferJPEGBaseline *pic = (const void *)pic_param->data;
+    if (pic->picture_width > surf->width || pic->picture_height > surf->height)
+        return VA_STATUS_ERROR_INVALID_PARAMETER;
+
+    struct swjpeg_decoder dec;
+    if (!swjpeg_decoder_init(&dec, pic, (const void *)iq_matrix->data,
+                             (const void *)huffman_table->data, drv->thread_count)) {
+        swjpeg_decoder_cleanup(&dec);
+        return VA_STATUS_ERROR_INVALID_PARAMETER;
+    }
+
+    /* every slice parameter element refers to the next slice data buffer */
+    VAStatus status = VA_STATUS_SUCCESS;
+    const struct mock_buffer *slice_params = NULL;
+    int slice_count = 0;
+    for (int i = 0; i < mctx->buf_count && status == VA_STATUS_SUCCESS; i++) {
+        const struct mock_buffer *buf = mock_get_buffer(drv, mctx->bufs[i]);
+        if (buf->type == VASliceParameterBufferType) {
+            slice_params = buf;
+            if (buf->size < sizeof(VASliceParameterBufferJPEGBaseline))
+                status = VA_STATUS_ERROR_INVALID_PARAMETER;
+            continue;
+        }
+        if (buf->type != VASliceDataBufferType)
+            continue;
+        if (!slice_params) {
+            status = VA_STATUS_ERROR_INVALID_PARAMETER;
+            break;
+        }
+
+        const VASliceParameterBufferJPEGBaseline *slices = (const void *)slice_params->data;
+        for (unsigned int j = 0; j < slice_params->num_elements; j++) {
+            const VASliceParameterBufferJPEGBaseline *slice = &slices[j];
+            if ((uint64_t)slice->slice_data_offset + slice->slice_data_size >
+                (uint64_t)buf->size * buf->num_elements) {
+                status = VA_STATUS_ERROR_INVALID_PARAMETER;
+                break;
+            }
+            if (!swjpeg_decoder_decode_slice(&dec, slice, buf->data)) {
+                status = VA_STATUS_ERROR_DECODING_ERROR;
+                break;
+            }
+            slice_count++;
+        }
+        slice_params = NULL;
+    }
+    if (status == VA_STATUS_SUCCESS && !slice_count)
+        status = VA_STATUS_ERROR_INVALID_PARAMETER;
+
+    if (status == VA_STATUS_SUCCESS)
+        status = mock_output(&dec, surf);
+
+    swjpeg_decoder_cleanup(&dec);
+
+    return status;
+}
+
+static VAStatus
+mock_end_picture(VADriverContextP ctx, VAContextID context)
+{
+    struct mock_driver *drv = mock_driver(ctx);
+    VAStatus status = VA_STATUS_SUCCESS;
+
+    pthread_mutex_lock(&drv->mutex);
+    struct mock_object *obj = mock_lookup(drv, context, MOCK_OBJECT_CONTEXT);
+    if (!obj || !obj->context.in_picture) {
+        status = VA_STATUS_ERROR_INVALID_CONTEXT;
+        goto out;
+    }
+
+    struct mock_context *mctx = &obj->context;
+    mctx->in_picture = false;
+
+    struct mock_object *surf_obj = mock_lookup(drv, mctx->target, MOCK_OBJECT_SURFACE);
+    if (!surf_obj) {
+        status = VA_STATUS_ERROR_INVALID_SURFACE;
+        goto out;
+    }
+
+    /* rendered buffers may have been destroyed since */
+    for (int i = 0; i < mctx->buf_count; i++) {
+        if (!mock_lookup(drv, mctx->bufs[i], MOCK_OBJECT_BUFFER)) {
+            status = VA_STATUS_ERROR_INVALID_BUFFER;
+            goto out;
+        }
+    }
+
+    /* decode errors are reported when the surface is synced */
+    struct mock_surface *surf = &surf_obj->surface;
+    surf->decode_status = mock_decode_jpeg(drv, mctx, surf);
+    surf->ready_ns = mock_now() + drv->latency_ns;
+
+out:
+    pthread_mutex_unlock(&drv->mutex);
+    return status;
+}
+
+static VAStatus
+mock_get_surface_ready(struct mock_driver *drv,
+                       VASurfaceID surface,
+                       uint64_t *ready_ns,
+                       VAStatus *decode_status)
+{
+    pthread_mutex_lock(&drv->mutex);
+    const struct mock_object *obj = mock_lookup(drv, surface, MOCK_OBJECT_SURFACE);
+    if (obj) {
+        *ready_ns = obj->surface.ready_ns;
+        *decode_status = obj->surface.decode_status;
+    }
+    pthread_mutex_unlock(&drv->mutex);
+
+    return obj ? VA_STATUS_SUCCESS : VA_STATUS_ERROR_INVALID_SURFACE;
+}
+
+static VAStatus
+mock_sync_surface(VADriverContextP ctx, VASurfaceID render_target)
+{
+    uint64_t ready_ns;
+    VAStatus decode_status;
+    const VAStatus status =
+        mock_get_surface_ready(mock_driver(ctx), render_target, &ready_ns, &decode_status);
+    if (status != VA_STATUS_SUCCESS)
+        return status;
+
+    mock_sleep_until(ready_ns);
+
+    return decode_status;
+}
+
+/* vaSyncSurface2 and its timeout status are new in libva 2.9 (VA-API 1.9) */
+#if VA_CHECK_VERSION(1, 9, 0)
+static VAStatus
+mock_sync_surface2(VADriverContextP ctx, VASurfaceID surface, uint64_t timeout_ns)
+{
+    uint64_t ready_ns;
+    VAStatus decode_status;
+    const VAStatus status =
+        mock_get_surface_ready(mock_driver(ctx), surface, &ready_ns, &decode_status);
+    if (status != VA_STATUS_SUCCESS)
+        return status;
+
+    const uint64_t now = mock_now();
+    if (ready_ns > now && ready_ns - now > timeout_ns) {
+        mock_sleep_until(now + timeout_ns);
+        return VA_STATUS_ERROR_TIMEDOUT;
+    }
+    mock_sleep_until(ready_ns);
+
+    return decode_status;
+}
+#endif
+
+static VAStatus
+mock_query_surface_status(VADriverContextP ctx,
+                          VASurfaceID render_target,
+                          VASurfaceStatus *status)
+{
+    uint64_t ready_ns;
+    VAStatus decode_status;
+    const VAStatus ret =
+        mock_get_surface_ready(mock_driver(ctx), render_target, &ready_ns, &decode_status);
+    if (ret != VA_STATUS_SUCCESS)
+        return ret;
+
+    *status = mock_now() >= ready_ns ? VASurfaceReady : VASurfaceRendering;
+    return VA_STATUS_SUCCESS;
+}
+
+static VAStatus
+mock_query_image_formats(VADriverContextP ctx, VAImageFormat *format_list, int *num_formats)
+{
+    for (int i = 0; i < MOCK_FORMAT_COUNT; i++)
+        format_list[i] = mock_image_format(&mock_formats[i]);
+    *num_formats = MOCK_FORMAT_COUNT;
+    return VA_STATUS_SUCCESS;
+}
+
+static VAStatus
+mock_create_image(
+    VADriverContextP ctx, VAImageFormat *format, int width, int height, VAImage *image)
+{
+    struct mock_driver *drv = mock_driver(ctx);
+
+    const struct mock_format *fmt = mock_find_format(0, format->fourcc);
+    if (!fmt)
+        return VA_STATUS_ERROR_INVALID_IMAGE_FORMAT;
+    if (width <= 0 || height <= 0 || width > drv->max_width || height > drv->max_height)
+        return VA_STATUS_ERROR_RESOLUTION_NOT_SUPPORTED;
+
+    VAImage img = {
+        .format = mock_image_format(fmt),
+        .width = width,
+        .height = height,
+        .num_planes = fmt->plane_count,
+    };
+    img.data_size = mock_layout(fmt, width, height, 2, img.pitches, img.offsets);
+
+    pthread_mutex_lock(&drv->mutex);
+    VAStatus status =
+        mock_create_buffer_locked(drv, VAImageBufferType, img.data_size, 1, NULL, &img.buf);
+    if (status == VA_STATUS_SUCCESS) {
+        struct mock_object *obj = mock_add(drv, MOCK_OBJECT_IMAGE, &img.image_id);
+        if (obj) {
+            obj->image = img;
+            *image = img;
+        } else {
+            mock_destroy_buffer_locked(drv, img.buf);
+            status = VA_STATUS_ERROR_ALLOCATION_FAILED;
+        }
+    }
+    pthread_mutex_unlock(&drv->mutex);
+
+    return status;
+}
+
+static VAStatus
+mock_derive_image(VADriverContextP ctx, VASurfaceID surface, VAImage *image)
+{
+    return VA_STATUS_ERROR_UNIMPLEMENTED;
+}
+
+static VAStatus
+mock_destroy_image(VADriverContextP ctx, VAImageID image)
+{
+    struct mock_driver *drv = mock_driver(ctx);
+    VAStatus status = VA_STATUS_SUCCESS;
+
+    pthread_mutex_lock(&drv->mutex);
+    const struct mock_object *obj = mock_lookup(drv, image, MOCK_OBJECT_IMAGE);
+    if (obj) {
+        mock_destroy_buffer_locked(drv, obj->image.buf);
+        mock_remove(drv, image);
+    } else {
+        status = VA_STATUS_ERROR_INVALID_IMAGE;
+    }
+    pthread_mutex_unlock(&drv->mutex);
+
+    return status;
+}
+
+static VAStatus
+mock_set_image_palette(VADriverContextP ctx, VAImageID image, unsigned char *palette)
+{
+    return VA_STATUS_ERROR_UNIMPLEMENTED;
+}
+
+static VAStatus
+mock_get_image(VADriverContextP ctx,
+               VASurfaceID surface,
+               int x,
+               int y,
+               unsigned int width,
+               unsigned int height,
+               VAImageID image)
+{
+    struct mock_driver *drv = mock_driver(ctx);
+
+    /* like hardware drivers, wait for pending decodes */
+    uint64_t ready_ns;
+    VAStatus decode_status;
+    VAStatus status = mock_get_surface_ready(drv, surface, &ready_ns, &decode_status);
+    if (status != VA_STATUS_SUCCESS)
+        return status;
+    mock_sleep_until(ready_ns);
+
+    pthread_mutex_lock(&drv->mutex);
+    const struct mock_object *surf_obj = mock_lookup(drv, surface, MOCK_OBJECT_SURFACE);
+    const struct mock_object *img_obj = mock_lookup(drv, image, MOCK_OBJECT_IMAGE);
+    if (!surf_obj || !img_obj) {
+        status = surf_obj ? VA_STATUS_ERROR_INVALID_IMAGE : VA_STATUS_ERROR_INVALID_SURFACE;
+        goto out;
+    }
+
+    /* no color conversion */
+    const struct mock_surface *surf = &surf_obj->surface;
+    const VAImage *img = &img_obj->image;
+    if (img->format.fourcc != surf->format->fourcc) {
+        status = VA_STATUS_ERROR_INVALID_IMAGE_FORMAT;
+        goto out;
+    }
+    if (x < 0 || y < 0 || (x | y) & 1 || x + width > surf->width || y + height > surf->height ||
+        width > img->width || height > img->height) {
+        status = VA_STATUS_ERROR_INVALID_PARAMETER;
+        goto out;
+    }
+
+    uint8_t *dst = mock_lookup(drv, img->buf, MOCK_OBJECT_BUFFER)->buffer.data;
+    for (int p = 0; p < surf->format->plane_count; p++) {
+        uint32_t rect[4];
+        mock_plane_rect(surf->format, p, x, y, width, height, rect);
+        for (uint32_t i = 0; i < rect[3]; i++) {
+            memcpy(dst + img->offsets[p] + img->pitches[p] * i,
+                   surf->data + surf->offsets[p] + surf->pitches[p] * (rect[1] + i) + rect[0],
+                   rect[2]);
+        }
+    }
+
+out:
+    pthread_mutex_unlock(&drv->mutex);
+    return status;
+}
+
+static VAStatus
+mock_put_image(VADriverContextP ctx,
+               VASurfaceID surface,
+               VAImageID image,
+               int src_x,
+               int src_y,
+               unsigned int src_width,
+               unsigned int src_height,
+               int dest_x,
+               int dest_y,
+               unsigned int dest_width,
+               unsigned int dest_height)
+{
+    return VA_STATUS_ERROR_UNIMPLEMENTED;
+}
+
+static VAStatus
+mock_put_surface(VADriverContextP ctx,
+                 VASurfaceID surface,
+                 void *draw,
+                 short srcx,
+                 short srcy,
+                 unsigned short srcw,
+                 unsigned short srch,
+                 short destx,
+                 short desty,
+                 unsigned short destw,
+                 unsigned short desth,
+                 VARectangle *cliprects,
+                 unsigned int number_cliprects,
+                 unsigned int flags)
+{
+    return VA_STATUS_ERROR_UNIMPLEMENTED;
+}
+
+static VAStatus
+mock_query_surface_error(VADriverContextP ctx,
+                         VASurfaceID render_target,
+                         VAStatus error_status,
+                         void **error_info)
+{
+    return VA_STATUS_ERROR_UNIMPLEMENTED;
+}
+
+static VAStatus
+mock_query_subpicture_formats(VADriverContextP ctx,
+                              VAImageFormat *format_list,
+                              unsigned int *flags,
+                              unsigned int *num_formats)
+{
+    *num_formats = 0;
+    return VA_STATUS_SUCCESS;
+}
+
+static VAStatus
+mock_create_subpicture(VADriverContextP ctx, VAImageID image, VASubpictureID *subpicture)
+{
+    return VA_STATUS_ERROR_UNIMPLEMENTED;
+}
+
+static VAStatus
+mock_destroy_subpicture(VADriverContextP ctx, VASubpictureID subpicture)
+{
+    return VA_STATUS_ERROR_UNIMPLEMENTED;
+}
+
+static VAStatus
+mock_set_subpicture_image(VADriverContextP ctx, VASubpictureID subpicture, VAImageID image)
+{
+    return VA_STATUS_ERROR_UNIMPLEMENTED;
+}
+
+static VAStatus
+mock_set_subpicture_chromakey(VADriverContextP ctx,
+                              VASubpictureID subpicture,
+                              unsigned int chromakey_min,
+                              unsigned int chromakey_max,
+                              unsigned int chromakey_mask)
+{
+    return VA_STATUS_ERROR_UNIMPLEMENTED;
+}
+
+static VAStatus
+mock_set_subpicture_global_alpha(VADriverContextP ctx,
+                                 VASubpictureID subpicture,
+                                 float global_alpha)
+{
+    return VA_STATUS_ERROR_UNIMPLEMENTED;
+}
+
+static VAStatus
+mock_associate_subpicture(VADriverContextP ctx,
+                          VASubpictureID subpicture,
+                          VASurfaceID *target_surfaces,
+                          int num_surfaces,
+                          short src_x,
+                          short src_y,
+                          unsigned short src_width,
+                          unsigned short src_height,
+                          short dest_x,
+                          short dest_y,
+                          unsigned short dest_width,
+                          unsigned short dest_height,
+                          unsigned int flags)
+{
+    return VA_STATUS_ERROR_UNIMPLEMENTED;
+}
+
+static VAStatus
+mock_deassociate_subpicture(VADriverContextP ctx,
+                            VASubpictureID subpicture,
+                            VASurfaceID *target_surfaces,
+                            int num_surfaces)
+{
+    return VA_STATUS_ERROR_UNIMPLEMENTED;
+}
+
+static VAStatus
+mock_query_display_attributes(VADriverContextP ctx,
+                              VADisplayAttribute *attr_list,
+                              int *num_attributes)
+{
+    *num_attributes = 0;
+    return VA_STATUS_SUCCESS;
+}
+
+static VAStatus
+mock_get_display_attributes(VADriverContextP ctx,
+                            VADisplayAttribute *attr_list,
+                            int num_attributes)
+{
+    return VA_STATUS_ERROR_ATTR_NOT_SUPPORTED;
+}
+
+static VAStatus
+mock_set_display_attributes(VADriverContextP ctx,
+                            VADisplayAttribute *attr_list,
+                            int num_attributes)
+{
+    return VA_STATUS_ERROR_ATTR_NOT_SUPPORTED;
+}
+
+static void
+mock_init_params(struct mock_driver *drv)
+{
+    drv->thread_count = 1;
+    drv->max_width = MOCK_DEFAULT_MAX_SIZE;
+    drv->max_height = MOCK_DEFAULT_MAX_SIZE;
+
+    const char *latency = getenv("MOCK_DRV_LATENCY_US");
+    if (latency)
+        drv->latency_ns = strtoull(latency, NULL, 10) * 1000;
+
+    const char *threads = getenv("MOCK_DRV_THREADS");
+    if (threads && atoi(threads) > 0)
+        drv->thread_count = atoi(threads);
+
+    const char *max_size = getenv("MOCK_DRV_MAX_SIZE");
+    int max_width;
+    int max_height;
+    if (max_size && sscanf(max_size, "%dx%d", &max_width, &max_height) == 2 && max_width > 0 &&
+        max_height > 0) {
+        drv->max_width = max_width;
+        drv->max_height = max_height;
+    }
+}
+
+VAStatus __attribute__((visibility("default"))) __vaDriverInit_1_0(VADriverContextP ctx);
+
+VAStatus
+__vaDriverInit_1_0(VADriverContextP ctx)
+{
+    struct mock_driver *drv = calloc(1, sizeof(*drv));
+    if (!drv)
+        return VA_STATUS_ERROR_ALLOCATION_FAILED;
+
+    pthread_mutex_init(&drv->mutex, NULL);
+    mock_init_params(drv);
+
+    ctx->pDriverData = drv;
+    ctx->max_profiles = 1;
+    ctx->max_entrypoints = 1;
+    ctx->max_attributes = VAConfigAttribTypeMax;
+    ctx->max_image_formats = MOCK_FORMAT_COUNT;
+    /* libva requires non-zero maximums even when nothing is supported */
+    ctx->max_subpic_formats = 1;
+    ctx->max_display_attributes = 1;
+    ctx->str_vendor = MOCK_VENDOR;
+
+    struct VADriverVTable *vtable = ctx->vtable;
+    vtable->vaTerminate = mock_terminate;
+    vtable->vaQueryConfigProfiles = mock_query_config_profiles;
+    vtable->vaQueryConfigEntrypoints = mock_query_config_entrypoints;
+    vtable->vaGetConfigAttributes = mock_get_config_attributes;
+    vtable->vaCreateConfig = mock_create_config;
+    vtable->vaDestroyConfig = mock_destroy_config;
+    vtable->vaQueryConfigAttributes = mock_query_config_attributes;
+    vtable->vaQuerySurfaceAttributes = mock_query_surface_attributes;
+    vtable->vaCreateSurfaces = mock_create_surfaces;
+    vtable->vaCreateSurfaces2 = mock_create_surfaces2;
+    vtable->vaDestroySurfaces = mock_destroy_surfaces;
+    vtable->vaCreateContext = mock_create_context;
+    vtable->vaDestroyContext = mock_destroy_context;
+    vtable->vaCreateBuffer = mock_create_buffer;
+    vtable->vaBufferSetNumElements = mock_buffer_set_num_elements;
+    vtable->vaMapBuffer = mock_map_buffer;
+    vtable->vaUnmapBuffer = mock_unmap_buffer;
+    vtable->vaDestroyBuffer = mock_destroy_buffer;
+    vtable->vaBufferInfo = mock_buffer_info;
+    vtable->vaBeginPicture = mock_begin_picture;
+    vtable->vaRenderPicture = mock_render_picture;
+    vtable->vaEndPicture = mock_end_picture;
+    vtable->vaSyncSurface = mock_sync_surface;
+#if VA_CHECK_VERSION(1, 9, 0)
+    vtable->vaSyncSurface2 = mock_sync_surface2;
+#endif
+    vtable->vaQuerySurfaceStatus = mock_query_surface_status;
+    vtable->vaQuerySurfaceError = mock_query_surface_error;
+    vtable->vaPutSurface = mock_put_surface;
+    vtable->vaQueryImageFormats = mock_query_image_formats;
+    vtable->vaCreateImage = mock_create_image;
+    vtable->vaDeriveImage = mock_derive_image;
+    vtable->vaDestroyImage = mock_destroy_image;
+    vtable->vaSetImagePalette = mock_set_image_palette;
+    vtable->vaGetImage = mock_get_image;
+    vtable->vaPutImage = mock_put_image;
+    vtable->vaQuerySubpictureFormats = mock_query_subpicture_formats;
+    vtable->vaCreateSubpicture = mock_create_subpicture;
+    vtable->vaDestroySubpicture = mock_destroy_subpicture;
+    vtable->vaSetSubpictureImage = mock_set_subpicture_image;
+    vtable->vaSetSubpictureChromakey = mock_set_subpicture_chromakey;
+    vtable->vaSetSubpictureGlobalAlpha = mock_set_subpicture_global_alpha;
+    vtable->vaAssociateSubpicture = mock_associate_subpicture;
+    vtable->vaDeassociateSubpicture = mock_deassociate_subpicture;
+    vtable->vaQueryDisplayAttributes = mock_query_display_attributes;
+    vtable->vaGetDisplayAttributes = mock_get_display_attributes;
+    vtable->vaSetDisplayAttributes = mock_set_display_attributes;
+
+    return VA_STATUS_SUCCESS;
+}
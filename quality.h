@@ -0,0 +1,303 @@
+/*
+ * Copyright 2022 Google LLC
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef QUALITY_H
+#define QUALITY_H
+
+/*
+ * PSNR and SSIM of 8-bit planes.  The kernels use SSE2 when the compiler
+ * targets it and fall back to scalar code otherwise.  SSIM is the mean over
+ * 8x8 windows placed every 4 samples, which are summed from 4x4 blocks so
+ * that every sample is only loaded once.
+ */
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+struct quality_plane {
+    /* first byte of the plane */
+    const uint8_t *data;
+    uint32_t pitch;
+    /* 1 for planar samples, 2 for interleaved components */
+    uint32_t step;
+    /* which of the interleaved components */
+    uint32_t component;
+    uint32_t width;
+    uint32_t height;
+};
+
+struct quality_result {
+    double psnr;
+    double ssim;
+};
+
+struct quality_sums {
+    uint64_t a;
+    uint64_t b;
+    uint64_t aa;
+    uint64_t bb;
+    uint64_t ab;
+};
+
+static inline void
+quality_nv12_planes(const uint8_t *data,
+                    const uint32_t *pitches,
+                    const uint32_t *offsets,
+                    uint32_t width,
+                    uint32_t height,
+                    struct quality_plane planes[3])
+{
+    planes[0] = (struct quality_plane){
+        .data = data + offsets[0],
+        .pitch = pitches[0],
+        .step = 1,
+        .width = width,
+        .height = height,
+    };
+    for (int i = 1; i < 3; i++) {
+        planes[i] = (struct quality_plane){
+            .data = data + offsets[1],
+            .pitch = pitches[1],
+            .step = 2,
+            .component = i - 1,
+            .width = (width + 1) / 2,
+            .height = (height + 1) / 2,
+        };
+    }
+}
+
+static inline const uint8_t *
+quality_plane_row(const struct quality_plane *plane, uint32_t y)
+{
+    return plane->data + plane->pitch * y;
+}
+
+static inline int
+quality_plane_sample(const struct quality_plane *plane, const uint8_t *row, uint32_t x)
+{
+    return row[x * plane->step + plane->component];
+}
+
+#ifdef __SSE2__
+
+/* loads 8 samples starting at x as 16-bit lanes */
+static inline __m128i
+quality_load8(const struct quality_plane *plane, const uint8_t *row, uint32_t x)
+{
+    if (plane->step == 1) {
+        const __m128i v = _mm_loadl_epi64((const __m128i *)(row + x));
+        return _mm_unpacklo_epi8(v, _mm_setzero_si128());
+    }
+
+    const __m128i v = _mm_loadu_si128((const __m128i *)(row + x * 2));
+    return plane->component ? _mm_srli_epi16(v, 8) : _mm_and_si128(v, _mm_set1_epi16(0xff));
+}
+
+static inline uint64_t
+quality_hsum_epi32(__m128i v)
+{
+    uint32_t lanes[4];
+    _mm_storeu_si128((__m128i *)lanes, v);
+    return (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+#endif /* __SSE2__ */
+
+static inline uint64_t
+quality_sse(const struct quality_plane *a, const struct quality_plane *b)
+{
+    uint64_t sse = 0;
+
+    for (uint32_t y = 0; y < a->height; y++) {
+        const uint8_t *row_a = quality_plane_row(a, y);
+        const uint8_t *row_b = quality_plane_row(b, y);
+        uint32_t x = 0;
+
+#ifdef __SSE2__
+        __m128i acc = _mm_setzero_si128();
+        for (; x + 8 <= a->width; x += 8) {
+            const __m128i d =
+                _mm_sub_epi16(quality_load8(a, row_a, x), quality_load8(b, row_b, x));
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(d, d));
+        }
+        sse += quality_hsum_epi32(acc);
+#endif
+
+        for (; x < a->width; x++) {
+            const int d = quality_plane_sample(a, row_a, x) - quality_plane_sample(b, row_b, x);
+            sse += d * d;
+        }
+    }
+
+    return sse;
+}
+
+static inline double
+quality_psnr(uint64_t sse, uint64_t count)
+{
+    if (!sse)
+        return INFINITY;
+    return 10.0 * log10(255.0 * 255.0 * (double)count / (double)sse);
+}
+
+static inline double
+quality_ssim_window(const struct quality_sums *s, double n)
+{
+    const double c1 = 0.01 * 0.01 * 255 * 255 * n * n;
+    const double c2 = 0.03 * 0.03 * 255 * 255 * n * n;
+    const double ab = (double)s->a * s->b;
+    const double a2_b2 = (double)s->a * s->a + (double)s->b * s->b;
+
+    const double num = (2 * ab + c1) * (2 * (n * s->ab - ab) + c2);
+    const double den = (a2_b2 + c1) * (n * ((double)s->aa + s->bb) - a2_b2 + c2);
+    return num / den;
+}
+
+static inline void
+quality_sums_add(struct quality_sums *dst, const struct quality_sums *src)
+{
+    dst->a += src->a;
+    dst->b += src->b;
+    dst->aa += src->aa;
+    dst->bb += src->bb;
+    dst->ab += src->ab;
+}
+
+static inline void
+quality_sums_region(const struct quality_plane *a,
+                    const struct quality_plane *b,
+                    uint32_t x0,
+                    uint32_t y0,
+                    uint32_t width,
+                    uint32_t height,
+                    struct quality_sums *sums)
+{
+    *sums = (struct quality_sums){ 0 };
+    for (uint32_t y = y0; y < y0 + height; y++) {
+        const uint8_t *row_a = quality_plane_row(a, y);
+        const uint8_t *row_b = quality_plane_row(b, y);
+        for (uint32_t x = x0; x < x0 + width; x++) {
+            const uint32_t va = quality_plane_sample(a, row_a, x);
+            const uint32_t vb = quality_plane_sample(b, row_b, x);
+            sums->a += va;
+            sums->b += vb;
+            sums->aa += va * va;
+            sums->bb += vb * vb;
+            sums->ab += va * vb;
+        }
+    }
+}
+
+/* sums of the 4x4 blocks in the band of rows [y, y + 4) */
+static inline void
+quality_sums_band(const struct quality_plane *a,
+                  const struct quality_plane *b,
+                  uint32_t y,
+                  struct quality_sums *blocks,
+                  uint32_t block_count)
+{
+    uint32_t bx = 0;
+
+#ifdef __SSE2__
+    const __m128i ones = _mm_set1_epi16(1);
+    for (; bx + 2 <= block_count; bx += 2) {
+        __m128i sa = _mm_setzero_si128();
+        __m128i sb = _mm_setzero_si128();
+        __m128i saa = _mm_setzero_si128();
+        __m128i sbb = _mm_setzero_si128();
+        __m128i sab = _mm_setzero_si128();
+        for (uint32_t i = 0; i < 4; i++) {
+            const __m128i va = quality_load8(a, quality_plane_row(a, y + i), bx * 4);
+            const __m128i vb = quality_load8(b, quality_plane_row(b, y + i), bx * 4);
+            sa = _mm_add_epi16(sa, va);
+            sb = _mm_add_epi16(sb, vb);
+            saa = _mm_add_epi32(saa, _mm_madd_epi16(va, va));
+            sbb = _mm_add_epi32(sbb, _mm_madd_epi16(vb, vb));
+            sab = _mm_add_epi32(sab, _mm_madd_epi16(va, vb));
+        }
+
+        /* lanes 0-1 belong to the first block and lanes 2-3 to the second */
+        uint32_t lanes[5][4];
+        _mm_storeu_si128((__m128i *)lanes[0], _mm_madd_epi16(sa, ones));
+        _mm_storeu_si128((__m128i *)lanes[1], _mm_madd_epi16(sb, ones));
+        _mm_storeu_si128((__m128i *)lanes[2], saa);
+        _mm_storeu_si128((__m128i *)lanes[3], sbb);
+        _mm_storeu_si128((__m128i *)lanes[4], sab);
+        for (int j = 0; j < 2; j++) {
+            blocks[bx + j] = (struct quality_sums){
+                .a = lanes[0][j * 2] + lanes[0][j * 2 + 1],
+                .b = lanes[1][j * 2] + lanes[1][j * 2 + 1],
+                .aa = lanes[2][j * 2] + lanes[2][j * 2 + 1],
+                .bb = lanes[3][j * 2] + lanes[3][j * 2 + 1],
+                .ab = lanes[4][j * 2] + lanes[4][j * 2 + 1],
+            };
+        }
+    }
+#endif
+
+    for (; bx < block_count; bx++)
+        quality_sums_region(a, b, bx * 4, y, 4, 4, &blocks[bx]);
+}
+
+static inline double
+quality_ssim(const struct quality_plane *a, const struct quality_plane *b)
+{
+    const uint32_t blocks_w = a->width / 4;
+    const uint32_t blocks_h = a->height / 4;
+
+    /* too small for 8x8 windows; treat the plane as one window */
+    if (blocks_w < 2 || blocks_h < 2) {
+        struct quality_sums sums;
+        quality_sums_region(a, b, 0, 0, a->width, a->height, &sums);
+        return quality_ssim_window(&sums, (double)a->width * a->height);
+    }
+
+    struct quality_sums *bands = malloc(sizeof(*bands) * blocks_w * 2);
+    if (!bands)
+        return NAN;
+
+    struct quality_sums *prev = bands;
+    struct quality_sums *cur = bands + blocks_w;
+    double total = 0.0;
+
+    quality_sums_band(a, b, 0, prev, blocks_w);
+    for (uint32_t by = 1; by < blocks_h; by++) {
+        quality_sums_band(a, b, by * 4, cur, blocks_w);
+
+        for (uint32_t bx = 0; bx + 1 < blocks_w; bx++) {
+            struct quality_sums window = prev[bx];
+            quality_sums_add(&window, &prev[bx + 1]);
+            quality_sums_add(&window, &cur[bx]);
+            quality_sums_add(&window, &cur[bx + 1]);
+            total += quality_ssim_window(&window, 64.0);
+        }
+
+        struct quality_sums *tmp = prev;
+        prev = cur;
+        cur = tmp;
+    }
+
+    free(bands);
+
+    return total / ((double)(blocks_w - 1) * (blocks_h - 1));
+}
+
+static inline void
+quality_compare(const struct quality_plane *a,
+                const struct quality_plane *b,
+                struct quality_result *result)
+{
+    const uint64_t sse = quality_sse(a, b);
+    result->psnr = quality_psnr(sse, (uint64_t)a->width * a->height);
+    result->ssim = quality_ssim(a, b);
+}
+
+#endif /* QUALITY_H */
@@ -0,0 +1,660 @@
+/*
+ * Copyright 2022 Google LLC
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef SWJPEG_H
+#define SWJPEG_H
+
+/*
+ * A software JPEG baseline decoder.  It consumes the same parameter buffers
+ * as VAProfileJPEGBaseline and outputs NV12 so that it can be compared
+ * against hardware decoders.
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <va/va.h>
+
+#define SWJPEG_MAX_COMPONENTS 4
+#define SWJPEG_MAX_THREADS 64
+#define SWJPEG_LOOKAHEAD 9
+
+struct swjpeg_huffman {
+    /* (length << 8) | value for codes no longer than SWJPEG_LOOKAHEAD */
+    uint16_t lookup[1 << SWJPEG_LOOKAHEAD];
+    int32_t maxcode[18];
+    int32_t valoffset[17];
+    uint8_t values[256];
+};
+
+struct swjpeg_component {
+    int id;
+    int h;
+    int v;
+    int tq;
+
+    uint8_t *plane;
+    int pitch;
+    int blocks_w;
+    int blocks_h;
+};
+
+struct swjpeg_decoder {
+    int width;
+    int height;
+
+    struct swjpeg_component components[SWJPEG_MAX_COMPONENTS];
+    int component_count;
+    int hmax;
+    int vmax;
+    int mcu_cols;
+    int mcu_rows;
+
+    /* in zigzag order */
+    uint16_t quant[4][64];
+    struct swjpeg_huffman dc[2];
+    struct swjpeg_huffman ac[2];
+
+    int thread_count;
+};
+
+struct swjpeg_nv12 {
+    uint8_t *data;
+    uint32_t pitches[2];
+    uint32_t offsets[2];
+};
+
+struct swjpeg_bits {
+    const uint8_t *ptr;
+    const uint8_t *end;
+    uint64_t buf;
+    int count;
+};
+
+struct swjpeg_scan {
+    const struct swjpeg_decoder *dec;
+    int scan_components[SWJPEG_MAX_COMPONENTS];
+    int dc_tables[SWJPEG_MAX_COMPONENTS];
+    int ac_tables[SWJPEG_MAX_COMPONENTS];
+    int scan_component_count;
+
+    int first_mcu;
+    int num_mcus;
+    int restart_interval;
+
+    /* one segment per restart interval */
+    const uint8_t **segments;
+    const uint8_t *end;
+    int segment_count;
+
+    atomic_int next_segment;
+    atomic_bool failed;
+};
+
+static const uint8_t swjpeg_zigzag[64] = {
+    0,  1,  8,  16, 9,  2,  3,  10, 17, 24, 32, 25, 18, 11, 4,  5,  12, 19, 26, 33, 40, 48,
+    41, 34, 27, 20, 13, 6,  7,  14, 21, 28, 35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23,
+    30, 37, 44, 51, 58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+};
+
+static inline void
+swjpeg_init_huffman(struct swjpeg_huffman *huff,
+                    const uint8_t *num_codes,
+                    const uint8_t *values,
+                    int value_max)
+{
+    memset(huff, 0, sizeof(*huff));
+
+    int count = 0;
+    for (int i = 0; i < 16; i++)
+        count += num_codes[i];
+    if (count > value_max)
+        count = value_max;
+    memcpy(huff->values, values, count);
+
+    int code = 0;
+    int k = 0;
+    for (int len = 1; len <= 16; len++) {
+        huff->valoffset[len] = k - code;
+
+        for (int i = 0; i < num_codes[len - 1] && k < count; i++) {
+            if (len <= SWJPEG_LOOKAHEAD) {
+                const int shift = SWJPEG_LOOKAHEAD - len;
+                for (int j = 0; j < (1 << shift); j++)
+                    huff->lookup[(code << shift) | j] = (len << 8) | huff->values[k];
+            }
+            code++;
+            k++;
+        }
+
+        huff->maxcode[len] = num_codes[len - 1] ? code - 1 : -1;
+        code <<= 1;
+    }
+    huff->maxcode[17] = INT32_MAX;
+}
+
+static inline void
+swjpeg_bits_fill(struct swjpeg_bits *bits)
+{
+    while (bits->count <= 56) {
+        uint8_t byte = 0;
+        if (bits->ptr < bits->end) {
+            byte = bits->ptr[0];
+            if (byte == 0xff) {
+                const uint8_t next = bits->ptr + 1 < bits->end ? bits->ptr[1] : 0xd9;
+                if (!next) {
+                    bits->ptr += 2;
+                } else {
+                    /* a marker; feed zeros from now on */
+                    bits->end = bits->ptr;
+                    byte = 0;
+                }
+            } else {
+                bits->ptr++;
+            }
+        }
+
+        bits->buf |= (uint64_t)byte << (56 - bits->count);
+        bits->count += 8;
+    }
+}
+
+static inline int
+swjpeg_bits_get(struct swjpeg_bits *bits, int n)
+{
+    if (!n)
+        return 0;
+
+    swjpeg_bits_fill(bits);
+    const int val = bits->buf >> (64 - n);
+    bits->buf <<= n;
+    bits->count -= n;
+    return val;
+}
+
+static inline int
+swjpeg_bits_decode(struct swjpeg_bits *bits, const struct swjpeg_huffman *huff)
+{
+    swjpeg_bits_fill(bits);
+
+    const uint16_t entry = huff->lookup[bits->buf >> (64 - SWJPEG_LOOKAHEAD)];
+    if (entry) {
+        const int len = entry >> 8;
+        bits->buf <<= len;
+        bits->count -= len;
+        return entry & 0xff;
+    }
+
+    for (int len = SWJPEG_LOOKAHEAD + 1; len <= 16; len++) {
+        const int code = bits->buf >> (64 - len);
+        if (code <= huff->maxcode[len]) {
+            bits->buf <<= len;
+            bits->count -= len;
+            return huff->values[(huff->valoffset[len] + code) & 0xff];
+        }
+    }
+
+    return -1;
+}
+
+static inline int
+swjpeg_extend(int val, int size)
+{
+    return val < (1 << (size - 1)) ? val - (1 << size) + 1 : val;
+}
+
+/* the fixed-point constants of the islow IDCT of libjpeg, which factors the
+ * 8-point IDCT after Loeffler, Ligtenberg and Moschytz
+ */
+#define SWJPEG_IDCT_CONST_BITS 13
+#define SWJPEG_IDCT_PASS1_BITS 2
+#define SWJPEG_IDCT_FIX_0_298631336 2446
+#define SWJPEG_IDCT_FIX_0_390180644 3196
+#define SWJPEG_IDCT_FIX_0_541196100 4433
+#define SWJPEG_IDCT_FIX_0_765366865 6270
+#define SWJPEG_IDCT_FIX_0_899976223 7373
+#define SWJPEG_IDCT_FIX_1_175875602 9633
+#define SWJPEG_IDCT_FIX_1_501321110 12299
+#define SWJPEG_IDCT_FIX_1_847759065 15137
+#define SWJPEG_IDCT_FIX_1_961570560 16069
+#define SWJPEG_IDCT_FIX_2_053119869 16819
+#define SWJPEG_IDCT_FIX_2_562915447 20995
+#define SWJPEG_IDCT_FIX_3_072711026 25172
+
+static inline int64_t
+swjpeg_idct_descale(int64_t val, int bits)
+{
+    return (val + ((int64_t)1 << (bits - 1))) >> bits;
+}
+
+/* one 8-point IDCT over in[0], in[stride], ..., scaled up by 1 << CONST_BITS;
+ * 64-bit sums do not overflow on the coefficients of corrupt scans
+ */
+static inline void
+swjpeg_idct_1d(const int64_t *in, int stride, int64_t out[8])
+{
+    /* even part */
+    int64_t z2 = in[stride * 2];
+    int64_t z3 = in[stride * 6];
+    int64_t z1 = (z2 + z3) * SWJPEG_IDCT_FIX_0_541196100;
+    const int64_t even2 = z1 - z3 * SWJPEG_IDCT_FIX_1_847759065;
+    const int64_t even3 = z1 + z2 * SWJPEG_IDCT_FIX_0_765366865;
+
+    z2 = in[0];
+    z3 = in[stride * 4];
+    const int64_t even0 = (z2 + z3) * (1 << SWJPEG_IDCT_CONST_BITS);
+    const int64_t even1 = (z2 - z3) * (1 << SWJPEG_IDCT_CONST_BITS);
+
+    const int64_t tmp10 = even0 + even3;
+    const int64_t tmp13 = even0 - even3;
+    const int64_t tmp11 = even1 + even2;
+    const int64_t tmp12 = even1 - even2;
+
+    /* odd part */
+    int64_t tmp0 = in[stride * 7];
+    int64_t tmp1 = in[stride * 5];
+    int64_t tmp2 = in[stride * 3];
+    int64_t tmp3 = in[stride * 1];
+
+    z1 = tmp0 + tmp3;
+    z2 = tmp1 + tmp2;
+    z3 = tmp0 + tmp2;
+    int64_t z4 = tmp1 + tmp3;
+    const int64_t z5 = (z3 + z4) * SWJPEG_IDCT_FIX_1_175875602;
+
+    tmp0 *= SWJPEG_IDCT_FIX_0_298631336;
+    tmp1 *= SWJPEG_IDCT_FIX_2_053119869;
+    tmp2 *= SWJPEG_IDCT_FIX_3_072711026;
+    tmp3 *= SWJPEG_IDCT_FIX_1_501321110;
+    z1 *= -SWJPEG_IDCT_FIX_0_899976223;
+    z2 *= -SWJPEG_IDCT_FIX_2_562915447;
+    z3 = z3 * -SWJPEG_IDCT_FIX_1_961570560 + z5;
+    z4 = z4 * -SWJPEG_IDCT_FIX_0_390180644 + z5;
+
+    tmp0 += z1 + z3;
+    tmp1 += z2 + z4;
+    tmp2 += z2 + z3;
+    tmp3 += z1 + z4;
+
+    out[0] = tmp10 + tmp3;
+    out[7] = tmp10 - tmp3;
+    out[1] = tmp11 + tmp2;
+    out[6] = tmp11 - tmp2;
+    out[2] = tmp12 + tmp1;
+    out[5] = tmp12 - tmp1;
+    out[3] = tmp13 + tmp0;
+    out[4] = tmp13 - tmp0;
+}
+
+/* a separable integer IDCT, columns then rows, with the DC-only shortcut of
+ * libjpeg for columns whose AC coefficients are all zero
+ */
+static inline void
+swjpeg_idct(const int32_t *coefs, uint8_t *dst, int pitch)
+{
+    bool dc_only = true;
+    for (int i = 1; i < 64; i++) {
+        if (coefs[i]) {
+            dc_only = false;
+            break;
+        }
+    }
+
+    if (dc_only) {
+        const int64_t val = swjpeg_idct_descale(coefs[0], 3) + 128;
+        const uint8_t pixel = val < 0 ? 0 : val > 255 ? 255 : val;
+        for (int y = 0; y < 8; y++)
+            memset(dst + pitch * y, pixel, 8);
+        return;
+    }
+
+    int64_t in[64];
+    for (int i = 0; i < 64; i++)
+        in[i] = coefs[i];
+
+    /* columns, keeping PASS1_BITS of extra precision */
+    int64_t tmp[64];
+    for (int x = 0; x < 8; x++) {
+        bool ac_zero = true;
+        for (int y = 1; y < 8; y++) {
+            if (in[y * 8 + x]) {
+                ac_zero = false;
+                break;
+            }
+        }
+
+        if (ac_zero) {
+            for (int y = 0; y < 8; y++)
+                tmp[y * 8 + x] = in[x] * (1 << SWJPEG_IDCT_PASS1_BITS);
+            continue;
+        }
+
+        int64_t out[8];
+        swjpeg_idct_1d(in + x, 8, out);
+        for (int y = 0; y < 8; y++) {
+            tmp[y * 8 + x] =
+                swjpeg_idct_descale(out[y], SWJPEG_IDCT_CONST_BITS - SWJPEG_IDCT_PASS1_BITS);
+        }
+    }
+
+    /* rows, removing the extra precision and the factor of 8 */
+    const int shift = SWJPEG_IDCT_CONST_BITS + SWJPEG_IDCT_PASS1_BITS + 3;
+    for (int y = 0; y < 8; y++) {
+        int64_t out[8];
+        swjpeg_idct_1d(tmp + y * 8, 1, out);
+        for (int x = 0; x < 8; x++) {
+            const int64_t val = swjpeg_idct_descale(out[x], shift) + 128;
+            dst[pitch * y + x] = val < 0 ? 0 : val > 255 ? 255 : val;
+        }
+    }
+}
+
+static inline bool
+swjpeg_decode_block(struct swjpeg_bits *bits,
+                    const struct swjpeg_huffman *dc,
+                    const struct swjpeg_huffman *ac,
+                    const uint16_t *quant,
+                    int *pred,
+                    uint8_t *dst,
+                    int pitch)
+{
+    int32_t coefs[64] = { 0 };
+
+    const int s = swjpeg_bits_decode(bits, dc);
+    if (s < 0 || s > 11)
+        return false;
+    *pred += s ? swjpeg_extend(swjpeg_bits_get(bits, s), s) : 0;
+    coefs[0] = *pred * quant[0];
+
+    for (int k = 1; k < 64;) {
+        const int rs = swjpeg_bits_decode(bits, ac);
+        if (rs < 0)
+            return false;
+
+        const int r = rs >> 4;
+        const int size = rs & 0xf;
+        if (!size) {
+            if (r != 15)
+                break;
+            k += 16;
+            continue;
+        }
+
+        k += r;
+        if (k > 63)
+            return false;
+        coefs[swjpeg_zigzag[k]] = swjpeg_extend(swjpeg_bits_get(bits, size), size) * quant[k];
+        k++;
+    }
+
+    swjpeg_idct(coefs, dst, pitch);
+    return true;
+}
+
+static inline bool
+swjpeg_decode_segment(struct swjpeg_scan *scan, int seg)
+{
+    const struct swjpeg_decoder *dec = scan->dec;
+
+    int first = seg * scan->restart_interval;
+    int count = scan->restart_interval ? scan->restart_interval : scan->num_mcus;
+    if (first + count > scan->num_mcus)
+        count = scan->num_mcus - first;
+    first += scan->first_mcu;
+
+    struct swjpeg_bits bits = {
+        .ptr = scan->segments[seg],
+        .end = seg + 1 < scan->segment_count ? scan->segments[seg + 1] : scan->end,
+    };
+
+    int preds[SWJPEG_MAX_COMPONENTS] = { 0 };
+    for (int mcu = first; mcu < first + count; mcu++) {
+        const int mcu_x = mcu % dec->mcu_cols;
+        const int mcu_y = mcu / dec->mcu_cols;
+        if (mcu_y >= dec->mcu_rows)
+            return false;
+
+        for (int i = 0; i < scan->scan_component_count; i++) {
+            const struct swjpeg_component *comp = &dec->components[scan->scan_components[i]];
+            const struct swjpeg_huffman *dc = &dec->dc[scan->dc_tables[i]];
+            const struct swjpeg_huffman *ac = &dec->ac[scan->ac_tables[i]];
+            const uint16_t *quant = dec->quant[comp->tq];
+
+            for (int v = 0; v < comp->v; v++) {
+                for (int h = 0; h < comp->h; h++) {
+                    const int bx = mcu_x * comp->h + h;
+                    const int by = mcu_y * comp->v + v;
+                    uint8_t *dst = comp->plane + comp->pitch * by * 8 + bx * 8;
+
+                    if (!swjpeg_decode_block(&bits, dc, ac, quant, &preds[i], dst, comp->pitch))
+                        return false;
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+static inline void *
+swjpeg_decode_thread(void *arg)
+{
+    struct swjpeg_scan *scan = arg;
+
+    while (!atomic_load(&scan->failed)) {
+        const int seg = atomic_fetch_add(&scan->next_segment, 1);
+        if (seg >= scan->segment_count)
+            break;
+
+        if (!swjpeg_decode_segment(scan, seg))
+            atomic_store(&scan->failed, true);
+    }
+
+    return NULL;
+}
+
+static inline bool
+swjpeg_decoder_init(struct swjpeg_decoder *dec,
+                    const VAPictureParameterBufferJPEGBaseline *pic_param,
+                    const VAIQMatrixBufferJPEGBaseline *iq_matrix,
+                    const VAHuffmanTableBufferJPEGBaseline *huffman_table,
+                    int thread_count)
+{
+    memset(dec, 0, sizeof(*dec));
+
+    if (!pic_param->num_components || pic_param->num_components > SWJPEG_MAX_COMPONENTS)
+        return false;
+
+    dec->width = pic_param->picture_width;
+    dec->height = pic_param->picture_height;
+    dec->component_count = pic_param->num_components;
+    dec->hmax = 1;
+    dec->vmax = 1;
+    for (int i = 0; i < dec->component_count; i++) {
+        struct swjpeg_component *comp = &dec->components[i];
+        comp->id = pic_param->components[i].component_id;
+        comp->h = pic_param->components[i].h_sampling_factor;
+        comp->v = pic_param->components[i].v_sampling_factor;
+        comp->tq = pic_param->components[i].quantiser_table_selector & 0x3;
+        if (comp->h < 1 || comp->h > 4 || comp->v < 1 || comp->v > 4)
+            return false;
+
+        /* a single-component scan is not interleaved */
+        if (dec->component_count == 1)
+            comp->h = comp->v = 1;
+
+        if (comp->h > dec->hmax)
+            dec->hmax = comp->h;
+        if (comp->v > dec->vmax)
+            dec->vmax = comp->v;
+    }
+
+    dec->mcu_cols = (dec->width + dec->hmax * 8 - 1) / (dec->hmax * 8);
+    dec->mcu_rows = (dec->height + dec->vmax * 8 - 1) / (dec->vmax * 8);
+    for (int i = 0; i < dec->component_count; i++) {
+        struct swjpeg_component *comp = &dec->components[i];
+        comp->blocks_w = dec->mcu_cols * comp->h;
+        comp->blocks_h = dec->mcu_rows * comp->v;
+        comp->pitch = comp->blocks_w * 8;
+        comp->plane = malloc((size_t)comp->pitch * comp->blocks_h * 8);
+        if (!comp->plane)
+            return false;
+    }
+
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 64; j++)
+            dec->quant[i][j] = iq_matrix->quantiser_table[i][j];
+    }
+
+    for (int i = 0; i < 2; i++) {
+        swjpeg_init_huffman(&dec->dc[i], huffman_table->huffman_table[i].num_dc_codes,
+                            huffman_table->huffman_table[i].dc_values,
+                            sizeof(huffman_table->huffman_table[i].dc_values));
+        swjpeg_init_huffman(&dec->ac[i], huffman_table->huffman_table[i].num_ac_codes,
+                            huffman_table->huffman_table[i].ac_values,
+                            sizeof(huffman_table->huffman_table[i].ac_values));
+    }
+
+    if (thread_count <= 0)
+        thread_count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (thread_count > SWJPEG_MAX_THREADS)
+        thread_count = SWJPEG_MAX_THREADS;
+    dec->thread_count = thread_count > 0 ? thread_count : 1;
+
+    return true;
+}
+
+static inline void
+swjpeg_decoder_cleanup(struct swjpeg_decoder *dec)
+{
+    for (int i = 0; i < dec->component_count; i++)
+        free(dec->components[i].plane);
+}
+
+/* slice_data points to the data of the slice buffer, before slice_data_offset */
+static inline bool
+swjpeg_decoder_decode_slice(struct swjpeg_decoder *dec,
+                            const VASliceParameterBufferJPEGBaseline *slice_param,
+                            const void *slice_data)
+{
+    struct swjpeg_scan scan = {
+        .dec = dec,
+        .scan_component_count = slice_param->num_components,
+        .first_mcu = slice_param->slice_vertical_position * dec->mcu_cols +
+                     slice_param->slice_horizontal_position,
+        .num_mcus = slice_param->num_mcus,
+        .restart_interval = slice_param->restart_interval,
+    };
+
+    if (scan.scan_component_count != dec->component_count)
+        return false;
+    for (int i = 0; i < scan.scan_component_count; i++) {
+        int idx = -1;
+        for (int j = 0; j < dec->component_count; j++) {
+            if (dec->components[j].id == slice_param->components[i].component_selector) {
+                idx = j;
+                break;
+            }
+        }
+        if (idx < 0)
+            return false;
+
+        scan.scan_components[i] = idx;
+        scan.dc_tables[i] = slice_param->components[i].dc_table_selector & 0x1;
+        scan.ac_tables[i] = slice_param->components[i].ac_table_selector & 0x1;
+    }
+
+    const uint8_t *data = (const uint8_t *)slice_data + slice_param->slice_data_offset;
+    scan.end = data + slice_param->slice_data_size;
+
+    int segment_max = 1;
+    if (scan.restart_interval)
+        segment_max = (scan.num_mcus + scan.restart_interval - 1) / scan.restart_interval;
+    scan.segments = malloc(sizeof(*scan.segments) * segment_max);
+    if (!scan.segments)
+        return false;
+
+    /* split the scan at RSTn markers */
+    scan.segments[scan.segment_count++] = data;
+    for (const uint8_t *p = data; p + 1 < scan.end && scan.segment_count < segment_max; p++) {
+        if (p[0] == 0xff && p[1] >= 0xd0 && p[1] <= 0xd7) {
+            scan.segments[scan.segment_count++] = p + 2;
+            p++;
+        }
+    }
+
+    int thread_count = dec->thread_count;
+    if (thread_count > scan.segment_count)
+        thread_count = scan.segment_count;
+
+    pthread_t threads[SWJPEG_MAX_THREADS];
+    int started = 0;
+    for (int i = 1; i < thread_count; i++) {
+        if (pthread_create(&threads[started], NULL, swjpeg_decode_thread, &scan))
+            break;
+        started++;
+    }
+    swjpeg_decode_thread(&scan);
+    for (int i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+
+    free(scan.segments);
+
+    return !atomic_load(&scan.failed);
+}
+
+static inline uint8_t
+swjpeg_sample_chroma(const struct swjpeg_decoder *dec,
+                     const struct swjpeg_component *comp,
+                     int x,
+                     int y)
+{
+    /* average the samples covering the 2x2 luma block at (x, y), without
+     * the MCU padding past the right and bottom edges
+     */
+    const int x1 = x + 1 < dec->width ? x + 1 : x;
+    const int y1 = y + 1 < dec->height ? y + 1 : y;
+    int sum = 0;
+    for (int j = 0; j < 2; j++) {
+        for (int i = 0; i < 2; i++) {
+            const int cx = (i ? x1 : x) * comp->h / dec->hmax;
+            const int cy = (j ? y1 : y) * comp->v / dec->vmax;
+            sum += comp->plane[comp->pitch * cy + cx];
+        }
+    }
+    return (sum + 2) / 4;
+}
+
+static inline void
+swjpeg_decoder_output_nv12(const struct swjpeg_decoder *dec, const struct swjpeg_nv12 *out)
+{
+    const struct swjpeg_component *y_comp = &dec->components[0];
+    for (int y = 0; y < dec->height; y++) {
+        memcpy(out->data + out->offsets[0] + out->pitches[0] * y,
+               y_comp->plane + y_comp->pitch * y, dec->width);
+    }
+
+    const int chroma_width = (dec->width + 1) / 2;
+    const int chroma_height = (dec->height + 1) / 2;
+    for (int y = 0; y < chroma_height; y++) {
+        uint8_t *dst = out->data + out->offsets[1] + out->pitches[1] * y;
+
+        if (dec->component_count < 3) {
+            memset(dst, 128, chroma_width * 2);
+            continue;
+        }
+
+        for (int x = 0; x < chroma_width; x++) {
+            dst[2 * x + 0] = swjpeg_sample_chroma(dec, &dec->components[1], x * 2, y * 2);
+            dst[2 * x + 1] = swjpeg_sample_chroma(dec, &dec->components[2], x * 2, y * 2);
+        }
+    }
+}
+
+#endif /* SWJPEG_H */
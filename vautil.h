@@ -8,6 +8,7 @@
 
 #include <assert.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <math.h>
 #include <stdarg.h>
 #include <stdbool.h>
@@ -16,6 +17,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
 #include <unistd.h>
 #include <va/va.h>
 #include <va/va_drm.h>
@@ -25,16 +28,149 @@
 #define PRINTFLIKE(f, a) __attribute__((format(printf, f, a)))
 #define NORETURN __attribute__((noreturn))
 #define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+#define MIN2(a, b) ((a) < (b) ? (a) : (b))
+#define MAX2(a, b) ((a) > (b) ? (a) : (b))
+
+#define VA_STATS_BUCKET_COUNT 32
+#define VA_USERPTR_PITCH_ALIGN 128
+#define VA_USERPTR_HEIGHT_ALIGN 32
+#define VA_SYNC_DEFAULT_TIMEOUT_NS 1000000ull
+#define VA_SYNC_DEFAULT_DEADLINE_NS 10000000000ull
+#define VA_SYNC_POLL_MIN_NS 10000ull
+#define VA_SYNC_POLL_MAX_NS 1000000ull
+
+enum va_sync_mode {
+    /* vaSyncSurface */
+    VA_SYNC_BLOCKING,
+    /* vaSyncSurface2 with a timeout, retried until the surface is ready or
+     * the deadline passes
+     */
+    VA_SYNC_TIMED,
+    /* vaQuerySurfaceStatus with exponential backoff */
+    VA_SYNC_POLL,
+
+    VA_SYNC_MODE_COUNT,
+};
 
 struct va_init_params {
-    int unused;
+    /* collect per-call latencies and live object sizes */
+    bool stats;
+    /* count live objects only, without timing any call */
+    bool track_objects;
+    /* write a Chrome Trace Event file */
+    const char *trace_file;
+    /* how va_sync_surface waits */
+    enum va_sync_mode sync_mode;
+    /* per vaSyncSurface2 call, VA_SYNC_DEFAULT_TIMEOUT_NS when 0 */
+    uint64_t sync_timeout_ns;
+    /* per timed or polled wait, VA_SYNC_DEFAULT_DEADLINE_NS when 0 */
+    uint64_t sync_deadline_ns;
+    /* exit with VA_EXIT_SKIP instead of failing when there is no render node */
+    bool skip_without_device;
+};
+
+/* the exit status that meson test reports as skipped */
+#define VA_EXIT_SKIP 77
+
+/* vaSyncSurface2 and its timeout status are new in libva 2.9 (VA-API 1.9);
+ * va->sync_expired, not the status, tells a deadline apart from driver errors
+ */
+#if VA_CHECK_VERSION(1, 9, 0)
+#define VA_SYNC_STATUS_TIMEDOUT VA_STATUS_ERROR_TIMEDOUT
+#else
+#define VA_SYNC_STATUS_TIMEDOUT VA_STATUS_ERROR_UNKNOWN
+#endif
+
+enum va_call {
+    VA_CALL_CREATE_CONFIG,
+    VA_CALL_DESTROY_CONFIG,
+    VA_CALL_CREATE_SURFACE,
+    VA_CALL_DESTROY_SURFACE,
+    VA_CALL_SYNC_SURFACE,
+    VA_CALL_CREATE_CONTEXT,
+    VA_CALL_DESTROY_CONTEXT,
+    VA_CALL_CREATE_BUFFER,
+    VA_CALL_DESTROY_BUFFER,
+    VA_CALL_MAP_BUFFER,
+    VA_CALL_UNMAP_BUFFER,
+    VA_CALL_BEGIN_PICTURE,
+    VA_CALL_RENDER_PICTURE,
+    VA_CALL_END_PICTURE,
+    VA_CALL_CREATE_IMAGE,
+    VA_CALL_DESTROY_IMAGE,
+    VA_CALL_GET_IMAGE,
+
+    VA_CALL_COUNT,
+};
+
+enum va_object_type {
+    VA_OBJECT_SURFACE,
+    VA_OBJECT_BUFFER,
+    VA_OBJECT_IMAGE,
+
+    VA_OBJECT_COUNT,
+};
+
+struct va_call_stats {
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t min_ns;
+    uint64_t max_ns;
+    /* bucket i counts latencies in [2^i, 2^(i+1)) ns */
+    uint64_t buckets[VA_STATS_BUCKET_COUNT];
+};
+
+struct va_sync_stats {
+    uint64_t count;
+    /* from the start of the wait to completion */
+    uint64_t wait_ns;
+    /* cpu time of the waiting thread */
+    uint64_t cpu_ns;
+    /* vaSyncSurface, vaSyncSurface2 or vaQuerySurfaceStatus calls */
+    uint64_t calls;
+    uint64_t timeouts;
+    /* timed syncs that blocked because vaSyncSurface2 is unimplemented */
+    uint64_t fallbacks;
+};
+
+struct va_object {
+    enum va_object_type type;
+    VAGenericID id;
+    uint64_t size;
+};
+
+struct va_stats {
+    struct va_call_stats calls[VA_CALL_COUNT];
+    struct va_sync_stats sync;
+
+    struct va_object *objects;
+    int object_count;
+    int object_max;
+
+    int live_counts[VA_OBJECT_COUNT];
+    uint64_t live_bytes[VA_OBJECT_COUNT];
+    uint64_t resident_bytes;
+    uint64_t peak_resident_bytes;
+};
+
+#define VA_PAIR_ATTR_WORDS ((VAConfigAttribTypeMax + 63) / 64)
+
+struct va_arena {
+    void *ptr;
+    size_t size;
 };
 
 struct va_pair {
     VAProfile profile;
     VAEntrypoint entrypoint;
 
-    VAConfigAttrib attrs[VAConfigAttribTypeMax];
+    /* bit i is set when attr type i is supported */
+    uint64_t attr_mask[VA_PAIR_ATTR_WORDS];
+    /* values of the supported attrs, in type order, start at
+     * va->pair_attrs[attr_offset]
+     */
+    uint32_t attr_offset;
+    uint32_t attr_count;
 };
 
 struct va {
@@ -52,6 +188,7 @@ struct va {
 
     struct va_pair *pairs;
     int pair_count;
+    uint32_t *pair_attrs;
 
     VAImageFormat *img_formats;
     unsigned int img_count;
@@ -59,6 +196,48 @@ struct va {
     VAImageFormat *subpic_formats;
     unsigned int *subpic_flags;
     unsigned int subpic_count;
+
+    struct va_stats stats;
+    /* vaSyncSurface2 is unimplemented, so timed syncs block */
+    bool sync_fallback;
+    /* the last timed or polled sync gave up at its deadline */
+    bool sync_expired;
+
+    FILE *trace;
+    uint64_t trace_epoch;
+    bool trace_empty;
+};
+
+static const char *const va_sync_mode_names[VA_SYNC_MODE_COUNT] = {
+    [VA_SYNC_BLOCKING] = "blocking",
+    [VA_SYNC_TIMED] = "timed",
+    [VA_SYNC_POLL] = "poll",
+};
+
+static const char *const va_call_names[VA_CALL_COUNT] = {
+    [VA_CALL_CREATE_CONFIG] = "create_config",
+    [VA_CALL_DESTROY_CONFIG] = "destroy_config",
+    [VA_CALL_CREATE_SURFACE] = "create_surface",
+    [VA_CALL_DESTROY_SURFACE] = "destroy_surface",
+    [VA_CALL_SYNC_SURFACE] = "sync_surface",
+    [VA_CALL_CREATE_CONTEXT] = "create_context",
+    [VA_CALL_DESTROY_CONTEXT] = "destroy_context",
+    [VA_CALL_CREATE_BUFFER] = "create_buffer",
+    [VA_CALL_DESTROY_BUFFER] = "destroy_buffer",
+    [VA_CALL_MAP_BUFFER] = "map_buffer",
+    [VA_CALL_UNMAP_BUFFER] = "unmap_buffer",
+    [VA_CALL_BEGIN_PICTURE] = "begin_picture",
+    [VA_CALL_RENDER_PICTURE] = "render_picture",
+    [VA_CALL_END_PICTURE] = "end_picture",
+    [VA_CALL_CREATE_IMAGE] = "create_image",
+    [VA_CALL_DESTROY_IMAGE] = "destroy_image",
+    [VA_CALL_GET_IMAGE] = "get_image",
+};
+
+static const char *const va_object_names[VA_OBJECT_COUNT] = {
+    [VA_OBJECT_SURFACE] = "surface",
+    [VA_OBJECT_BUFFER] = "buffer",
+    [VA_OBJECT_IMAGE] = "image",
 };
 
 static inline void
@@ -69,10 +248,28 @@ va_logv(const char *format, va_list ap)
     printf("\n");
 }
 
+/* the open trace, which va_die and exit close so that the JSON stays valid;
+ * forked children leave the trace of their parent alone
+ */
+static FILE *va_trace_fp;
+static pid_t va_trace_pid;
+
+static inline void
+va_trace_close(void)
+{
+    if (!va_trace_fp || va_trace_pid != getpid())
+        return;
+
+    fprintf(va_trace_fp, "\n]}\n");
+    fclose(va_trace_fp);
+    va_trace_fp = NULL;
+}
+
 static inline void NORETURN
 va_diev(const char *format, va_list ap)
 {
     va_logv(format, ap);
+    va_trace_close();
     abort();
 }
 
@@ -103,6 +300,297 @@ static inline void PRINTFLIKE(2, 3) va_check(const struct va *va, const char *fo
     va_end(ap);
 }
 
+static inline uint64_t
+va_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static inline uint64_t
+va_thread_cpu_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* parses "blocking", "timed[:<ms>[:<deadline ms>]]" or "poll[:<deadline ms>]" */
+static inline bool
+va_parse_sync_mode(struct va_init_params *params, const char *str)
+{
+    for (int i = 0; i < VA_SYNC_MODE_COUNT; i++) {
+        const size_t len = strlen(va_sync_mode_names[i]);
+        if (strncmp(str, va_sync_mode_names[i], len))
+            continue;
+
+        if (i != VA_SYNC_BLOCKING && str[len] == ':') {
+            char *end;
+            double ms = strtod(str + len + 1, &end);
+            if (ms <= 0.0)
+                return false;
+            if (i == VA_SYNC_TIMED) {
+                params->sync_timeout_ns = (uint64_t)(ms * 1e6);
+                if (*end != ':')
+                    ms = 0.0;
+                else if ((ms = strtod(end + 1, &end)) <= 0.0)
+                    return false;
+            }
+            if (*end)
+                return false;
+            if (ms > 0.0)
+                params->sync_deadline_ns = (uint64_t)(ms * 1e6);
+        } else if (str[len]) {
+            continue;
+        }
+
+        params->sync_mode = i;
+        return true;
+    }
+
+    return false;
+}
+
+static inline int
+va_compare_u64(const void *a, const void *b)
+{
+    const uint64_t *x = a;
+    const uint64_t *y = b;
+    return *x < *y ? -1 : *x > *y;
+}
+
+/* vals must be sorted */
+static inline uint64_t
+va_percentile(const uint64_t *vals, int count, int pct)
+{
+    if (!count)
+        return 0;
+
+    const int idx = (count - 1) * pct / 100;
+    return vals[idx];
+}
+
+static inline void
+va_trace_event(struct va *va, char phase, const char *name, const char *extra)
+{
+    if (!va->trace)
+        return;
+
+    const double ts = (va_now() - va->trace_epoch) / 1e3;
+    fprintf(va->trace,
+            "%s\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":%ld%s}",
+            va->trace_empty ? "" : ",", name, phase, ts, (int)getpid(), (long)syscall(SYS_gettid),
+            extra ? extra : "");
+    va->trace_empty = false;
+}
+
+static inline void
+va_trace_begin(struct va *va, const char *name)
+{
+    va_trace_event(va, 'B', name, NULL);
+}
+
+static inline void
+va_trace_end(struct va *va, const char *name)
+{
+    va_trace_event(va, 'E', name, NULL);
+}
+
+/* phase is one of 's', 't', or 'f' and must be called inside a begin/end pair */
+static inline void
+va_trace_flow(struct va *va, char phase, const char *name, uint64_t id)
+{
+    char extra[64];
+    snprintf(extra, sizeof(extra), ",\"cat\":\"flow\",\"id\":%" PRIu64 "%s", id,
+             phase == 'f' ? ",\"bp\":\"e\"" : "");
+    va_trace_event(va, phase, name, extra);
+}
+
+static inline void
+va_trace_init(struct va *va)
+{
+    if (!va->params.trace_file)
+        return;
+
+    va->trace = fopen(va->params.trace_file, "w");
+    if (!va->trace)
+        va_die("failed to open %s", va->params.trace_file);
+
+    va->trace_epoch = va_now();
+    va->trace_empty = true;
+    fprintf(va->trace, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+
+    static bool registered;
+    if (!registered && !atexit(va_trace_close))
+        registered = true;
+    va_trace_fp = va->trace;
+    va_trace_pid = getpid();
+}
+
+static inline void
+va_trace_cleanup(struct va *va)
+{
+    if (!va->trace)
+        return;
+
+    if (va->trace == va_trace_fp)
+        va_trace_fp = NULL;
+    fprintf(va->trace, "\n]}\n");
+    fclose(va->trace);
+    va->trace = NULL;
+}
+
+static inline uint64_t
+va_call_begin(struct va *va, enum va_call call)
+{
+    va_trace_begin(va, va_call_names[call]);
+    return va->params.stats ? va_now() : 0;
+}
+
+static inline void
+va_call_end(struct va *va, enum va_call call, uint64_t begin)
+{
+    va_trace_end(va, va_call_names[call]);
+    if (!va->params.stats)
+        return;
+
+    const uint64_t ns = va_now() - begin;
+    struct va_call_stats *stats = &va->stats.calls[call];
+
+    if (!stats->count || ns < stats->min_ns)
+        stats->min_ns = ns;
+    if (ns > stats->max_ns)
+        stats->max_ns = ns;
+    stats->count++;
+    stats->total_ns += ns;
+
+    int bucket = 63 - __builtin_clzll(ns | 1);
+    if (bucket >= VA_STATS_BUCKET_COUNT)
+        bucket = VA_STATS_BUCKET_COUNT - 1;
+    stats->buckets[bucket]++;
+}
+
+static inline void
+va_stats_add_object(struct va *va, enum va_object_type type, VAGenericID id, uint64_t size)
+{
+    struct va_stats *stats = &va->stats;
+    if (!va->params.stats && !va->params.track_objects)
+        return;
+
+    if (stats->object_count >= stats->object_max) {
+        stats->object_max = stats->object_max ? stats->object_max * 2 : 64;
+        stats->objects = realloc(stats->objects, sizeof(*stats->objects) * stats->object_max);
+        if (!stats->objects)
+            va_die("failed to alloc stats objects");
+    }
+    stats->objects[stats->object_count++] = (struct va_object){
+        .type = type,
+        .id = id,
+        .size = size,
+    };
+
+    stats->live_counts[type]++;
+    stats->live_bytes[type] += size;
+    stats->resident_bytes += size;
+    if (stats->resident_bytes > stats->peak_resident_bytes)
+        stats->peak_resident_bytes = stats->resident_bytes;
+}
+
+static inline void
+va_stats_remove_object(struct va *va, enum va_object_type type, VAGenericID id)
+{
+    struct va_stats *stats = &va->stats;
+    if (!va->params.stats && !va->params.track_objects)
+        return;
+
+    /* recently created objects are usually destroyed first */
+    for (int i = stats->object_count - 1; i >= 0; i--) {
+        struct va_object *obj = &stats->objects[i];
+        if (obj->type != type || obj->id != id)
+            continue;
+
+        stats->live_counts[type]--;
+        stats->live_bytes[type] -= obj->size;
+        stats->resident_bytes -= obj->size;
+
+        *obj = stats->objects[--stats->object_count];
+        return;
+    }
+}
+
+static inline uint64_t
+va_stats_surface_size(unsigned int fourcc, unsigned int width, unsigned int height)
+{
+    const uint64_t pixels = (uint64_t)width * height;
+
+    switch (fourcc) {
+    case VA_FOURCC_Y800:
+        return pixels;
+    case VA_FOURCC_NV12:
+    case VA_FOURCC_I420:
+    case VA_FOURCC_YV12:
+    case VA_FOURCC_IMC3:
+    case VA_FOURCC_411P:
+        return pixels * 3 / 2;
+    case VA_FOURCC_YUY2:
+    case VA_FOURCC_UYVY:
+    case VA_FOURCC_422H:
+    case VA_FOURCC_422V:
+        return pixels * 2;
+    case VA_FOURCC_444P:
+    case VA_FOURCC_P010:
+        return pixels * 3;
+    default:
+        return pixels * 4;
+    }
+}
+
+static inline void
+va_stats_dump(const struct va *va)
+{
+    const struct va_stats *stats = &va->stats;
+
+    va_log("call stats:");
+    for (int i = 0; i < VA_CALL_COUNT; i++) {
+        const struct va_call_stats *call = &stats->calls[i];
+        if (!call->count)
+            continue;
+
+        va_log("  %s: %" PRIu64 " calls, total %.3f ms, avg %.3f us, min %.3f us, max %.3f us",
+               va_call_names[i], call->count, call->total_ns / 1e6,
+               call->total_ns / 1e3 / call->count, call->min_ns / 1e3, call->max_ns / 1e3);
+        for (int j = 0; j < VA_STATS_BUCKET_COUNT; j++) {
+            if (!call->buckets[j])
+                continue;
+            va_log("    [%.3f, %.3f) us: %" PRIu64, (double)(1ull << j) / 1e3,
+                   (double)(1ull << (j + 1)) / 1e3, call->buckets[j]);
+        }
+    }
+
+    const struct va_sync_stats *sync = &stats->sync;
+    if (sync->count) {
+        va_log("sync stats (%s): %" PRIu64 " syncs, avg wait %.3f us, avg cpu %.3f us (%.1f%%), "
+               "%.1f calls per sync, %" PRIu64 " timeouts, %" PRIu64 " blocking fallbacks",
+               va_sync_mode_names[va->params.sync_mode], sync->count,
+               sync->wait_ns / 1e3 / sync->count, sync->cpu_ns / 1e3 / sync->count,
+               sync->wait_ns ? 100.0 * sync->cpu_ns / sync->wait_ns : 0.0,
+               (double)sync->calls / sync->count, sync->timeouts, sync->fallbacks);
+    }
+
+    va_log("object stats:");
+    for (int i = 0; i < VA_OBJECT_COUNT; i++) {
+        va_log("  live %ss: %d, %" PRIu64 " bytes", va_object_names[i], stats->live_counts[i],
+               stats->live_bytes[i]);
+    }
+    for (int i = 0; i < stats->object_count; i++) {
+        const struct va_object *obj = &stats->objects[i];
+        va_log("  leaked %s 0x%x: %" PRIu64 " bytes", va_object_names[obj->type], obj->id,
+               obj->size);
+    }
+    va_log("  peak resident: %" PRIu64 " bytes", stats->peak_resident_bytes);
+}
+
 static inline void
 va_init_display_drm(struct va *va)
 {
@@ -124,8 +612,20 @@ va_init_display_drm(struct va *va)
 
     drmFreeDevices(devs, dev_count);
 
-    if (fd < 0)
+    /* drmGetDevices2 skips devices without a known bus, such as vgem */
+    for (int i = 0; fd < 0 && i < 64; i++) {
+        char path[64];
+        snprintf(path, sizeof(path), "%s/%s%d", DRM_DIR_NAME, DRM_RENDER_MINOR_NAME, 128 + i);
+        fd = open(path, O_RDWR | O_CLOEXEC);
+    }
+
+    if (fd < 0) {
+        if (va->params.skip_without_device) {
+            va_log("no render node; skipping");
+            exit(VA_EXIT_SKIP);
+        }
         va_die("failed to find any render node");
+    }
 
     va->native_display = fd;
 }
@@ -189,6 +689,9 @@ va_init_pairs(struct va *va)
     if (!va->pairs)
         va_die("failed to alloc pairs");
 
+    VAConfigAttrib attrs[VAConfigAttribTypeMax];
+    uint32_t attr_total = 0;
+
     struct va_pair *pair = va->pairs;
     for (int i = 0; i < profile_count; i++) {
         int entrypoint_count;
@@ -199,15 +702,36 @@ va_init_pairs(struct va *va)
         for (int j = 0; j < entrypoint_count; j++) {
             assert(pair < va->pairs + va->pair_count);
 
+            memset(pair, 0, sizeof(*pair));
             pair->profile = profiles[i];
             pair->entrypoint = entrypoints[j];
             for (int k = 0; k < VAConfigAttribTypeMax; k++)
-                pair->attrs[k].type = k;
+                attrs[k].type = k;
 
             va->status = vaGetConfigAttributes(va->display, pair->profile, pair->entrypoint,
-                                               pair->attrs, VAConfigAttribTypeMax);
+                                               attrs, VAConfigAttribTypeMax);
             va_check(va, "failed to get config attrs");
 
+            for (int k = 0; k < VAConfigAttribTypeMax; k++) {
+                if (attrs[k].value == VA_ATTRIB_NOT_SUPPORTED)
+                    continue;
+                pair->attr_mask[k / 64] |= 1ull << (k % 64);
+                pair->attr_count++;
+            }
+
+            /* pack the supported values of all pairs into one allocation */
+            pair->attr_offset = attr_total;
+            attr_total += pair->attr_count;
+            va->pair_attrs = realloc(va->pair_attrs, sizeof(*va->pair_attrs) * attr_total);
+            if (!va->pair_attrs && attr_total)
+                va_die("failed to alloc pair attrs");
+
+            uint32_t *values = va->pair_attrs + pair->attr_offset;
+            for (int k = 0; k < VAConfigAttribTypeMax; k++) {
+                if (attrs[k].value != VA_ATTRIB_NOT_SUPPORTED)
+                    *values++ = attrs[k].value;
+            }
+
             pair++;
         }
     }
@@ -252,22 +776,33 @@ va_init(struct va *va, const struct va_init_params *params)
     if (params)
         va->params = *params;
 
+    va_trace_init(va);
+
+    va_trace_begin(va, "init");
     va_init_display(va);
     va_init_pairs(va);
     va_init_images(va);
     va_init_subpics(va);
+    va_trace_end(va, "init");
 }
 
 static inline void
 va_cleanup(struct va *va)
 {
+    if (va->params.stats)
+        va_stats_dump(va);
+    free(va->stats.objects);
+
     free(va->subpic_formats);
     free(va->img_formats);
+    free(va->pair_attrs);
     free(va->pairs);
     free(va->attrs);
 
     vaTerminate(va->display);
     close(va->native_display);
+
+    va_trace_cleanup(va);
 }
 
 static inline const struct va_pair *
@@ -281,6 +816,29 @@ va_find_pair(const struct va *va, VAProfile profile, VAEntrypoint entrypoint)
     return NULL;
 }
 
+static inline bool
+va_pair_has_attr(const struct va_pair *pair, VAConfigAttribType type)
+{
+    if ((unsigned int)type >= VAConfigAttribTypeMax)
+        return false;
+    return pair->attr_mask[type / 64] & (1ull << (type % 64));
+}
+
+static inline uint32_t
+va_pair_get_attr(const struct va *va, const struct va_pair *pair, VAConfigAttribType type)
+{
+    if (!va_pair_has_attr(pair, type))
+        return VA_ATTRIB_NOT_SUPPORTED;
+
+    /* the rank of the bit among the set bits is the index of the value */
+    uint32_t rank = __builtin_popcountll(pair->attr_mask[type / 64] &
+                                         ((1ull << (type % 64)) - 1));
+    for (uint32_t i = 0; i < (uint32_t)type / 64; i++)
+        rank += __builtin_popcountll(pair->attr_mask[i]);
+
+    return va->pair_attrs[pair->attr_offset + rank];
+}
+
 static inline VAConfigID
 va_create_config(struct va *va,
                  VAProfile profile,
@@ -293,8 +851,10 @@ va_create_config(struct va *va,
     attrs[attr_count].type = VAConfigAttribRTFormat;
     attrs[attr_count++].value = rt_formats;
 
+    const uint64_t begin = va_call_begin(va, VA_CALL_CREATE_CONFIG);
     VAConfigID config;
     va->status = vaCreateConfig(va->display, profile, entrypoint, attrs, attr_count, &config);
+    va_call_end(va, VA_CALL_CREATE_CONFIG, begin);
     va_check(va, "failed to create config");
 
     return config;
@@ -303,7 +863,9 @@ va_create_config(struct va *va,
 static inline void
 va_destroy_config(struct va *va, VAConfigID config)
 {
+    const uint64_t begin = va_call_begin(va, VA_CALL_DESTROY_CONFIG);
     va->status = vaDestroyConfig(va->display, config);
+    va_call_end(va, VA_CALL_DESTROY_CONFIG, begin);
     va_check(va, "failed to destroy config");
 }
 
@@ -318,34 +880,288 @@ va_create_surface(
     attrs[attr_count].value.type = VAGenericValueTypeInteger;
     attrs[attr_count++].value.value.i = fourcc;
 
+    const uint64_t begin = va_call_begin(va, VA_CALL_CREATE_SURFACE);
     VASurfaceID surf;
     va->status =
         vaCreateSurfaces(va->display, rt_format, width, height, &surf, 1, attrs, attr_count);
+    va_call_end(va, VA_CALL_CREATE_SURFACE, begin);
     va_check(va, "failed to create surface");
 
+    va_stats_add_object(va, VA_OBJECT_SURFACE, surf,
+                        va_stats_surface_size(fourcc, width, height));
+
+    return surf;
+}
+
+/* returns the integer value of a surface attr, or fallback when the driver
+ * does not report it
+ */
+static inline int
+va_query_surface_attr(struct va *va, VAConfigID config, VASurfaceAttribType type, int fallback)
+{
+    unsigned int count;
+    va->status = vaQuerySurfaceAttributes(va->display, config, NULL, &count);
+    va_check(va, "failed to query surface attr count");
+
+    VASurfaceAttrib *attrs = malloc(sizeof(*attrs) * count);
+    if (!attrs)
+        va_die("failed to alloc surface attrs");
+    va->status = vaQuerySurfaceAttributes(va->display, config, attrs, &count);
+    va_check(va, "failed to query surface attrs");
+
+    int val = fallback;
+    for (unsigned int i = 0; i < count; i++) {
+        if (attrs[i].type == type && attrs[i].flags != VA_SURFACE_ATTRIB_NOT_SUPPORTED &&
+            attrs[i].value.type == VAGenericValueTypeInteger)
+            val = attrs[i].value.value.i;
+    }
+
+    free(attrs);
+
+    return val;
+}
+
+/* a conservative layout that satisfies the pitch and height alignment of
+ * common drivers
+ */
+static inline void
+va_userptr_layout(VASurfaceAttribExternalBuffers *desc,
+                  unsigned int fourcc,
+                  unsigned int width,
+                  unsigned int height)
+{
+    const uint32_t pitch = (width + VA_USERPTR_PITCH_ALIGN - 1) & ~(VA_USERPTR_PITCH_ALIGN - 1);
+    const uint32_t aligned_height =
+        (height + VA_USERPTR_HEIGHT_ALIGN - 1) & ~(VA_USERPTR_HEIGHT_ALIGN - 1);
+
+    memset(desc, 0, sizeof(*desc));
+    desc->pixel_format = fourcc;
+    desc->width = width;
+    desc->height = height;
+
+    switch (fourcc) {
+    case VA_FOURCC_NV12:
+        desc->num_planes = 2;
+        desc->pitches[0] = pitch;
+        desc->pitches[1] = pitch;
+        desc->offsets[0] = 0;
+        desc->offsets[1] = pitch * aligned_height;
+        desc->data_size = desc->offsets[1] + pitch * aligned_height / 2;
+        break;
+    default:
+        va_die("unsupported user pointer fourcc 0x%x", fourcc);
+    }
+}
+
+/* the caller owns ptr, which must stay valid until the surface is destroyed */
+static inline VASurfaceID
+va_create_surface_userptr(struct va *va,
+                          unsigned int rt_format,
+                          const VASurfaceAttribExternalBuffers *desc,
+                          void *ptr)
+{
+    uintptr_t buf = (uintptr_t)ptr;
+    VASurfaceAttribExternalBuffers ext = *desc;
+    ext.buffers = &buf;
+    ext.num_buffers = 1;
+
+    VASurfaceAttrib attrs[VASurfaceAttribCount];
+    int attr_count = 0;
+
+    attrs[attr_count].type = VASurfaceAttribPixelFormat;
+    attrs[attr_count].flags = VA_SURFACE_ATTRIB_SETTABLE;
+    attrs[attr_count].value.type = VAGenericValueTypeInteger;
+    attrs[attr_count++].value.value.i = desc->pixel_format;
+
+    attrs[attr_count].type = VASurfaceAttribMemoryType;
+    attrs[attr_count].flags = VA_SURFACE_ATTRIB_SETTABLE;
+    attrs[attr_count].value.type = VAGenericValueTypeInteger;
+    attrs[attr_count++].value.value.i = VA_SURFACE_ATTRIB_MEM_TYPE_USER_PTR;
+
+    attrs[attr_count].type = VASurfaceAttribExternalBufferDescriptor;
+    attrs[attr_count].flags = VA_SURFACE_ATTRIB_SETTABLE;
+    attrs[attr_count].value.type = VAGenericValueTypePointer;
+    attrs[attr_count++].value.value.p = &ext;
+
+    const uint64_t begin = va_call_begin(va, VA_CALL_CREATE_SURFACE);
+    VASurfaceID surf;
+    va->status = vaCreateSurfaces(va->display, rt_format, desc->width, desc->height, &surf, 1,
+                                  attrs, attr_count);
+    va_call_end(va, VA_CALL_CREATE_SURFACE, begin);
+    va_check(va, "failed to create user pointer surface");
+
+    /* the memory is not allocated by the driver */
+    va_stats_add_object(va, VA_OBJECT_SURFACE, surf, 0);
+
     return surf;
 }
 
 static inline void
 va_destroy_surface(struct va *va, VASurfaceID surf)
 {
+    const uint64_t begin = va_call_begin(va, VA_CALL_DESTROY_SURFACE);
     va->status = vaDestroySurfaces(va->display, &surf, 1);
+    va_call_end(va, VA_CALL_DESTROY_SURFACE, begin);
     va_check(va, "failed to destroy surface");
+
+    va_stats_remove_object(va, VA_OBJECT_SURFACE, surf);
 }
 
+/* without vaSyncSurface2, the sync blocks for this call and is counted as
+ * a fallback; the selected mode stays for the report
+ */
 static inline void
-va_sync_surface(struct va *va, VASurfaceID surf)
+va_sync_surface_timed(struct va *va,
+                      VASurfaceID surf,
+                      uint64_t deadline,
+                      uint64_t *calls,
+                      uint64_t *timeouts,
+                      uint64_t *fallbacks)
+{
+#if VA_CHECK_VERSION(1, 9, 0)
+    const uint64_t timeout =
+        va->params.sync_timeout_ns ? va->params.sync_timeout_ns : VA_SYNC_DEFAULT_TIMEOUT_NS;
+
+    while (!va->sync_fallback) {
+        va->status = vaSyncSurface2(va->display, surf, timeout);
+        (*calls)++;
+        if (va->status == VA_STATUS_ERROR_UNIMPLEMENTED) {
+            va_log("no vaSyncSurface2 support; timed syncs block");
+            va->sync_fallback = true;
+            break;
+        }
+        if (va->status != VA_STATUS_ERROR_TIMEDOUT)
+            return;
+        (*timeouts)++;
+        if (va_now() >= deadline) {
+            va->sync_expired = true;
+            return;
+        }
+    }
+#else
+    if (!va->sync_fallback) {
+        va_log("no vaSyncSurface2 in this libva; timed syncs block");
+        va->sync_fallback = true;
+    }
+#endif
+
+    va->status = vaSyncSurface(va->display, surf);
+    (*calls)++;
+    (*fallbacks)++;
+}
+
+static inline void
+va_sync_surface_poll(struct va *va,
+                     VASurfaceID surf,
+                     uint64_t deadline,
+                     uint64_t *calls,
+                     uint64_t *timeouts)
 {
+    uint64_t delay = VA_SYNC_POLL_MIN_NS;
+
+    while (true) {
+        VASurfaceStatus status;
+        va->status = vaQuerySurfaceStatus(va->display, surf, &status);
+        (*calls)++;
+        if (va->status != VA_STATUS_SUCCESS)
+            return;
+        if (!(status & VASurfaceRendering))
+            break;
+        if (va_now() >= deadline) {
+            (*timeouts)++;
+            va->sync_expired = true;
+            va->status = VA_SYNC_STATUS_TIMEDOUT;
+            return;
+        }
+
+        const struct timespec ts = {
+            .tv_sec = delay / 1000000000ull,
+            .tv_nsec = delay % 1000000000ull,
+        };
+        nanosleep(&ts, NULL);
+        delay = MIN2(delay * 2, VA_SYNC_POLL_MAX_NS);
+    }
+
+    /* the surface is idle; only vaSyncSurface reports decode errors */
     va->status = vaSyncSurface(va->display, surf);
+    (*calls)++;
+}
+
+/* waits like va_sync_surface but returns the status to the caller; timed and
+ * polled waits give up after the deadline, which sets va->sync_expired
+ */
+static inline VAStatus
+va_sync_surface_status(struct va *va, VASurfaceID surf)
+{
+    const uint64_t begin = va_call_begin(va, VA_CALL_SYNC_SURFACE);
+    const uint64_t cpu_begin = va->params.stats ? va_thread_cpu_now() : 0;
+    const uint64_t deadline = va_now() + (va->params.sync_deadline_ns
+                                              ? va->params.sync_deadline_ns
+                                              : VA_SYNC_DEFAULT_DEADLINE_NS);
+    uint64_t calls = 0;
+    uint64_t timeouts = 0;
+    uint64_t fallbacks = 0;
+    va->sync_expired = false;
+
+    switch (va->params.sync_mode) {
+    case VA_SYNC_BLOCKING:
+    default:
+        va->status = vaSyncSurface(va->display, surf);
+        calls++;
+        break;
+    case VA_SYNC_TIMED:
+        va_sync_surface_timed(va, surf, deadline, &calls, &timeouts, &fallbacks);
+        break;
+    case VA_SYNC_POLL:
+        va_sync_surface_poll(va, surf, deadline, &calls, &timeouts);
+        break;
+    }
+
+    if (va->params.stats) {
+        struct va_sync_stats *sync = &va->stats.sync;
+        sync->count++;
+        sync->wait_ns += va_now() - begin;
+        sync->cpu_ns += va_thread_cpu_now() - cpu_begin;
+        sync->calls += calls;
+        sync->timeouts += timeouts;
+        sync->fallbacks += fallbacks;
+    }
+
+    va_call_end(va, VA_CALL_SYNC_SURFACE, begin);
+
+    return va->status;
+}
+
+/* describes why va_sync_surface_status failed */
+static inline const char *
+va_sync_error_str(const struct va *va)
+{
+    return va->sync_expired ? "not ready by the sync deadline" : vaErrorStr(va->status);
+}
+
+static inline void
+va_sync_surface(struct va *va, VASurfaceID surf)
+{
+    va_sync_surface_status(va, surf);
+    if (va->sync_expired)
+        va_die("surface %u is not ready by the sync deadline", surf);
     va_check(va, "failed to sync surface");
 }
 
 static inline VAContextID
-va_create_context(
-    struct va *va, VAConfigID config, int width, int height, int flag, VASurfaceID surf)
+va_create_context(struct va *va,
+                  VAConfigID config,
+                  int width,
+                  int height,
+                  int flag,
+                  const VASurfaceID *surfs,
+                  int surf_count)
 {
+    const uint64_t begin = va_call_begin(va, VA_CALL_CREATE_CONTEXT);
     VAContextID ctx;
-    va->status = vaCreateContext(va->display, config, width, height, flag, &surf, 1, &ctx);
+    va->status = vaCreateContext(va->display, config, width, height, flag, (VASurfaceID *)surfs,
+                                 surf_count, &ctx);
+    va_call_end(va, VA_CALL_CREATE_CONTEXT, begin);
     va_check(va, "failed to create context");
 
     return ctx;
@@ -354,7 +1170,9 @@ va_create_context(
 static inline void
 va_destroy_context(struct va *va, VAContextID ctx)
 {
+    const uint64_t begin = va_call_begin(va, VA_CALL_DESTROY_CONTEXT);
     va->status = vaDestroyContext(va->display, ctx);
+    va_call_end(va, VA_CALL_DESTROY_CONTEXT, begin);
     va_check(va, "failed to destroy context");
 }
 
@@ -362,25 +1180,35 @@ static inline VABufferID
 va_create_buffer(
     struct va *va, VAContextID ctx, VABufferType type, unsigned int size, const void *data)
 {
+    const uint64_t begin = va_call_begin(va, VA_CALL_CREATE_BUFFER);
     VABufferID buf;
     va->status = vaCreateBuffer(va->display, ctx, type, size, 1, (void *)data, &buf);
+    va_call_end(va, VA_CALL_CREATE_BUFFER, begin);
     va_check(va, "failed to create buffer");
 
+    va_stats_add_object(va, VA_OBJECT_BUFFER, buf, size);
+
     return buf;
 }
 
 static inline void
 va_destroy_buffer(struct va *va, VABufferID buf)
 {
+    const uint64_t begin = va_call_begin(va, VA_CALL_DESTROY_BUFFER);
     va->status = vaDestroyBuffer(va->display, buf);
+    va_call_end(va, VA_CALL_DESTROY_BUFFER, begin);
     va_check(va, "failed to destroy buffer");
+
+    va_stats_remove_object(va, VA_OBJECT_BUFFER, buf);
 }
 
 static inline void *
 va_map_buffer(struct va *va, VABufferID buf)
 {
+    const uint64_t begin = va_call_begin(va, VA_CALL_MAP_BUFFER);
     void *ptr;
     va->status = vaMapBuffer(va->display, buf, &ptr);
+    va_call_end(va, VA_CALL_MAP_BUFFER, begin);
     va_check(va, "failed to map buffer");
     return ptr;
 }
@@ -388,28 +1216,36 @@ va_map_buffer(struct va *va, VABufferID buf)
 static inline void
 va_unmap_buffer(struct va *va, VABufferID buf)
 {
+    const uint64_t begin = va_call_begin(va, VA_CALL_UNMAP_BUFFER);
     va->status = vaUnmapBuffer(va->display, buf);
+    va_call_end(va, VA_CALL_UNMAP_BUFFER, begin);
     va_check(va, "failed to unmap buffer");
 }
 
 static inline void
 va_begin_picture(struct va *va, VAContextID ctx, VASurfaceID surf)
 {
+    const uint64_t begin = va_call_begin(va, VA_CALL_BEGIN_PICTURE);
     va->status = vaBeginPicture(va->display, ctx, surf);
+    va_call_end(va, VA_CALL_BEGIN_PICTURE, begin);
     va_check(va, "failed to begin picture");
 }
 
 static inline void
 va_render_picture(struct va *va, VAContextID ctx, const VABufferID *bufs, int count)
 {
+    const uint64_t begin = va_call_begin(va, VA_CALL_RENDER_PICTURE);
     va->status = vaRenderPicture(va->display, ctx, (VABufferID *)bufs, count);
+    va_call_end(va, VA_CALL_RENDER_PICTURE, begin);
     va_check(va, "failed to render picture");
 }
 
 static inline void
 va_end_picture(struct va *va, VAContextID ctx)
 {
+    const uint64_t begin = va_call_begin(va, VA_CALL_END_PICTURE);
     va->status = vaEndPicture(va->display, ctx);
+    va_call_end(va, VA_CALL_END_PICTURE, begin);
     va_check(va, "failed to end picture");
 }
 
@@ -420,42 +1256,58 @@ va_create_image(struct va *va, int width, int height, int fourcc, VAImage *img)
         .fourcc = fourcc,
     };
 
+    const uint64_t begin = va_call_begin(va, VA_CALL_CREATE_IMAGE);
     va->status = vaCreateImage(va->display, &format, width, height, img);
+    va_call_end(va, VA_CALL_CREATE_IMAGE, begin);
     va_check(va, "failed to create image");
+
+    va_stats_add_object(va, VA_OBJECT_IMAGE, img->image_id, img->data_size);
 }
 
 static inline void
 va_destroy_image(struct va *va, VAImageID img)
 {
+    const uint64_t begin = va_call_begin(va, VA_CALL_DESTROY_IMAGE);
     va->status = vaDestroyImage(va->display, img);
+    va_call_end(va, VA_CALL_DESTROY_IMAGE, begin);
     va_check(va, "failed to destroy image");
+
+    va_stats_remove_object(va, VA_OBJECT_IMAGE, img);
 }
 
+/* reads back the width x height rectangle at (x, y) of the surface */
 static inline void
-va_get_image(
-    struct va *va, VASurfaceID surf, unsigned int width, unsigned int height, VAImageID img)
+va_get_image(struct va *va,
+             VASurfaceID surf,
+             int x,
+             int y,
+             unsigned int width,
+             unsigned int height,
+             VAImageID img)
 {
-    va->status = vaGetImage(va->display, surf, 0, 0, width, height, img);
+    const uint64_t begin = va_call_begin(va, VA_CALL_GET_IMAGE);
+    va->status = vaGetImage(va->display, surf, x, y, width, height, img);
+    va_call_end(va, VA_CALL_GET_IMAGE, begin);
     va_check(va, "failed to get image");
 }
 
 static inline void
-va_save_image(struct va *va, const VAImage *img, const char *filename)
+va_save_nv12(const void *ptr,
+             uint32_t width,
+             uint32_t height,
+             const uint32_t *pitches,
+             const uint32_t *offsets,
+             const char *filename)
 {
-    if (img->format.fourcc != VA_FOURCC_NV12)
-        va_die("only VA_FOURCC_NV12 is supported");
-
-    void *ptr = va_map_buffer(va, img->buf);
-
     FILE *fp = fopen(filename, "w");
     if (!fp)
         va_die("failed to open %s", filename);
 
-    fprintf(fp, "P6 %u %u %u\n", img->width, img->height, 255);
-    for (uint32_t y = 0; y < img->height; y++) {
-        for (uint32_t x = 0; x < img->width; x++) {
-            const uint8_t *yy = ptr + img->offsets[0] + img->pitches[0] * y + x;
-            const uint8_t *uv = ptr + img->offsets[1] + img->pitches[1] * (y / 2) + (x & ~1);
+    fprintf(fp, "P6 %u %u %u\n", width, height, 255);
+    for (uint32_t y = 0; y < height; y++) {
+        for (uint32_t x = 0; x < width; x++) {
+            const uint8_t *yy = ptr + offsets[0] + pitches[0] * y + x;
+            const uint8_t *uv = ptr + offsets[1] + pitches[1] * (y / 2) + (x & ~1);
 
             const int yuv[3] = { (int)*yy, (int)uv[0] - 128, (int)uv[1] - 128 };
             const int rgb[3] = { yuv[0] + 1.402000f * yuv[2],
@@ -470,10 +1322,73 @@ va_save_image(struct va *va, const VAImage *img, const char *filename)
     }
 
     fclose(fp);
+}
 
+static inline void
+va_save_image(struct va *va, const VAImage *img, const char *filename)
+{
+    if (img->format.fourcc != VA_FOURCC_NV12)
+        va_die("only VA_FOURCC_NV12 is supported");
+
+    void *ptr = va_map_buffer(va, img->buf);
+    va_save_nv12(ptr, img->width, img->height, img->pitches, img->offsets, filename);
     va_unmap_buffer(va, img->buf);
 }
 
+/* resident set size of the process, or 0 when unknown */
+static inline uint64_t
+va_rss_bytes(void)
+{
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if (!fp)
+        return 0;
+
+    unsigned long size;
+    unsigned long resident;
+    if (fscanf(fp, "%lu %lu", &size, &resident) != 2)
+        resident = 0;
+    fclose(fp);
+
+    return (uint64_t)resident * sysconf(_SC_PAGESIZE);
+}
+
+static inline int
+va_stats_live_objects(const struct va *va)
+{
+    int count = 0;
+    for (int i = 0; i < VA_OBJECT_COUNT; i++)
+        count += va->stats.live_counts[i];
+    return count;
+}
+
+/* page-aligned host memory that is reused until a larger size is requested */
+static inline void *
+va_arena_reserve(struct va_arena *arena, size_t size)
+{
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    size = (size + page_size - 1) & ~(page_size - 1);
+    if (size <= arena->size)
+        return arena->ptr;
+
+    if (arena->ptr)
+        munmap(arena->ptr, arena->size);
+
+    arena->ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (arena->ptr == MAP_FAILED)
+        va_die("failed to map arena");
+    arena->size = size;
+
+    return arena->ptr;
+}
+
+static inline void
+va_arena_cleanup(struct va_arena *arena)
+{
+    if (arena->ptr)
+        munmap(arena->ptr, arena->size);
+    memset(arena, 0, sizeof(*arena));
+}
+
 static inline const void *
 va_map_file(struct va *va, const char *filename, size_t *out_size)
 {